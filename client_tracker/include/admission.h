@@ -0,0 +1,65 @@
+/*
+ * Swarthmore College, CS 87
+ * Copyright (c) 2020 Swarthmore College Computer Science Department,
+ * Swarthmore PA, Professor Tia Newhall
+ *
+ * SLY: admission.h
+ * Authors: Sasha Casada, Yatin Lala, and Leo Douhovnikoff (12-18-2023)
+ */
+
+#ifndef _ADMISSION_H_
+#define _ADMISSION_H_
+
+#define ADMISSION_INIT_LIMIT    64      // concurrent transfers allowed at start
+#define ADMISSION_MAX_LIMIT     4096    // never allow more than this many
+#define ADMISSION_SLOT_FACTOR   4       // floor of the limit, x upload slots
+#define ADMISSION_QUEUE         256     // leechers that may wait for a transfer
+#define ADMISSION_INTERVAL_MS   1000    // how often the limit is re-tuned
+#define ADMISSION_STEP          8       // transfers added/removed per probe
+#define ADMISSION_GAIN_PCT      5       // throughput gain that keeps a probe
+#define ADMISSION_HOLD          5       // intervals to sit still after a miss
+#define ADMISSION_BACKLOG_JOBS  64      // queued disk/I/O jobs = saturated
+#define RETRY_MIN_MS            250     // bounds on the BUSY backoff hint
+#define RETRY_MAX_MS            30000
+
+/* admission_enter() results */
+#define ADMIT_OK                0       // go ahead with the transfer
+#define ADMIT_QUEUED            1       // wait for admission_dequeue()
+#define ADMIT_BUSY              2       // turn the leecher away for now
+
+/* counters for the log */
+struct admission_stats {
+  int active;                     // transfers admitted and not yet done
+  int queued;                     // leechers waiting for a transfer
+  int limit;                      // current cap on (active)
+  long admitted, rejected;        // ever let in / ever sent BUSY
+  double rate;                    // bytes/sec sent over the last interval
+};
+
+/* start with a floor of ADMISSION_SLOT_FACTOR * (upload_slots) transfers,
+ * so the choker always has peers to rotate through */
+void admission_init(int upload_slots);
+
+/* a leecher finished its handshake: admit it, queue it, or turn it away */
+int admission_enter(void);
+
+/* move the oldest queued leecher to active if the limit allows. returns 1
+ * if the caller may start the transfer it is holding */
+int admission_dequeue(void);
+
+/* an admitted transfer is done after (ms) milliseconds */
+void admission_exit(long ms);
+
+/* account (bytes) of chunk data sent, the throughput the limit chases */
+void admission_sent(long bytes);
+
+/* re-tune the limit once every ADMISSION_INTERVAL_MS. (backlog) is the
+ * number of jobs waiting on the disk and I/O pools */
+void admission_tick(int backlog);
+
+/* milliseconds a turned away leecher should wait before trying again */
+int admission_retry_ms(void);
+
+void admission_get_stats(struct admission_stats *stats);
+
+#endif
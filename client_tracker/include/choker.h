@@ -0,0 +1,58 @@
+/*
+ * Swarthmore College, CS 87
+ * Copyright (c) 2020 Swarthmore College Computer Science Department,
+ * Swarthmore PA, Professor Tia Newhall
+ *
+ * SLY: choker.h
+ * Authors: Sasha Casada, Yatin Lala, and Leo Douhovnikoff (12-18-2023)
+ */
+
+#ifndef _CHOKER_H_
+#define _CHOKER_H_
+
+#include <pthread.h>
+
+#define DEFAULT_UPLOAD_SLOTS    4       // # of leechers served at once
+#define RECHOKE_INTERVAL        10      // seconds between rechoke rounds
+#define OPTIMISTIC_INTERVAL     3       // rechoke rounds per optimistic unchoke
+#define IDLE_RATE               1024    // smoothed bytes/sec that count as 0
+
+/* per-leecher choke state. a leecher is held in the choked state (blocked
+ * on the choker's condition variable) until the scheduler hands it one of
+ * the upload slots.
+ */
+struct choke_peer {
+  int choked;               // 1 while the peer must wait for a slot
+  int whole_round;          // 1 if it has held a slot since the round began
+  int optimistic;           // 1 if peer holds the optimistic unchoke slot
+  long bytes_round;         // bytes sent to peer during this rechoke round
+  double rate;              // smoothed upload rate to the peer (bytes/sec)
+  long seq;                 // arrival order, breaks ties first-come first-serve
+  struct choke_peer *prev, *next;   // neighbours in the interested list
+  struct choke_peer *wait_prev, *wait_next;   // and in the slot queue
+};
+
+/* initialize the choker with (slots) upload slots and start the rechoke
+ * thread. must be called once before seed_provide() */
+void choker_init(int slots);
+
+/* add a peer who is interested in chunks to the scheduler */
+void choker_register(struct choke_peer *peer);
+
+/* remove a peer from the scheduler, freeing its slot for a queued peer */
+void choker_unregister(struct choke_peer *peer);
+
+/* block the calling connection until (peer) holds an upload slot */
+void choker_wait_unchoked(struct choke_peer *peer);
+
+/* non-blocking check whether (peer) currently holds an upload slot */
+int choker_is_unchoked(struct choke_peer *peer);
+
+/* have the choker write to eventfd (fd) whenever slots are reassigned, so
+ * an event loop can retry its choked connections */
+void choker_set_notify(int fd);
+
+/* account (bytes) of chunk data sent to (peer) in the current round */
+void choker_record(struct choke_peer *peer, long bytes);
+
+#endif
@@ -0,0 +1,63 @@
+/*
+ * Swarthmore College, CS 87
+ * Copyright (c) 2020 Swarthmore College Computer Science Department,
+ * Swarthmore PA, Professor Tia Newhall
+ *
+ * SLY: diskq.h
+ * Authors: Sasha Casada, Yatin Lala, and Leo Douhovnikoff (12-18-2023)
+ */
+
+#ifndef _DISKQ_H_
+#define _DISKQ_H_
+
+#include <pthread.h>
+#include <sys/types.h>
+#include "workpool.h"
+
+#define DISKQ_BUFFERS           64      // chunks that may be waiting on disk
+#define DISKQ_WRITERS           2       // threads writing them out
+#define DISKQ_ALIGN             4096    // buffer/offset alignment for O_DIRECT
+
+/* one chunk on its way to disk. receivers fill (data) and hand it to
+ * diskq_write(), a writer puts it back on the free list when done */
+struct disk_buf {
+  char *data;                     // buf_size bytes
+  size_t len;                     // bytes of (data) to write
+  off_t offset;                   // where they go in (fd)
+  int fd;
+  int sync;                       // 1 to fdatasync(fd) after the write
+  void (*done)(struct disk_buf *b, int failed); // called once written
+  void *arg;                      // for (done)
+  struct diskq *q;                // queue the buffer belongs to
+  struct disk_buf *next;          // next free buffer
+};
+
+/* a bounded write-behind queue: a fixed set of buffers cycles between the
+ * network threads and a pool of writers. a receiver only waits when every
+ * buffer is still queued for the disk */
+struct diskq {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;            // a buffer came back
+  struct disk_buf *free_bufs;
+  int nbufs, nfree;
+  long stalls;                    // times a receiver had to wait
+  int errors;                     // failed writes since the last drain
+  struct workpool pool;           // the writers
+};
+
+/* allocate (nbufs) buffers of (buf_size) bytes and start (nwriters) */
+void diskq_init(struct diskq *q, size_t buf_size, int nbufs, int nwriters);
+
+/* take a free buffer, waiting for the writers if there is none */
+struct disk_buf *diskq_get(struct diskq *q);
+
+/* give back a buffer from diskq_get() without writing it */
+void diskq_put(struct diskq *q, struct disk_buf *b);
+
+/* queue (b) to be written; it goes back on the free list afterwards */
+void diskq_write(struct diskq *q, struct disk_buf *b);
+
+/* wait until every queued write is done. returns the # that failed */
+int diskq_drain(struct diskq *q);
+
+#endif
@@ -0,0 +1,48 @@
+/*
+ * Swarthmore College, CS 87
+ * Copyright (c) 2020 Swarthmore College Computer Science Department,
+ * Swarthmore PA, Professor Tia Newhall
+ *
+ * SLY: filecache.h
+ * Authors: Sasha Casada, Yatin Lala, and Leo Douhovnikoff (12-18-2023)
+ */
+
+#ifndef _FILECACHE_H_
+#define _FILECACHE_H_
+
+#include <sys/types.h>
+
+#define FILECACHE_HASHSIZE      101     // buckets in the open file table
+#define FILECACHE_EVENTS        (IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | \
+                                 IN_DELETE_SELF)  // changes that invalidate
+
+/* an open seed file shared by every connection serving it. (fd) and the
+ * metadata stay valid for as long as a reference is held, even if the
+ * file changes on disk and the entry is dropped from the table
+ */
+struct seed_file {
+  char *path;               // path the file was opened by
+  dev_t dev;                // device and inode the fd refers to
+  ino_t ino;
+  off_t size;               // file size when it was opened
+  int fd;                   // read only descriptor
+  int wd;                   // inotify watch, -1 if none
+  int refs;                 // connections using the entry
+  int stale;                // 1 once the file changed; no new references
+  struct seed_file *next;   // next entry in the hash chain
+};
+
+/* set up the table and start the inotify thread */
+void filecache_init(void);
+
+/* return a referenced entry for (path), opening it only if it isn't open
+ * already or the open copy went stale. NULL if it can't be opened */
+struct seed_file *filecache_open(char *path);
+
+/* take another reference on (f), e.g. for a job that outlives the caller's */
+void filecache_ref(struct seed_file *f);
+
+/* drop a reference from filecache_open() or filecache_ref() */
+void filecache_close(struct seed_file *f);
+
+#endif
@@ -1,7 +1,7 @@
-/* 
- * C dictionary implementation from: 
+/*
+ * C dictionary implementation from:
  * https://stackoverflow.com/questions/4384359/quick-way-to-implement-dictionary-in-c
- * 
+ *
  * Written by Vijay Mathew <http://vmathew.in/>.
  *
  *
@@ -11,36 +11,75 @@
 #ifndef _HASHTABLE_H_
 #define _HASHTABLE_H_
 
-#define HASHSIZE        101
-#define MAX_PEERS       256   // max # of peers that a file can support
+#include <pthread.h>
+
+#define HASH_SHARDS     64    // independently locked parts of the table
+#define HASH_MIN_BUCKETS 16   // buckets a shard starts with (power of 2)
+#define HASH_MAX_LOAD   2     // entries per bucket before a shard doubles
+#define MIN_PEERS       8     // peers a swarm has room for at first
+
+/* hash_lock() modes */
+#define HASH_READ       0
+#define HASH_WRITE      1
 
 ///////////////////////////////////////////////////////////////////////////////
 
+struct peer_timer;
+
 /* struct that encapsulates all of the peer information
  */
 struct peer_info {
-  char *peers[MAX_PEERS]; // the list of all peer IPs
+  unsigned char *peers;   // COMPACT_PEER_LEN bytes for each peer
+  struct peer_timer **timers; // when each peer in (peers) expires
   int curr_peers;         // the total # of active peers
+  int max_peers;          // room in (peers), doubled when full
+  struct peer_timer **slots; // (timers) by address and port, 2 * max_peers
+  long completed;         // # of downloads announced COMPLETED
+  pthread_mutex_t shuffle_lock; // readers reordering (peers) in place
 };
 
 struct nlist { /* table entry: */
     struct nlist *next; /* next entry in chain */
     char *name; /* defined name */
     struct peer_info *defn; /* replacement text */
+    unsigned hashval; /* hash(name), kept for resizing */
 };
 
-extern struct nlist *hashtab[HASHSIZE];
+/* one part of the table. its lock covers the chains and the (defn)s of
+ * every entry in it */
+struct hash_shard {
+    pthread_rwlock_t lock;
+    struct nlist **buckets;
+    unsigned nbuckets; /* a power of 2 */
+    long count;
+};
 
 /* hash: form hash value for string s */
 unsigned hash(char *s);
 
-/* lookup: look for s in hashtab */
+/* index of the shard that holds (or would hold) s */
+unsigned hash_shard(char *s);
+
+/* lock the shard that holds (or would hold) s, HASH_READ or HASH_WRITE */
+void hash_lock(char *s, int mode);
+
+/* unlock the shard that holds s */
+void hash_unlock(char *s);
+
+/* lookup: look for s in hashtab (its shard locked) */
 struct nlist *hash_lookup(char *s);
 
-/* install: put (name, defn) in hashtab */
+/* install: put (name, defn) in hashtab, unless name is already there.
+ * returns the entry for name (its shard write locked) */
 struct nlist *hash_install(char *name, struct peer_info *defn);
 
+/* call fn on every entry of hashtab, each shard read locked in turn */
+void hash_foreach(void (*fn)(struct nlist *np, void *arg), void *arg);
+
+/* # of entries in hashtab */
+long hash_count(void);
+
 /* make a duplicate of s */
 char *strdupl(char *s);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,92 @@
+/*
+ * Swarthmore College, CS 87
+ * Copyright (c) 2020 Swarthmore College Computer Science Department,
+ * Swarthmore PA, Professor Tia Newhall
+ *
+ * SLY: ledbat.h
+ * Authors: Sasha Casada, Yatin Lala, and Leo Douhovnikoff (12-18-2023)
+ */
+
+#ifndef _LEDBAT_H_
+#define _LEDBAT_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#define LEDBAT_MSS              1400    // max payload bytes per packet
+#define LEDBAT_WINDOW           1024    // max # of packets in flight
+#define LEDBAT_TARGET           100000  // target queuing delay (usec)
+#define LEDBAT_GAIN             1       // cwnd gain per RTT at zero delay
+#define LEDBAT_BASE_HISTORY     10      // # of 1 minute base delay minima
+#define LEDBAT_CURRENT_FILTER   4       // # of samples in the delay filter
+#define LEDBAT_MIN_CWND         2       // min congestion window in packets
+#define LEDBAT_INIT_CWND        2       // initial congestion window in packets
+#define LEDBAT_ALLOWED_INCREASE 1       // max cwnd growth past flightsize
+#define LEDBAT_MIN_RTO          200000  // retransmission timeout floor (usec)
+#define LEDBAT_MAX_RTO          2000000 // retransmission timeout cap (usec)
+#define LEDBAT_MAX_RETRIES      10      // timeouts in a row before giving up
+#define LEDBAT_IDLE_TIMEOUT     30      // seconds without packets before EOF
+
+/* one packet the sender still holds because it has not been acked yet */
+struct ledbat_packet {
+  uint32_t seq;             // packet sequence number
+  uint16_t len;             // # of payload bytes
+  uint64_t sent_us;         // local time the packet was last (re)sent
+  int retransmitted;        // 1 if resent (not used for RTT samples)
+  char data[LEDBAT_MSS];    // payload
+};
+
+/* a single LEDBAT stream. the seeder side only sends chunk data and the
+ * leecher side only receives it, so each end only uses half of the state.
+ */
+struct ledbat_sock {
+  int fd;                   // connected UDP socket
+
+  /* sender state */
+  struct ledbat_packet *window; // ring of LEDBAT_WINDOW unacked packets
+  uint32_t snd_una;         // oldest unacked sequence number
+  uint32_t snd_nxt;         // next sequence number to send
+  uint32_t snd_max;         // next sequence number never sent before
+  uint32_t recover;         // snd_max at the last window reduction
+  long flight;              // unacked payload bytes
+  double cwnd;              // congestion window in bytes
+  uint32_t last_ack;        // last cumulative ack seen
+  int dup_acks;             // # of duplicate acks for last_ack
+  int timeouts;             // consecutive retransmission timeouts
+  uint64_t srtt, rttvar, rto; // round trip estimates (usec)
+  uint32_t base_delay[LEDBAT_BASE_HISTORY]; // per-minute delay minima
+  uint64_t base_minute;     // minute the newest base_delay slot covers
+  uint32_t cur_delay[LEDBAT_CURRENT_FILTER]; // latest delay samples
+  int cur_delay_idx;
+
+  /* receiver state */
+  uint32_t rcv_nxt;         // next in-order sequence number expected
+  char *pending;            // in-order bytes not yet handed to the caller
+  int pending_off, pending_len;
+  int eof;                  // 1 once the sender has said FIN
+};
+
+/* bind (s) to an ephemeral UDP port, which is stored in (port) */
+int ledbat_listen(struct ledbat_sock *s, unsigned short *port);
+
+/* wait up to (timeout_ms) for the leecher at (peer_ip), the other end of
+ * its TCP connection, to connect to a listening (s). SYNs from anywhere
+ * else are dropped */
+int ledbat_accept(struct ledbat_sock *s, const char *peer_ip, int timeout_ms);
+
+/* connect (s) to the LEDBAT stream listening at (ip_addr):(port) */
+int ledbat_connect(struct ledbat_sock *s, char *ip_addr, unsigned short port);
+
+/* queue (len) bytes on the stream, blocking while the congestion window
+ * is full. returns len, or -1 if the peer went away */
+ssize_t ledbat_send(struct ledbat_sock *s, const void *buf, size_t len);
+
+/* block until (len) bytes are read or the stream ends; like recv() with
+ * MSG_WAITALL. returns the # of bytes read, or -1 on error */
+ssize_t ledbat_recv(struct ledbat_sock *s, void *buf, size_t len);
+
+/* flush unacked data (sender side), say FIN and release (s). a socket
+ * that failed to listen, accept or connect is already released */
+int ledbat_close(struct ledbat_sock *s);
+
+#endif
@@ -0,0 +1,65 @@
+/*
+ * Swarthmore College, CS 87
+ * Copyright (c) 2020 Swarthmore College Computer Science Department,
+ * Swarthmore PA, Professor Tia Newhall
+ *
+ * SLY: persist.h
+ * Authors: Sasha Casada, Yatin Lala, and Leo Douhovnikoff (12-18-2023)
+ */
+
+#ifndef _PERSIST_H_
+#define _PERSIST_H_
+
+#include <stdint.h>
+#include "shared.h"
+#include "hashtable.h"
+
+#define PERSIST_SNAPSHOT        "tracker.snap"  // the file index at some point
+#define PERSIST_WAL             "tracker.wal"   // every change since then
+#define PERSIST_WAL_OLD         "tracker.wal.old" // while a snapshot is taken
+#define SNAPSHOT_INTERVAL       300     // seconds between snapshots
+#define WAL_SYNC_INTERVAL       50      // ms between fdatasync()s of the WAL
+#define SNAPSHOT_MAGIC          "SLYSNAP1"
+
+/* persist_record types */
+#define PERSIST_ADD             1       // a file joined the index
+#define PERSIST_SEED            2       // a peer joined a swarm
+#define PERSIST_STOP            3       // a peer left a swarm
+#define PERSIST_COMPLETED       4       // a download of a file finished
+
+/* one change to the file index, as it is in the WAL. a snapshot is the
+ * same records, an ADD (with the file's (count) of completed downloads)
+ * followed by a SEED for each of its peers */
+struct persist_record {
+  uint8_t type;                         // PERSIST_ type
+  unsigned char peer[COMPACT_PEER_LEN]; // the peer of a SEED/STOP
+  uint8_t pad;
+  uint32_t count;                       // completed downloads, for an ADD
+  char name[64];                        // the info hash, not terminated
+};
+
+/* rebuild the index from the snapshot and WAL(s) in the working directory,
+ * handing every record to (apply) in order. (snapshot) is 1 for records
+ * from the snapshot, whose peers are never repeated. returns the # of
+ * records applied */
+long persist_recover(void (*apply)(struct persist_record *r, int snapshot));
+
+/* open the WAL for appending, once the index is recovered */
+void persist_init(void);
+
+/* append a (type) record for file (name) and (peer) (may be NULL) to the
+ * WAL. called with the shard of (name) write locked, so the WAL order is
+ * the order the index changed in. it is on disk by the next group commit
+ * of persist_loop() */
+void persist_log(int type, char *name, unsigned char *peer);
+
+/* write the whole index out as a new snapshot and drop the WAL it
+ * covers. returns 0, or -1 if the old snapshot and WAL had to stay */
+int persist_snapshot(void);
+
+/* snapshot thread: fdatasync() the WAL every WAL_SYNC_INTERVAL, and
+ * persist_snapshot() every SNAPSHOT_INTERVAL when anything was logged
+ * since the last one */
+void *persist_loop(void *args);
+
+#endif
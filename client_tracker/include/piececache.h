@@ -0,0 +1,92 @@
+/*
+ * Swarthmore College, CS 87
+ * Copyright (c) 2020 Swarthmore College Computer Science Department,
+ * Swarthmore PA, Professor Tia Newhall
+ *
+ * SLY: piececache.h
+ * Authors: Sasha Casada, Yatin Lala, and Leo Douhovnikoff (12-18-2023)
+ */
+
+#ifndef _PIECECACHE_H_
+#define _PIECECACHE_H_
+
+#include <pthread.h>
+
+#define PIECECACHE_DEFAULT_MB   64      // default cache size (-C), 0 disables
+#define PIECECACHE_SHARDS       16      // independently locked shards
+#define PIECECACHE_BUCKETS      1024    // hash buckets per shard
+#define PIECECACHE_IN_PCT       25      // % of a shard for first-time pieces
+#define PIECECACHE_OUT_PCT      50      // ghosts kept, % of the shard size
+#define PIECECACHE_SAMPLE       4       // LRU hot pieces compared on eviction
+
+/* which 2Q queue a piece is on */
+#define PIECE_IN                0       // seen once, resident (FIFO)
+#define PIECE_OUT               1       // seen once, evicted: key only
+#define PIECE_HOT               2       // seen again, resident (LRU)
+#define PIECE_GONE              3       // evicted while still referenced
+
+/* one cached chunk, or the ghost of one. (owner, chunk) is the key */
+struct piece {
+  const void *owner;            // seed file the chunk was read from
+  int chunk;                    // chunk id
+  char *data;                   // chunk bytes (NULL for ghosts)
+  long len;                     // # of bytes in (data)
+  int queue;                    // PIECE_ queue the piece is on
+  int refs;                     // connections currently sending from it
+  long hits;                    // requests served from this piece
+  struct piece *hash_next;      // next piece in the hash chain
+  struct piece *prev, *next;    // neighbours on its queue
+};
+
+/* a 2Q queue: pieces are added at the head and evicted from the tail */
+struct piece_queue {
+  struct piece *head, *tail;
+  long bytes;                   // bytes of the pieces (ghosts: virtual)
+  int count;
+};
+
+/* one independently locked part of the cache */
+struct piece_shard {
+  pthread_mutex_t lock;
+  struct piece *buckets[PIECECACHE_BUCKETS];
+  struct piece_queue in, out, hot;
+  long hits, misses, ghost_hits, evictions;
+};
+
+/* cache counters summed over all shards */
+struct piececache_stats {
+  long bytes;                   // resident bytes
+  long capacity;                // configured size in bytes
+  long hits, misses;            // lookups served from RAM / from disk
+  long ghost_hits;              // misses that were promoted as hot
+  long evictions;               // resident pieces dropped
+};
+
+/* size the cache to (capacity) bytes; 0 leaves it disabled */
+void piececache_init(long capacity);
+
+/* 1 if piececache_init() was given a non-zero size */
+int piececache_enabled(void);
+
+/* return a referenced copy of (chunk) of seed file (owner), reading (len)
+ * bytes at (offset) of (file) on a miss. NULL if the read fails. every
+ * piece returned has to be given back with piececache_put() */
+struct piece *piececache_get(const void *owner, int chunk, int file, 
+  off_t offset, long len);
+
+/* whether (chunk) of (owner) is worth serving through the cache: 1 if it
+ * is resident, or was asked for before so piececache_get() makes it hot.
+ * otherwise 0, and the caller reads the (len) bytes itself this time */
+int piececache_wanted(const void *owner, int chunk, long len);
+
+/* drop a reference taken by piececache_get() */
+void piececache_put(struct piece *p);
+
+/* forget every piece and ghost of (owner), e.g. once its file changed on
+ * disk. pieces still being sent from are freed by their last put */
+void piececache_drop_owner(const void *owner);
+
+/* snapshot the cache counters into (stats) */
+void piececache_get_stats(struct piececache_stats *stats);
+
+#endif
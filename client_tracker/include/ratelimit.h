@@ -0,0 +1,61 @@
+/*
+ * Swarthmore College, CS 87
+ * Copyright (c) 2020 Swarthmore College Computer Science Department,
+ * Swarthmore PA, Professor Tia Newhall
+ *
+ * SLY: ratelimit.h
+ * Authors: Sasha Casada, Yatin Lala, and Leo Douhovnikoff (12-18-2023)
+ */
+
+#ifndef _RATELIMIT_H_
+#define _RATELIMIT_H_
+
+#include <pthread.h>
+#include <sys/time.h>
+
+#define RATE_UNLIMITED          0       // rate value that disables a bucket
+#define LIMITS_FILE             "sly.limits"  // re-read on SIGHUP
+
+/* a token bucket which refills at (rate) bytes/sec up to (burst) bytes.
+ * buckets form a hierarchy (peer -> torrent -> global) through (parent),
+ * and a transfer has to be paid for at every level up the chain.
+ */
+struct token_bucket {
+  pthread_mutex_t lock;
+  long rate;                    // bytes per second, or RATE_UNLIMITED
+  long burst;                   // max # of tokens the bucket can hold
+  double tokens;                // current tokens; negative when in debt
+  struct timeval last;          // last time the bucket was refilled
+  struct token_bucket *parent;  // next bucket up the hierarchy (or NULL)
+  struct token_bucket *children;  // buckets right below, under (lock)
+  struct token_bucket *sibling;   // next child of (parent)
+};
+
+/* global upload/download buckets shared by every torrent and peer */
+extern struct token_bucket global_upload;
+extern struct token_bucket global_download;
+
+/* initialize (tb) to (rate) bytes/sec as a child of (parent) */
+void ratelimit_init(struct token_bucket *tb, long rate,
+  struct token_bucket *parent);
+
+/* change the rate of (tb) at runtime; takes effect on the next transfer */
+void ratelimit_set(struct token_bucket *tb, long rate);
+
+/* ratelimit_set() every bucket (depth) levels below (tb), e.g. every peer
+ * bucket with (depth) 2 under a global one */
+void ratelimit_set_below(struct token_bucket *tb, int depth, long rate);
+
+/* like ratelimit_consume() but never sleeps: returns the # of seconds the
+ * caller has to wait before sending, for callers that can't block */
+double ratelimit_reserve(struct token_bucket *tb, long bytes);
+
+/* pay for (bytes) at every level of (tb)'s hierarchy, sleeping once for
+ * the longest debt if any bucket runs dry. meant to be called once per
+ * chunk, never per byte */
+void ratelimit_consume(struct token_bucket *tb, long bytes);
+
+/* take (tb) out of its hierarchy and release any resources it holds */
+void ratelimit_destroy(struct token_bucket *tb);
+
+#endif
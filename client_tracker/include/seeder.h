@@ -11,10 +11,39 @@
 #define _PEER_H_
 
 #include "shared.h"
+#include "choker.h"
+#include "ratelimit.h"
+#include "piececache.h"
+#include "filecache.h"
 
 #define BACKLOG             12      // backlog length for listen_socket
-#define MAX_CONNECTIONS     256      // max # of connections for server  
+#define MAX_CONNECTIONS     16384   // max # of connections for server  
 #define MAX_FILENAME        1000    // max size of an allowed filename + dir
+#define LEDBAT_ACCEPT_TIMEOUT 5000  // ms to wait for a leecher's LEDBAT SYN
+#define SEND_BATCH_CHUNKS   16      // max contiguous chunks per sendfile run
+#define SEEDER_IO_THREADS   4       // pool threads running connections
+#define SEEDER_BACKLOG      4096    // listen backlog for the P2P port
+#define SEEDER_EVENTS       64      // max events taken per epoll_wait
+#define SEEDER_TICK_MS      10      // how often parked connections are checked
+#define LOOKUP_RETRY_MS     100     // retry delay while a torrent is hashing
+#define SEEDER_STATS_INTERVAL 30    // seconds between I/O pool log lines
+#define READAHEAD_MIN       4       // chunks prefetched ahead of a new peer
+#define READAHEAD_MAX       64      // chunks prefetched ahead of a fast peer
+
+/* where a leecher connection is in the seeding protocol. the event loop
+ * advances each connection as far as its socket allows and re-arms it
+ */
+enum conn_state {
+  CONN_HANDSHAKE,           // reading the handshake tag + info hash + flags
+  CONN_LOOKUP,              // waiting for the torrent to finish hashing
+  CONN_ADMIT,               // waiting for admission to start the transfer
+  CONN_SEND_STATES,         // writing handshake reply + our chunk states
+  CONN_RECV_REQUEST,        // reading the leecher's requested chunks
+  CONN_NEXT_RUN,            // picking the next run, waiting for a slot
+  CONN_THROTTLED,           // run paid for, waiting out rate limit debt
+  CONN_SEND_RUN,            // writing the run header + body
+  CONN_CLOSE                // done (or failed), release the slot
+};
 
 /* this struct represents all the data which encapsulates a single
  * user that may be connected to our messaging server at a given
@@ -25,6 +54,34 @@ struct client {
   int sockfd;               // socket file descriptor location
   char ip[INET_ADDRSTRLEN]; // ip of client
   char msg_buffer[BUFSIZE]; // message buffer per client
+  enum conn_state state;    // progress through the seeding protocol
+  struct UsageInfo *seed_info;  // torrent named in the handshake
+  char *io_buf;             // buffer of the read/write in progress
+  size_t io_len, io_off;    // its length and how much is done
+  int *requested;           // chunks the leecher asked for
+  struct seed_file *seed_file;  // shared open seed file, while serving
+  int file;                 // its descriptor
+  int next_chunk;           // first chunk not yet sent or skipped
+  int run_chunk, run_len;   // current run: first chunk and # of chunks
+  long run_bytes;           // current run length in bytes
+  long run_sent;            // bytes of the run body already sent
+  char header[sizeof(int) + sizeof(long int)];  // current run header
+  size_t header_off;        // bytes of the header already sent
+  struct piece *piece;      // cached chunk being sent, if the cache is on
+  int run_cached;           // 1 if the current run goes out of the cache
+  int uring_file;           // 1 if (file) is in our io_uring file slot
+  int uring_buf;            // io_uring buffer of the read->send in flight
+  int ra_next;              // first chunk not yet prefetched
+  int ra_window;            // # of requested chunks to prefetch ahead
+  int admitted;             // 1 once counted as an active transfer
+  struct timeval admit_tv;  // when it was admitted
+  int registered;           // 1 once added to the choker
+  int streaming;            // 1 if the leecher sends more than one request
+  int idle;                 // 1 between two requests of a streaming leecher
+  struct choke_peer choke_state;
+  struct token_bucket peer_limit;
+  struct timeval wake;      // when a parked connection should be retried
+  struct client *next;      // next in the parked or free list
 };
 
 /* struct that encapsulates all of the information that is to be
@@ -33,7 +90,7 @@ struct client {
 struct thread_info {
   int id;                // individual thread id
   int ntids;             // total active threads
-  struct UsageInfo *seed_info;
+  struct UsageInfo *seed_info; // torrent the peer asked for in its handshake
   pthread_t *pthread_id; // current pthread id
 };
 
@@ -46,9 +103,9 @@ extern struct client clients[MAX_CONNECTIONS];
 /* total number of currently connected clients */
 extern int connected_clients;
 
-/* function that creates threads for cord. of recv/send */
-void thread_init(struct client *client, struct UsageInfo *seed_info, 
-  int ntids);
+/* hands a LEDBAT connection to its own thread, since the LEDBAT sender
+ * blocks in its congestion control loop */
+int thread_init(struct client *client, int ntids);
 
 /* helper function for thread of t_main which manages send */
 void *tracker_connect();
@@ -62,7 +119,7 @@ void *client_recv(void *args);
 // /* TODO write a great comment */
 // void *thread_provide(void* args);
 
-/* initialize a connection with a leeching peer, provide chunks */
-void seed_provide(struct UsageInfo *seed_info);
+/* accept leeching peers for every torrent in the session, provide chunks */
+void seed_provide(void);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,51 @@
+/*
+ * Swarthmore College, CS 87
+ * Copyright (c) 2020 Swarthmore College Computer Science Department,
+ * Swarthmore PA, Professor Tia Newhall
+ *
+ * SLY: session.h
+ * Authors: Sasha Casada, Yatin Lala, and Leo Douhovnikoff (12-18-2023)
+ */
+
+#ifndef _SESSION_H_
+#define _SESSION_H_
+
+#include "shared.h"
+#include "workpool.h"
+
+#define SESSION_HASHSIZE        4099    // buckets in the session's torrent table
+#define HASH_WORKERS            4       // threads hashing chunks of new torrents
+#define DISK_WORKERS            2       // threads doing seed file disk checks
+
+/* session_find() results */
+#define SESSION_UNKNOWN         0       // not seeded here, or bad seed file
+#define SESSION_PENDING         1       // still being checked/hashed
+#define SESSION_READY           2
+
+/* a torrent seeded by this process. connections for it are routed here by
+ * the info hash (the file's sha256sum) the leecher sends in its handshake
+ */
+struct torrent {
+  struct UsageInfo *seed_info;  // everything needed to seed the torrent
+  int ready;                    // 1 once chunk states have been hashed
+  int failed;                   // 1 if the seed file is missing or bad
+  struct torrent *next;         // next torrent in the hash chain
+};
+
+/* pools shared by every torrent in the session */
+extern struct workpool hash_pool;
+extern struct workpool disk_pool;
+
+/* set up the torrent table and start the shared worker pools */
+void session_init(void);
+
+/* add a torrent to the session. its seed file is checked on the disk pool
+ * and hashed on the hash pool before any leecher is served from it */
+void session_add(struct UsageInfo *seed_info);
+
+/* find the torrent with (info_hash) without waiting for it to finish
+ * hashing: returns one of the SESSION_ codes and sets (seed_info) when the
+ * torrent is ready, NULL otherwise */
+int session_find(char *info_hash, struct UsageInfo **seed_info);
+
+#endif
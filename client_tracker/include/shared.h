@@ -14,6 +14,8 @@
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include "ratelimit.h"
+#include "ledbat.h"
 
 ////////////////////////// .SLY PROTOCOL DEFINITIONS //////////////////////////
 
@@ -27,10 +29,17 @@
     #define ADD_REQUEST             102
     #define SEED_REQUEST            103
     #define FILE_REQUEST            104
+    #define HANDSHAKE_LEDBAT        105     // peer handshake asking for UDP
 
     /* SERVER-TO-CLIENT COMMINICATION CODES */
     #define HANDSHAKE_OK            200
     #define HANDSHAKE_ERROR         201
+    #define HANDSHAKE_LEDBAT_OK     202     // chunk data follows over LEDBAT
+    #define HANDSHAKE_BUSY          203     // + uint16 retry-after (ms)
+
+    /* PEER HANDSHAKE FLAGS, ONE BYTE AFTER THE INFO HASH */
+    #define PEER_STREAMING          0x01    // more requests follow on the
+                                            // same connection
 
     #define ADD_APPROVED            210
     #define ADD_DENIED              211
@@ -48,6 +57,9 @@
     #define SEED_FAIL               233
 
     #define BUFSIZE   	            256
+    // a peer in a REQUEST_FOUND reply: IPv4 address then port, both in
+    // network byte order
+    #define COMPACT_PEER_LEN        6
     // max number of connections tracker will accept
     #define CONMAX   	            256 
 
@@ -79,6 +91,7 @@
     #define PEER_ID_SIZE            20
 
     /* EVENT SPECIFICATIONS */
+    #define REANNOUNCE              0       // periodic announce, no event
     #define STARTED                 1
     #define STOPPED                 2
     #define COMPLETED               3
@@ -87,6 +100,11 @@
     #define SINGLE_FILE             1
     #define MULTI_FILE              2
 
+    /* LEECHER SYNC POLICIES (-S) */
+    #define SYNC_NONE               0       // leave writeback to the kernel
+    #define SYNC_END                1       // fsync once the download is done
+    #define SYNC_CHUNK              2       // fdatasync after every chunk
+
 ///////////////////////////////////////////////////////////////////////////////
 
 /**   
@@ -106,7 +124,7 @@ typedef struct InfoDictionary {
     char *tracker_ip;           // ip of the torrent network hosting tracker
     char *file_path;            // path to our torrent file (.sly) (-a/-s/-r)
     char *file_name;               
-    int file_size;              // length of the file in bytes
+    long file_size;             // length of the file in bytes
     char sha256sum[65];         // SHA256 hexadecmial string of filesum
     int chunk_size;             // number of bytes in each piece
     int chunk_total;            // total number of chunks
@@ -118,7 +136,7 @@ typedef struct InfoDictionary {
 
 /* Encapsulates file information for MULTI_FILE mode info dictionary member */
 typedef struct InfoDictionaryFileInfo {
-    int length;                 // length of the file in bytes
+    long length;                // length of the file in bytes
     char sha256sum[65];         // SHA256 hexadecmial string of filesum
     char **path;                // list of strings containing path
                                 //      i.e, dir1/dir2/file.ext
@@ -144,6 +162,23 @@ typedef struct UsageInfo {
     int sockfd;
     int *chunk_states;
     struct InfoDictionary* info_dict; 
+
+    struct token_bucket upload_limit;   // per-torrent upload bucket
+    struct token_bucket download_limit; // per-torrent download bucket
+    long peer_rate;                     // per-peer limit in bytes/sec
+    int use_ledbat;                     // ask peers for LEDBAT transport (-b)
+    int drop_cache;                     // DONTNEED chunks once served (-N)
+    int download_fd;                    // target file, shared by peer threads
+    int sync_policy;                    // SYNC_ policy for download_fd (-S)
+    int sparse;                         // don't preallocate the download (-z)
+    int zero_copy;                      // splice chunks socket -> file (-Z)
+    struct diskq *disk_queue;           // write-behind queue for download_fd
+    int direct_io;                      // O_DIRECT writes and reads (-O)
+    int tail_fd;                        // buffered fd for an unaligned tail
+    struct stream *stream;              // in-order output while downloading (-T)
+    int *wanted;                        // chunks to fetch, NULL for all (-R)
+    int numwant;                        // peers to ask the tracker for (-n)
+    int announce_interval;              // seconds between announces
 } usage_info_t;
 
 /* Struct definition for holding command line arguments information */
@@ -152,6 +187,23 @@ typedef struct ArgsInfo {
     char *upload_path;                  // path to to the file to seed (-s)
     char *download_dir;                 // path to directory to download file (-r)
     char *generate_path;                // path of a torrent file to be generated (-g)
+    char **torrent_paths;               // every .sly given with -f
+    int num_torrents;                   // # of entries in torrent_paths
+    int upload_slots;                   // # of leechers served at once (-u)
+    long upload_rate;                   // global upload limit, bytes/sec (-U)
+    long download_rate;                 // global download limit, bytes/sec (-D)
+    long peer_rate;                     // per-peer limit, bytes/sec (-P)
+    int use_ledbat;                     // background LEDBAT transfers (-b)
+    long cache_size;                    // seeder piece cache, bytes (-C)
+    int drop_cache;                     // bypass piece and page cache (-N)
+    int sync_policy;                    // when downloads are synced (-S)
+    int sparse;                         // create downloads sparse (-z)
+    int zero_copy;                      // receive with splice() (-Z)
+    int direct_io;                      // bypass the page cache (-O)
+    char *stream_path;                  // stream the download here (-T)
+    char **ranges;                      // every range given with -R
+    int num_ranges;                     // # of entries in ranges
+    int numwant;                        // peers wanted, 0 for any (-n)
     struct InfoDictionary *info_dict; 
 } args_info_t;
 
@@ -162,6 +214,8 @@ typedef struct SeederInfo {
     struct UsageInfo *request_info;
     int* piece_states;
     char* pieces_path;
+    int use_ledbat;                 // 1 if the seeder agreed to LEDBAT
+    struct ledbat_sock ledbat;      // chunk data stream when use_ledbat
 } seeder_info_t; // ?
 
 /* Encapsulates metadata needed for log implementation */
@@ -207,6 +261,15 @@ void host_connection(int portnum, int *listenfd, struct sockaddr_in *caddr, unsi
  **/
 void get_chunk_states(struct UsageInfo *info, char *file_path);
 
+/**
+ * @brief Checks a single chunk of a file against its hash in the InfoDictionary
+ * @param info Pointer to a UsageInfo structure containing relevant information
+ * @param file_path The path to the file holding the chunk
+ * @param i Index of the chunk
+ * @return 1 if the chunk is valid, 0 otherwise
+ **/
+int verify_chunk(struct UsageInfo *info, char *file_path, int i);
+
 /**
  * @brief Calculate the SHA-256 hash of a file (using shell)
  * @param path_to_file The path to the file for which the hash is to be calculated
@@ -215,6 +278,11 @@ void get_chunk_states(struct UsageInfo *info, char *file_path);
  **/
 void sha256sum(char *path_to_file, char *sha256sum_output);
 
+/**
+ * @brief sha256sum() reading the file with O_DIRECT, around the page cache
+ **/
+void sha256sum_direct(char *path_to_file, char *sha256sum_output);
+
 /**
  * @brief Validate the SHA-256 checksum of a file
  * @param path_to_file The path to the file for which the checksum is to be validated
@@ -0,0 +1,75 @@
+/*
+ * Swarthmore College, CS 87
+ * Copyright (c) 2020 Swarthmore College Computer Science Department,
+ * Swarthmore PA, Professor Tia Newhall
+ *
+ * SLY: stream.h
+ * Authors: Sasha Casada, Yatin Lala, and Leo Douhovnikoff (12-18-2023)
+ */
+
+#ifndef _STREAM_H_
+#define _STREAM_H_
+
+#include <pthread.h>
+#include <sys/time.h>
+#include "shared.h"
+#include "diskq.h"
+
+#define STREAM_WINDOW           32      // chunks past the first hole to fetch
+#define STREAM_BATCH            4       // chunks per request to a peer
+#define STREAM_PIPELINE         2       // requests outstanding per peer
+
+/* where each chunk of a streamed download is */
+#define CHUNK_MISSING           0       // nobody is fetching it
+#define CHUNK_REQUESTED         1       // asked from a peer, see (owner)
+#define CHUNK_WRITTEN           2       // on disk, not verified yet
+#define CHUNK_VERIFIED          3       // hash checked, ready to go out
+
+/* a download that is handed out in order while it is still coming in.
+ * peers always get the lowest missing chunks inside a window that starts
+ * at the first one not yet on disk, and an emitter thread verifies the
+ * chunk at the playback position and writes it to (out_fd) */
+struct stream {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;            // a chunk or a peer changed state
+  int *state;                     // CHUNK_ state of every chunk
+  void **owner;                   // peer fetching each CHUNK_REQUESTED one
+  int chunk_total;
+  int next;                       // playback position, chunks emitted
+  int fetching;                   // 0 once the round's writes are done
+  int out_fd;                     // where the bytes go, -1 once it's gone
+  int file_fd;                    // the download, to read chunks back
+  int started;                    // 1 once the first byte went out
+  struct UsageInfo *info;
+  char *path;
+  pthread_t emitter;
+};
+
+/* stream the chunks of (info)'s file to (out_fd) */
+void stream_init(struct stream *s, struct UsageInfo *info, int out_fd);
+
+/* start a download round on (path). chunks info->chunk_states marks
+ * valid are emitted right away */
+void stream_start(struct stream *s, char *path);
+
+/* claim the next chunks for (peer), which has the chunks (have) marks 1,
+ * and set them to 1 in (requested). returns the # claimed. with (wait),
+ * blocks while other peers may still free up work; 0 then means (peer)
+ * has nothing left to fetch */
+int stream_next_batch(struct stream *s, void *peer, int *have,
+  int *requested, int wait);
+
+/* chunk (i) is on disk, or failed to get there */
+void stream_written(struct stream *s, int i, int ok);
+
+/* disk_buf completion for diskq_write(), (b->arg) is the stream */
+void stream_buf_done(struct disk_buf *b, int failed);
+
+/* (peer) stopped, whatever it still had requested is missing again */
+void stream_peer_done(struct stream *s, void *peer);
+
+/* end the round once every peer is done and the disk queue drained.
+ * returns 1 when the whole file went out, which closes (out_fd) */
+int stream_finish(struct stream *s);
+
+#endif
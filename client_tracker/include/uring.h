@@ -0,0 +1,69 @@
+/*
+ * Swarthmore College, CS 87
+ * Copyright (c) 2020 Swarthmore College Computer Science Department,
+ * Swarthmore PA, Professor Tia Newhall
+ *
+ * SLY: uring.h
+ * Authors: Sasha Casada, Yatin Lala, and Leo Douhovnikoff (12-18-2023)
+ */
+
+#ifndef _URING_H_
+#define _URING_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <linux/io_uring.h>
+
+#define URING_ENTRIES           256     // submission queue size
+#define URING_BUFFERS           32      // registered read buffers
+#define URING_BUF_SIZE          131072  // bytes per registered buffer
+
+/* a minimal io_uring, driven through the raw system calls. one ring is
+ * shared by every thread: submissions are serialized by (lock), and only
+ * one thread reaps completions.
+ */
+struct uring {
+  int fd;
+  pthread_mutex_t lock;
+  /* submission queue */
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  struct io_uring_sqe *sqes;
+  /* completion queue */
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_cqe *cqes;
+  /* registered buffers, handed out through a free stack */
+  char *bufs;
+  int *free_bufs;
+  int nfree;
+  /* registered file table */
+  int nfiles;
+};
+
+/* set up (ring) with registered buffers and a table of (nfiles) registered
+ * files. returns -1 if the kernel can't do what we need, and the caller
+ * should keep using its plain system call path */
+int uring_init(struct uring *ring, int nfiles);
+
+/* put (fd) in registered file slot (slot), or clear it with fd -1 */
+int uring_set_file(struct uring *ring, int slot, int fd);
+
+/* take a registered buffer, -1 if they are all in flight */
+int uring_get_buf(struct uring *ring);
+
+/* give back a buffer from uring_get_buf() */
+void uring_put_buf(struct uring *ring, int buf);
+
+/* queue a read of (len) bytes at (offset) of registered file (slot) into
+ * buffer (buf), linked to a send of that buffer on (sockfd). both
+ * completions carry (user_data), with URING_SEND set on the send's.
+ * returns -1 if the submission queue is full */
+#define URING_SEND              1
+int uring_read_send(struct uring *ring, int slot, off_t offset, int sockfd,
+  int buf, long len, uint64_t user_data);
+
+/* copy up to (max) completions into (cqes); returns how many. also
+ * pushes along anything the kernel hasn't taken from the submission queue */
+int uring_reap(struct uring *ring, struct io_uring_cqe *cqes, int max);
+
+#endif
@@ -0,0 +1,73 @@
+/*
+ * Swarthmore College, CS 87
+ * Copyright (c) 2020 Swarthmore College Computer Science Department,
+ * Swarthmore PA, Professor Tia Newhall
+ *
+ * SLY: workpool.h
+ * Authors: Sasha Casada, Yatin Lala, and Leo Douhovnikoff (12-18-2023)
+ */
+
+#ifndef _WORKPOOL_H_
+#define _WORKPOOL_H_
+
+#include <pthread.h>
+
+#define WORKPOOL_DEQUE_INIT     64      // initial job slots per worker deque
+
+/* a single queued job: (fn) is run with (arg) on one of the pool threads */
+struct work_item {
+  void (*fn)(void *arg);
+  void *arg;
+};
+
+/* one worker's jobs. the owner pushes and pops at the tail (newest first),
+ * idle workers steal from the head (oldest first) */
+struct work_deque {
+  pthread_mutex_t lock;
+  struct work_item *items;        // ring buffer of jobs
+  int cap;                        // # of slots in (items)
+  int head;                       // index of the oldest job
+  int count;                      // # of jobs queued
+};
+
+/* counters for watching a pool's load */
+struct workpool_stats {
+  int depth;                      // jobs queued right now, all workers
+  int max_depth;                  // deepest single worker deque so far
+  long submitted;                 // jobs ever submitted
+  long executed;                  // jobs ever run
+  long stolen;                    // jobs run by a worker that stole them
+};
+
+/* a fixed set of worker threads, each with its own deque of jobs. workers
+ * that run out of jobs steal from the others before going to sleep */
+struct workpool {
+  pthread_mutex_t lock;           // only guards sleeping
+  pthread_cond_t cond;
+  int pending;                    // jobs queued over all deques
+  int sleepers;                   // workers waiting on (cond)
+  int next_victim;                // round robin for outside submissions
+  struct work_deque *deques;      // one per worker
+  int nthreads;                   // # of worker threads
+  pthread_t *threads;
+  char *name;                     // pool name for the log
+  long submitted, executed, stolen;
+  int max_depth;
+};
+
+/* start (nthreads) workers for (pool) */
+void workpool_init(struct workpool *pool, char *name, int nthreads);
+
+/* queue fn(arg) to run on one of (pool)'s workers. a worker submitting to
+ * its own pool queues the job on its own deque */
+void workpool_submit(struct workpool *pool, void (*fn)(void *), void *arg);
+
+/* like workpool_submit() but queues the job behind everything already
+ * waiting on this worker, and first in line to be stolen. for splitting a
+ * long job into pieces without starving the rest of the queue */
+void workpool_yield(struct workpool *pool, void (*fn)(void *), void *arg);
+
+/* snapshot (pool)'s queue depth and counters into (stats) */
+void workpool_get_stats(struct workpool *pool, struct workpool_stats *stats);
+
+#endif
@@ -0,0 +1,188 @@
+/*
+ * Swarthmore College, CS 87
+ * Copyright (c) 2020 Swarthmore College Computer Science Department,
+ * Swarthmore PA, Professor Tia Newhall
+ *
+ * SLY: admission.c
+ * Authors: Sasha Casada, Yatin Lala, and Leo Douhovnikoff (12-18-2023)
+ */
+
+/**
+ * Admission control for the seeder. Only (limit) transfers run at once;
+ * past that, up to ADMISSION_QUEUE leechers wait in FIFO order and the
+ * rest are told BUSY along with how long to back off, estimated from how
+ * fast transfers have been finishing.
+ *
+ * The limit is found by hill climbing on measured throughput: while there
+ * is more demand than the limit, it is raised by ADMISSION_STEP, and kept
+ * only if the bytes sent per second went up by ADMISSION_GAIN_PCT. When
+ * they don't, the disk or the network is saturated and more concurrent
+ * transfers would only split the same bandwidth thinner, so the step is
+ * undone. Jobs piling up behind the disk and I/O pools cut the limit at
+ * once.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <pthread.h>
+#include "shared.h"
+#include "admission.h"
+
+////////////////////////////// DEFINITIONS ////////////////////////////////////
+
+static pthread_mutex_t admit_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int active, queued, limit, min_limit;
+static long admitted, rejected;
+static double avg_transfer_ms = 1000;     // EWMA of finished transfers
+static long sent_bytes;                   // since the last tick
+static double last_rate;                  // bytes/sec over the last interval
+static double base_rate;                  // throughput before the probe
+static int probing;                       // 1 if the last tick raised limit
+static int hold;                          // intervals left before probing
+static struct timeval last_tick;
+
+///////////////////////////////////////////////////////////////////////////////
+
+/* one hill climbing step from this interval's throughput (admit_lock held) */
+static void admission_tune(double rate, int backlog)
+{
+  if (backlog > ADMISSION_BACKLOG_JOBS) {
+    /* the disk or the I/O threads can't keep up, back off hard */
+    limit = limit * 3 / 4;
+    probing = 0;
+    hold = ADMISSION_HOLD;
+  }
+  else if (probing) {
+    if (rate <= base_rate * (100 + ADMISSION_GAIN_PCT) / 100) {
+      limit -= ADMISSION_STEP;
+      hold = ADMISSION_HOLD;
+      log_record("Admission: saturated at %.0f KiB/s, holding (%d) "
+        "transfers.\n", rate / 1024, limit);
+    }
+    probing = 0;
+  }
+  else if (hold > 0) {
+    hold--;
+  }
+  else if (queued > 0 && active >= limit) {
+    base_rate = rate;
+    limit += ADMISSION_STEP;
+    probing = 1;
+  }
+  if (limit < min_limit) {
+    limit = min_limit;
+  }
+  if (limit > ADMISSION_MAX_LIMIT) {
+    limit = ADMISSION_MAX_LIMIT;
+  }
+}
+
+void admission_init(int upload_slots)
+{
+  min_limit = upload_slots * ADMISSION_SLOT_FACTOR;
+  limit = (ADMISSION_INIT_LIMIT > min_limit) ? ADMISSION_INIT_LIMIT :
+    min_limit;
+  gettimeofday(&last_tick, NULL);
+}
+
+int admission_enter(void)
+{
+  int ret;
+
+  pthread_mutex_lock(&admit_lock);
+  /* nobody skips the queue */
+  if (queued == 0 && active < limit) {
+    active++;
+    admitted++;
+    ret = ADMIT_OK;
+  }
+  else if (queued < ADMISSION_QUEUE) {
+    queued++;
+    ret = ADMIT_QUEUED;
+  }
+  else {
+    rejected++;
+    ret = ADMIT_BUSY;
+  }
+  pthread_mutex_unlock(&admit_lock);
+  return ret;
+}
+
+int admission_dequeue(void)
+{
+  int ret = 0;
+
+  pthread_mutex_lock(&admit_lock);
+  if (queued > 0 && active < limit) {
+    queued--;
+    active++;
+    admitted++;
+    ret = 1;
+  }
+  pthread_mutex_unlock(&admit_lock);
+  return ret;
+}
+
+void admission_exit(long ms)
+{
+  pthread_mutex_lock(&admit_lock);
+  active--;
+  avg_transfer_ms = 0.875 * avg_transfer_ms + 0.125 * ms;
+  pthread_mutex_unlock(&admit_lock);
+}
+
+void admission_sent(long bytes)
+{
+  __atomic_add_fetch(&sent_bytes, bytes, __ATOMIC_RELAXED);
+}
+
+void admission_tick(int backlog)
+{
+  struct timeval now;
+  long ms;
+
+  gettimeofday(&now, NULL);
+  ms = (now.tv_sec - last_tick.tv_sec) * 1000 +
+    (now.tv_usec - last_tick.tv_usec) / 1000;
+  if (ms < ADMISSION_INTERVAL_MS) {
+    return;
+  }
+  last_tick = now;
+  pthread_mutex_lock(&admit_lock);
+  last_rate = __atomic_exchange_n(&sent_bytes, 0, __ATOMIC_RELAXED) * 1000.0
+    / ms;
+  admission_tune(last_rate, backlog);
+  pthread_mutex_unlock(&admit_lock);
+}
+
+int admission_retry_ms(void)
+{
+  double ms;
+
+  /* a slot frees up every avg_transfer_ms / limit on average, and
+   * everybody already waiting goes first */
+  pthread_mutex_lock(&admit_lock);
+  ms = avg_transfer_ms * (queued + 1) / limit;
+  pthread_mutex_unlock(&admit_lock);
+  if (ms < RETRY_MIN_MS) {
+    ms = RETRY_MIN_MS;
+  }
+  if (ms > RETRY_MAX_MS) {
+    ms = RETRY_MAX_MS;
+  }
+  return (int)ms;
+}
+
+void admission_get_stats(struct admission_stats *stats)
+{
+  pthread_mutex_lock(&admit_lock);
+  stats->active = active;
+  stats->queued = queued;
+  stats->limit = limit;
+  stats->admitted = admitted;
+  stats->rejected = rejected;
+  stats->rate = last_rate;
+  pthread_mutex_unlock(&admit_lock);
+}
@@ -0,0 +1,357 @@
+/*
+ * Swarthmore College, CS 87
+ * Copyright (c) 2020 Swarthmore College Computer Science Department,
+ * Swarthmore PA, Professor Tia Newhall
+ *
+ * SLY: choker.c
+ * Authors: Sasha Casada, Yatin Lala, and Leo Douhovnikoff (12-18-2023)
+ */
+
+/**
+ * Upload slot scheduler for the seeder. Only (upload_slots) leechers are
+ * streamed chunks at any moment; everybody else is choked and sleeps on a
+ * condition variable until a slot frees up. Every RECHOKE_INTERVAL seconds
+ * the regular slots go to the peers with the best measured upload rate, and
+ * every OPTIMISTIC_INTERVAL rounds one slot rotates round-robin through the
+ * choked peers so newcomers always get a chance to prove themselves.
+ *
+ * https://wiki.theory.org/BitTorrentSpecification#Choking_and_Optimistic_Unchoking
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <pthread.h>
+#include "shared.h"
+#include "choker.h"
+
+////////////////////////////// DEFINITIONS ////////////////////////////////////
+
+static pthread_mutex_t choke_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t choke_cond = PTHREAD_COND_INITIALIZER;
+
+static struct choke_peer *interested;       // FIFO list of interested peers
+static struct choke_peer *interested_tail;
+static struct choke_peer *waiting;          // the choked ones, FIFO too
+static struct choke_peer *waiting_tail;
+static struct choke_peer *optimistic_peer;  // holder of the optimistic slot
+static int upload_slots;
+static int unchoked;                        // peers holding a slot
+static int rechoke_round;
+static long next_seq;
+static struct timeval last_rechoke;
+static int notify_fd = -1;                  // eventfd poked on slot changes
+
+///////////////////////////////////////////////////////////////////////////////
+
+/* queue choked (p) for a slot behind everybody already waiting
+ * (choke_lock held) */
+static void wait_push(struct choke_peer *p)
+{
+  p->wait_next = NULL;
+  p->wait_prev = waiting_tail;
+  if (waiting_tail != NULL) {
+    waiting_tail->wait_next = p;
+  }
+  else {
+    waiting = p;
+  }
+  waiting_tail = p;
+}
+
+/* take (p) out of the slot queue (choke_lock held) */
+static void wait_remove(struct choke_peer *p)
+{
+  if (p->wait_prev) {
+    p->wait_prev->wait_next = p->wait_next;
+  }
+  else {
+    waiting = p->wait_next;
+  }
+  if (p->wait_next) {
+    p->wait_next->wait_prev = p->wait_prev;
+  }
+  else {
+    waiting_tail = p->wait_prev;
+  }
+  p->wait_prev = p->wait_next = NULL;
+}
+
+/* hand any free slots to the longest waiting peers. they got theirs part
+ * way through the round (choke_lock held) */
+static void fill_slots(void)
+{
+  struct choke_peer *p;
+
+  while (unchoked < upload_slots && waiting != NULL) {
+    p = waiting;
+    wait_remove(p);
+    p->choked = 0;
+    p->whole_round = 0;
+    unchoked++;
+  }
+}
+
+/* order peers by upload rate, then by who already holds a slot, then by
+ * arrival so the queue stays first-come first-serve for idle peers */
+static int compare_peers(const void *a, const void *b)
+{
+  const struct choke_peer *p = *(const struct choke_peer **)a;
+  const struct choke_peer *q = *(const struct choke_peer **)b;
+
+  if (p->rate != q->rate) {
+    return (p->rate < q->rate) ? 1 : -1;
+  }
+  if (p->choked != q->choked) {
+    return p->choked - q->choked;
+  }
+  return (p->seq < q->seq) ? -1 : 1;
+}
+
+/* pick the next choked peer after the current optimistic peer, wrapping
+ * around the interested list (choke_lock held) */
+static struct choke_peer *next_optimistic(void)
+{
+  struct choke_peer *start, *p;
+
+  start = (optimistic_peer != NULL) ? optimistic_peer->next : NULL;
+  for (p = start; p != NULL; p = p->next) {
+    if (p->choked) {
+      return p;
+    }
+  }
+  for (p = interested; p != start; p = p->next) {
+    if (p->choked) {
+      return p;
+    }
+  }
+  return (optimistic_peer != NULL && optimistic_peer->choked) ?
+    optimistic_peer : NULL;
+}
+
+/* a single rechoke round: refresh rates, then reassign every slot */
+static void rechoke(void)
+{
+  struct timeval now;
+  struct choke_peer **ranked;
+  struct choke_peer *p;
+  double elapsed;
+  int n, regular_slots;
+
+  gettimeofday(&now, NULL);
+  elapsed = (now.tv_sec - last_rechoke.tv_sec) +
+    (now.tv_usec - last_rechoke.tv_usec) / 1000000.0;
+  last_rechoke = now;
+  if (elapsed <= 0) {
+    elapsed = 1;
+  }
+
+  n = 0;
+  for (p = interested; p != NULL; p = p->next) {
+    if (p->whole_round && p->bytes_round == 0) {
+      /* held a slot for a whole round and sent nothing: it is idle */
+      p->rate = 0;
+    }
+    else {
+      p->rate = (p->rate + p->bytes_round / elapsed) / 2;
+      if (p->rate < IDLE_RATE) {
+        p->rate = 0;
+      }
+    }
+    p->bytes_round = 0;
+    n++;
+  }
+  if (n == 0) {
+    return;
+  }
+
+  ranked = malloc(sizeof(struct choke_peer *) * n);
+  if (!ranked) {
+    perror("ERROR: malloc(ranked) failed.");
+    exit(1); }
+  n = 0;
+  for (p = interested; p != NULL; p = p->next) {
+    ranked[n++] = p;
+  }
+  qsort(ranked, n, sizeof(struct choke_peer *), compare_peers);
+
+  /* keep one slot back for the optimistic unchoke if we have >1 slot */
+  regular_slots = (upload_slots > 1) ? upload_slots - 1 : upload_slots;
+  for (int i = 0; i < n; i++) {
+    ranked[i]->choked = (i >= regular_slots);
+  }
+  free(ranked);
+
+  if (upload_slots > 1) {
+    if (optimistic_peer == NULL ||
+      rechoke_round % OPTIMISTIC_INTERVAL == 0) {
+      if (optimistic_peer != NULL) {
+        optimistic_peer->optimistic = 0;
+      }
+      optimistic_peer = next_optimistic();
+      if (optimistic_peer != NULL) {
+        optimistic_peer->optimistic = 1;
+      }
+    }
+    if (optimistic_peer != NULL) {
+      optimistic_peer->choked = 0;
+    }
+  }
+  rechoke_round++;
+
+  /* requeue the choked peers, still in arrival order */
+  unchoked = 0;
+  waiting = waiting_tail = NULL;
+  for (p = interested; p != NULL; p = p->next) {
+    if (p->choked) {
+      wait_push(p);
+    }
+    else {
+      unchoked++;
+    }
+  }
+
+  /* a previous optimistic peer may have been promoted to a regular slot */
+  fill_slots();
+  for (p = interested; p != NULL; p = p->next) {
+    p->whole_round = !p->choked;
+  }
+}
+
+/* wake up everybody waiting on a slot: blocked connections through the
+ * condition variable, the seeder's event loop through (notify_fd)
+ * (choke_lock held) */
+static void slots_changed(void)
+{
+  uint64_t one = 1;
+
+  pthread_cond_broadcast(&choke_cond);
+  if (notify_fd != -1 && write(notify_fd, &one, sizeof(one)) == -1) {
+    // eventfd counter is saturated, the reader will wake up anyway
+  }
+}
+
+/* thread that periodically rotates the upload slots */
+static void *rechoke_thread(void *args)
+{
+  while (1) {
+    sleep(RECHOKE_INTERVAL);
+    pthread_mutex_lock(&choke_lock);
+    rechoke();
+    slots_changed();
+    pthread_mutex_unlock(&choke_lock);
+  }
+  return NULL;
+}
+
+void choker_init(int slots)
+{
+  pthread_t tid;
+  int ret;
+
+  upload_slots = (slots > 0) ? slots : DEFAULT_UPLOAD_SLOTS;
+  interested = interested_tail = NULL;
+  waiting = waiting_tail = NULL;
+  optimistic_peer = NULL;
+  unchoked = 0;
+  rechoke_round = 0;
+  next_seq = 0;
+  gettimeofday(&last_rechoke, NULL);
+
+  ret = pthread_create(&tid, NULL, rechoke_thread, NULL);
+  if (ret) {
+    perror("ERROR: pthread_create() failed.");
+    exit(1); }
+  pthread_detach(tid);
+  log_record("Choker initialized with (%d) upload slots.\n", upload_slots);
+}
+
+void choker_register(struct choke_peer *peer)
+{
+  pthread_mutex_lock(&choke_lock);
+  peer->choked = 1;
+  peer->whole_round = 0;
+  peer->optimistic = 0;
+  peer->bytes_round = 0;
+  peer->rate = 0;
+  peer->seq = next_seq++;
+  peer->next = NULL;
+  peer->prev = interested_tail;
+  if (interested_tail != NULL) {
+    interested_tail->next = peer;
+  }
+  else {
+    interested = peer;
+  }
+  interested_tail = peer;
+  wait_push(peer);
+  fill_slots();
+  slots_changed();
+  pthread_mutex_unlock(&choke_lock);
+}
+
+void choker_unregister(struct choke_peer *peer)
+{
+  pthread_mutex_lock(&choke_lock);
+  if (peer->prev) {
+    peer->prev->next = peer->next;
+  }
+  else {
+    interested = peer->next;
+  }
+  if (peer->next) {
+    peer->next->prev = peer->prev;
+  }
+  else {
+    interested_tail = peer->prev;
+  }
+  peer->prev = peer->next = NULL;
+  if (peer->choked) {
+    wait_remove(peer);
+  }
+  else {
+    unchoked--;
+  }
+  if (optimistic_peer == peer) {
+    optimistic_peer = NULL;
+  }
+  peer->choked = 1;
+  fill_slots();
+  slots_changed();
+  pthread_mutex_unlock(&choke_lock);
+}
+
+void choker_wait_unchoked(struct choke_peer *peer)
+{
+  pthread_mutex_lock(&choke_lock);
+  while (peer->choked) {
+    pthread_cond_wait(&choke_cond, &choke_lock);
+  }
+  pthread_mutex_unlock(&choke_lock);
+}
+
+int choker_is_unchoked(struct choke_peer *peer)
+{
+  int unchoked;
+
+  pthread_mutex_lock(&choke_lock);
+  unchoked = !peer->choked;
+  pthread_mutex_unlock(&choke_lock);
+  return unchoked;
+}
+
+void choker_set_notify(int fd)
+{
+  pthread_mutex_lock(&choke_lock);
+  notify_fd = fd;
+  pthread_mutex_unlock(&choke_lock);
+}
+
+void choker_record(struct choke_peer *peer, long bytes)
+{
+  pthread_mutex_lock(&choke_lock);
+  peer->bytes_round += bytes;
+  pthread_mutex_unlock(&choke_lock);
+}
@@ -7,6 +7,7 @@
  * Authors: Sasha Casada, Yatin Lala, and Leo Douhovnikoff (12-18-2023)
  */
 
+#define _GNU_SOURCE     // fallocate(), splice()
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -20,11 +21,18 @@
 #include <readline/readline.h>
 #include <readline/history.h>
 #include <pthread.h>
+#include <signal.h>
 #include <getopt.h>
 #include <math.h>
 #include <dirent.h>
 #include "seeder.h"
 #include "shared.h"
+#include "choker.h"
+#include "session.h"
+#include "piececache.h"
+#include "admission.h"
+#include "diskq.h"
+#include "stream.h"
 
 ////////////////////////////// DEFINITIONS ////////////////////////////////////
 
@@ -35,9 +43,17 @@
 #define USAGE_GENERATE    4
 #define PIECE_LENGTH      128
 #define MAX_PATH_LENGTH   1000
+#define BUSY_RETRIES      8     // times a busy seeder is retried
+#define BACKOFF_MIN_MS    250   // first backoff, doubled on every retry
+#define BACKOFF_MAX_MS    60000
+#define DEFAULT_INTERVAL  60    // seconds between announces, until told
 
 log_info_t logger;
 
+static struct UsageInfo **seeding;      // every torrent we announce
+static int num_seeding;
+static struct UsageInfo *downloading;   // the torrent we request, if any
+
 int download_from_peerlist(struct UsageInfo *request_info); 
 
 void *download_from_peer(void* args);
@@ -54,6 +70,30 @@ void request_file(struct UsageInfo *request_info);
 /* attempts to seed a file on the torrent network */
 void seed_file(struct UsageInfo *seed_info);
 
+/* builds the seed info for one torrent of a seeding session */
+struct UsageInfo *init_seed_info(struct ArgsInfo *args, 
+  struct InfoDictionary *info_dict);
+
+/* registers another .sly with its tracker and adds it to the session */
+void seed_torrent(struct ArgsInfo *args, char *torrent_path);
+
+/* announces (event) for (info)'s torrent over its tracker socket, or a
+ * connection of its own when that is closed. returns 0, or -1 if the
+ * tracker could not be reached */
+static int announce(struct UsageInfo *info, int event);
+
+/* re-announces every seeded torrent on its interval until SIGINT/SIGTERM
+ * arrive (blocked in every thread), then announces STOPPED and exits */
+static void *announce_torrents(void *args);
+
+/* read "upload|download|peer <KiB/s>" lines from (path) into the rates of
+ * (args), leaving out a line keeps that rate. returns -1 if it can't */
+static int read_limits(char *path, struct ArgsInfo *args);
+
+/* limits thread: on every SIGHUP re-read LIMITS_FILE into (args) and
+ * apply it to the global, torrent and peer buckets */
+static void *watch_limits(void *args);
+
 /* sends info_dictionary struct in args to server */
 void add_file(struct UsageInfo *add_info);
 
@@ -66,9 +106,52 @@ void init_connection(int portnum, int *sockfd, char *ip_addr);
 /* attempt a handshake with the tracker */
 void tracker_handshake(int sockfd);
 
+/* send the info hash of a file request or announce together with the int
+ * (numwant or event) that follows it */
+static ssize_t send_info_hash(int sockfd, struct InfoDictionary *info_dict,
+  int arg);
+
+/* attempt a handshake with a seeder, negotiating the chunk transport.
+ * returns 0 on success, or the ms to back off if the seeder is busy */
+int peer_handshake(struct SeederInfo *seeder);
+
+/* read chunk data from a seeder over its negotiated transport */
+static ssize_t recv_from_peer(struct SeederInfo *seeder, void *buf, 
+  size_t len);
+
+/* whole-file checksum of a download, around the page cache with -O */
+static void hash_download(struct UsageInfo *request_info, char *path,
+  char *sha256sum_output);
+
+/* create (path) with (size) bytes, preallocated unless (sparse) */
+static int create_download_file(char *path, off_t size, int sparse);
+
+/* move (len) bytes from (sockfd) to (offset) of (fd) through (pipefd)
+ * without copying them into user space. returns 0, or -1 on error */
+static int splice_chunk(int sockfd, int pipefd[2], int fd, size_t len, 
+  off_t offset);
+
+/* take one run off (seeder)'s connection and queue its chunks for the
+ * disk. returns the # of chunks it covered, or -1 if the peer hung up */
+static int recv_run(struct SeederInfo *seeder, 
+  struct token_bucket *peer_limit, int pipefd[2]);
+
+/* streaming (-T): keep fetching the most urgent chunks (seeder) has, 
+ * STREAM_PIPELINE requests at a time, until there are none left */
+static void stream_from_peer(struct SeederInfo *seeder, 
+  struct token_bucket *peer_limit, int pipefd[2]);
+
 /* TODO write a comment */
 void init_from_file(struct InfoDictionary *data);
 
+/* adds a .sly path (or every .sly in a directory) to the torrent list */
+static void add_torrent_path(struct ArgsInfo *args, char *path);
+
+/* marks the chunks covering the -R ranges of (args). returns NULL (the 
+ * whole file) when there are none */
+static int *parse_ranges(struct ArgsInfo *args, 
+  struct InfoDictionary *info_dict);
+
 /* parses args for peer client and returns in ArgsInfo struct */
 static void parse_args(int ac, char *av[], struct ArgsInfo *data, 
   struct InfoDictionary *info_dict);
@@ -83,13 +166,22 @@ int main(int argc, char **argv)
   int sockfd;
   struct ArgsInfo args;
   struct InfoDictionary info_dict;
+  sigset_t stop_signals, hup_signal;
+  pthread_t limits_thread;
 
   /* initialize log_file and log start time */
   logger.log_file = fopen("client.log","w");
     gettimeofday(&(logger.start_tv),NULL);
+  srand(logger.start_tv.tv_usec ^ getpid());  // backoff jitter
 
   parse_args(argc, argv, &args, &info_dict);
   init_from_file(&info_dict);
+  ratelimit_init(&global_upload, args.upload_rate, NULL);
+  ratelimit_init(&global_download, args.download_rate, NULL);
+  /* only the limits thread takes SIGHUP, every thread inherits the mask */
+  sigemptyset(&hup_signal);
+  sigaddset(&hup_signal, SIGHUP);
+  pthread_sigmask(SIG_BLOCK, &hup_signal, NULL);
     // print_info_dictionary(&info_dict);
 
   init_connection(P2T_PORTNUM, &sockfd, info_dict.tracker_ip);
@@ -106,13 +198,34 @@ int main(int argc, char **argv)
  
     case USAGE_SEED:
         log_record("usage_mode: USAGE_SEED\n");
-        struct UsageInfo seed_info; 
-          seed_info.sockfd = sockfd;
-          seed_info.upload_path = args.upload_path;
-          seed_info.info_dict = &info_dict;
-        seed_file(&seed_info);
-          seed_info.chunk_states = malloc(sizeof(int)*info_dict.chunk_size);
-        seed_provide(&seed_info);
+        /* only the announcer takes these, to tell the trackers we left */
+        sigemptyset(&stop_signals);
+        sigaddset(&stop_signals, SIGINT);
+        sigaddset(&stop_signals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &stop_signals, NULL);
+        session_init();
+        choker_init(args.upload_slots);
+        piececache_init(args.cache_size);
+        admission_init(args.upload_slots);
+        /* the first torrent reuses our tracker connection */
+        struct UsageInfo *seed_info = init_seed_info(&args, &info_dict);
+          seed_info->sockfd = sockfd;
+        seed_file(seed_info);
+        session_add(seed_info);
+        for (int i = 1; i < args.num_torrents; i++) {
+          seed_torrent(&args, args.torrent_paths[i]);
+        }
+        printf("Seeding (%d) torrents from '%s'.\n", args.num_torrents, 
+          args.upload_path);
+        if (pthread_create(&limits_thread, NULL, watch_limits, &args)) {
+          perror("ERROR: pthread_create() failed.");
+          exit(1); }
+        pthread_t announcer;
+        if (pthread_create(&announcer, NULL, announce_torrents, 
+          &stop_signals)) {
+          perror("ERROR: pthread_create() failed.");
+          exit(1); }
+        seed_provide();
         break;
 
     case USAGE_REQUEST:
@@ -121,6 +234,53 @@ int main(int argc, char **argv)
           request_info.sockfd = sockfd;
           request_info.download_dir = args.download_dir;
           request_info.info_dict = &info_dict;
+          request_info.peer_rate = args.peer_rate;
+          request_info.use_ledbat = args.use_ledbat;
+          request_info.sync_policy = args.sync_policy;
+          request_info.sparse = args.sparse;
+          request_info.zero_copy = args.zero_copy;
+          request_info.direct_io = args.direct_io;
+          request_info.wanted = parse_ranges(&args, &info_dict);
+          request_info.numwant = args.numwant;
+        if (request_info.wanted != NULL) {
+          /* only the ranges get blocks, the rest of the file stays a hole */
+          request_info.sparse = 1;
+        }
+        if (args.direct_io && info_dict.chunk_size % DISKQ_ALIGN != 0) {
+          log_record("Chunk size %d isn't O_DIRECT aligned, using buffered "
+            "I/O.\n", info_dict.chunk_size);
+          request_info.direct_io = 0;
+        }
+        struct diskq disk_queue;
+        diskq_init(&disk_queue, info_dict.chunk_size, DISKQ_BUFFERS, 
+          DISKQ_WRITERS);
+          request_info.disk_queue = &disk_queue;
+        struct stream stream;
+          request_info.stream = NULL;
+        if (args.stream_path != NULL) {
+          int out_fd;
+          if (strcmp(args.stream_path, "-") == 0) {
+            /* the data gets stdout to itself, our chatter moves over */
+            out_fd = dup(STDOUT_FILENO);
+            dup2(STDERR_FILENO, STDOUT_FILENO);
+          }
+          else {
+            /* opening a FIFO waits here for its reader */
+            out_fd = open(args.stream_path, O_WRONLY | O_CREAT | O_TRUNC, 
+              0644);
+          }
+          if (out_fd == -1) {
+            perror("ERROR: open(stream) failed.");
+            exit(1); }
+          stream_init(&stream, &request_info, out_fd);
+          request_info.stream = &stream;
+        }
+          ratelimit_init(&request_info.download_limit, RATE_UNLIMITED, 
+            &global_download);
+        downloading = &request_info;
+        if (pthread_create(&limits_thread, NULL, watch_limits, &args)) {
+          perror("ERROR: pthread_create() failed.");
+          exit(1); }
         request_file(&request_info);
           request_info.chunk_states = malloc(sizeof(int)*info_dict.chunk_size);
         while (download_from_peerlist(&request_info) == 1) {
@@ -129,8 +289,17 @@ int main(int argc, char **argv)
           request_file(&request_info);
           log_record("DEBUG: Looping download from peerlist\n");
         }
-        printf("File '%s' has been downloaded to the current directory!\n", 
-          info_dict.file_name);
+        if (request_info.wanted != NULL) {
+          printf("The requested ranges of '%s' have been downloaded!\n",
+            info_dict.file_name);
+        }
+        else {
+          if (announce(&request_info, COMPLETED) == -1) {
+            log_record("Could not announce the finished download.\n");
+          }
+          printf("File '%s' has been downloaded to the current directory!\n", 
+            info_dict.file_name);
+        }
         break;
 
     case USAGE_GENERATE:
@@ -159,7 +328,7 @@ int download_from_peerlist(struct UsageInfo *request_info)
   int ret;
   int chunk_total = request_info->info_dict->chunk_total;
   int num_peers = request_info->num_peers;
-  int filesize = seeders->request_info->info_dict->file_size;
+  off_t filesize = seeders->request_info->info_dict->file_size;
   int *p_chunk_states = request_info->chunk_states;
   char *p_download_dir = seeders->request_info->download_dir;
   char *p_filename = request_info->info_dict->file_name;
@@ -177,18 +346,16 @@ int download_from_peerlist(struct UsageInfo *request_info)
     exit(1);
     }
 
-  /* create file using fseek */
+  /* create the file at its full size */
   if (stat(download_file_path, &st) == -1) {
     log_record("File '%s' does not exist. Creating file.\n", 
       download_file_path);
-    FILE *file = fopen(download_file_path, "w");
-    if (file == NULL) {
+    if (create_download_file(download_file_path, filesize, 
+      request_info->sparse) == -1) {
       log_record("File '%s' creation error. Exiting\n", download_file_path);
       fprintf(stderr, "Error (%d): %s\n", errno, strerror(errno));
+      exit(1);
     }
-    fseek(file, filesize - 1, SEEK_SET);
-    fputc('\0', file);
-    fclose(file);
     log_record("File '%s' created!\n", download_file_path);
   }
 
@@ -201,11 +368,21 @@ int download_from_peerlist(struct UsageInfo *request_info)
       log_record("Chunk(s) missing. Will attempt to request from peers.\n");
       break;
     }
+    else if (i == chunk_total - 1 && request_info->wanted != NULL) {
+      /* the whole file checksum can't hold for a partial download */
+      log_record("Requested ranges already available.\n");
+      free(seeders);
+      return 0;
+    }
     else if (i == chunk_total - 1) {
-      sha256sum(download_file_path, sha256sum_file);
+      hash_download(request_info, download_file_path, sha256sum_file);
       if (validate_sha256sum(request_info->info_dict->sha256sum, 
         sha256sum_file) == 0) {
         log_record("Complete file already available.\n");
+        if (request_info->stream != NULL) {
+          stream_start(request_info->stream, download_file_path);
+          stream_finish(request_info->stream);
+        }
         log_record("File %s available in directory %s.\n", p_filename, 
           p_download_dir);
         free(seeders);
@@ -237,8 +414,9 @@ int download_from_peerlist(struct UsageInfo *request_info)
     pthread_join(threads[i], 0);
   }
   
-  /* distribute the chunk requests among connected peers */ 
-  for (int i = 0; i<num_peers; i++) {
+  /* distribute the chunk requests among connected peers. streaming hands
+   * them out as it goes instead, so every peer keeps what it has */ 
+  for (int i = 0; i<num_peers && !request_info->stream; i++) {
     // printf("Seeder %d provides chunkset [", i);
     for (int j = 0; j < chunk_total; j++) {
       // printf("%d, ", seeders[i].piece_states[j]);
@@ -255,7 +433,7 @@ int download_from_peerlist(struct UsageInfo *request_info)
   }
 
   /* gaurentee we always have a chunk provider if it is available */
-  for (int i = 0; i<num_peers; i++) {
+  for (int i = 0; i<num_peers && !request_info->stream; i++) {
     for (int j = 0; j < chunk_total; j++) {
       if (seeders[i].piece_states[j] == 2 && p_chunk_states[j] == 0) {
         p_chunk_states[j] = 1;
@@ -267,9 +445,36 @@ int download_from_peerlist(struct UsageInfo *request_info)
     }
   }
 
+  /* one descriptor for every peer thread, each writes whole chunks at 
+   * their own offsets so no seek position or stdio buffer is shared */
+  request_info->download_fd = open(download_file_path, 
+    O_RDWR | (request_info->direct_io ? O_DIRECT : 0));
+  if (request_info->download_fd == -1 && request_info->direct_io && 
+    errno == EINVAL) {
+    log_record("'%s' can't be opened O_DIRECT, using buffered writes.\n",
+      download_file_path);
+    request_info->direct_io = 0;
+    request_info->download_fd = open(download_file_path, O_RDWR);
+  }
+  /* O_DIRECT writes whole blocks, so a last chunk that ends mid-block 
+   * goes through the page cache instead */
+  request_info->tail_fd = request_info->download_fd;
+  if (request_info->download_fd != -1 && request_info->direct_io) {
+    request_info->tail_fd = open(download_file_path, O_RDWR);
+  }
+  if (request_info->download_fd == -1 || request_info->tail_fd == -1) {
+    log_record("File '%s' could not be opened for download. Exiting\n", 
+      download_file_path);
+    fprintf(stderr, "Error (%d): %s\n", errno, strerror(errno));
+    exit(1);
+  }
+
   /* download all of the chunks into our file from our connected peers*/
   log_record("Downloading chunks from peers...\n");
   printf("Downloading file from (%d) peers.\n", num_peers);
+  if (request_info->stream != NULL) {
+    stream_start(request_info->stream, download_file_path);
+  }
   for (int i = 0; i < num_peers; i++) {
     ret = pthread_create(&threads[i], NULL, download_chunkset_from_peer, 
       &seeders[i]);
@@ -283,6 +488,28 @@ int download_from_peerlist(struct UsageInfo *request_info)
     close(seeders[i].sockfd);
     free(seeders[i].piece_states);
   }
+  /* failed writes leave bad chunks behind, the integrity check below 
+   * catches them and they are requested again */
+  if (diskq_drain(request_info->disk_queue) > 0) {
+    log_record("Some chunks of '%s' could not be written.\n", 
+      download_file_path);
+  }
+  if (request_info->stream != NULL) {
+    /* the rest of the stream has to wait for the next round */
+    stream_finish(request_info->stream);
+  }
+  if (request_info->sync_policy == SYNC_END && 
+    fsync(request_info->download_fd) == -1) {
+    log_record("fsync of '%s' failed: %s\n", download_file_path, 
+      strerror(errno));
+  }
+  if (request_info->tail_fd != request_info->download_fd) {
+    /* write the tail back so it can be dropped from the cache too */
+    fdatasync(request_info->tail_fd);
+    posix_fadvise(request_info->tail_fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(request_info->tail_fd);
+  }
+  close(request_info->download_fd);
 
   /* final file integrity checksum */
   log_record("Getting chunk_states for final integrity check...\n");
@@ -293,8 +520,13 @@ int download_from_peerlist(struct UsageInfo *request_info)
       log_record("Piece missing. Attempting to re-request peers...\n");
       break;
     }
+    else if (i == chunk_total - 1 && request_info->wanted != NULL) {
+      log_record("Requested ranges received. Download successful.\n");
+      free(seeders);
+      return 0;
+    }
     else if (i == chunk_total - 1) {
-      sha256sum(download_file_path, sha256sum_file);
+      hash_download(request_info, download_file_path, sha256sum_file);
       if (validate_sha256sum(request_info->info_dict->sha256sum, 
         sha256sum_file) == 0) {
         log_record("Correct file received. Download successful.\n");
@@ -319,8 +551,34 @@ void *populate_seeder_info(void* args)
     seeder->piece_states[i] = 0;
   }
 
-  init_connection(P2P_PORTNUM, &seeder->sockfd, seeder->ip_addr);
-  tracker_handshake(seeder->sockfd);
+  /* a busy seeder says how long to stay away; we wait at least that, 
+   * doubling our own backoff each time with jitter so a crowd of turned 
+   * away leechers doesn't come back all at once */
+  for (int attempt = 0; ; attempt++) {
+    init_connection(P2P_PORTNUM, &seeder->sockfd, seeder->ip_addr);
+    int retry_ms = peer_handshake(seeder);
+    if (retry_ms == 0) {
+      break;
+    }
+    close(seeder->sockfd);
+    if (attempt == BUSY_RETRIES) {
+      log_record("(%s) FATAL: Peer still busy after (%d) retries.\n",
+        seeder->ip_addr, BUSY_RETRIES);
+      fprintf(stderr, "ERROR: Peer (%s) is too busy.\n", seeder->ip_addr);
+      exit(EXIT_FAILURE); 
+    }
+    long backoff = (long)BACKOFF_MIN_MS << attempt;
+    if (backoff < retry_ms) {
+      backoff = retry_ms;
+    }
+    if (backoff > BACKOFF_MAX_MS) {
+      backoff = BACKOFF_MAX_MS;
+    }
+    backoff += rand() % (backoff / 2 + 1);
+    log_record("(%s) Peer is busy, retrying in %ld ms.\n", seeder->ip_addr,
+      backoff);
+    usleep(backoff * 1000);
+  }
 
   recv(seeder->sockfd, seeder->piece_states, sizeof(int) * 
     seeder->request_info->info_dict->chunk_total, MSG_WAITALL);
@@ -332,18 +590,34 @@ void *download_chunkset_from_peer(void* args)
 {
   struct SeederInfo *seeder = (struct SeederInfo*) args;
   struct UsageInfo *request_info = (struct UsageInfo*) seeder->request_info;
-  char* buf = malloc(sizeof(char) * BUFSIZ);
-  long int file_size;
-  ssize_t len;
-  int chunk_id;
+  struct token_bucket peer_limit;
+  int pipefd[2] = {-1, -1};
+  int chunks_left, chunks;
 
   int chunk_size = request_info->info_dict->chunk_size;
 
-  /* create the download path */
-  char *p_download_dir = request_info->download_dir;
-  char *p_filename = request_info->info_dict->file_name;
-  char download_file_path[MAX_FILENAME];
-  sprintf(download_file_path , "%s/%s", p_download_dir, p_filename);
+  /* zero copy only works off a kernel socket, LEDBAT is user space. 
+   * O_DIRECT needs aligned user buffers, which splice doesn't have */
+  if (request_info->zero_copy && !seeder->use_ledbat && 
+    !request_info->direct_io) {
+    if (pipe(pipefd) == -1) {
+      log_record("(%s) No pipe for splice(), copying instead: %s\n",
+        seeder->ip_addr, strerror(errno));
+      pipefd[0] = -1;
+    }
+    else {
+      /* room for a whole chunk, so most chunks take one splice each way */
+      fcntl(pipefd[1], F_SETPIPE_SZ, chunk_size);
+    }
+  }
+
+  ratelimit_init(&peer_limit, request_info->peer_rate, 
+    &request_info->download_limit);
+
+  if (request_info->stream != NULL) {
+    stream_from_peer(seeder, &peer_limit, pipefd);
+    goto done;
+  }
 
   // Send the list of things we want from the peer
   send(seeder->sockfd, seeder->piece_states, sizeof(int) * 
@@ -356,59 +630,155 @@ void *download_chunkset_from_peer(void* args)
   printf("%d] from peer %s\n", seeder->piece_states[request_info->info_dict->
     chunk_total-1], seeder->ip_addr);
 
-  /* open our file for writing into */
-  FILE* file = fopen(download_file_path, "rb+");
-  if (file == NULL) {
-    fprintf(stderr, "Could not open file for download. %s", strerror(errno));
-    return NULL; // exit and destory objects
-  }
-
+  /* the seeder merges contiguous chunks into runs, so count chunks rather 
+   * than headers: a run of (file_size) bytes covers several chunks */
+  chunks_left = 0;
   for (int i = 0; i < request_info->info_dict->chunk_total; i++) {
+    if (seeder->piece_states[i] == 1) {
+      chunks_left++;
+    }
+  }
 
-    if (seeder->piece_states[i] != 1) {
-      // printf("DEBUG: I do not want chunk id %d!\n", i);
-      continue;
+  while (chunks_left > 0) {
+    chunks = recv_run(seeder, &peer_limit, pipefd);
+    if (chunks == -1) {
+      log_record("Peer %s hung up with (%d) chunks left.\n", 
+        seeder->ip_addr, chunks_left);
+      break;
     }
+    chunks_left -= chunks;
+  }
 
-    recv(seeder->sockfd, &chunk_id, sizeof(int), MSG_WAITALL);
-    // printf("Iteration %d: I am about to recieve chunk_id %d\n", i, 
-    //  chunk_id);
-    // printf("DEBUG: I want chunk id %d!\n", i);
-    recv(seeder->sockfd, &file_size, sizeof(long int), MSG_WAITALL);
-    // printf("DEBUG: chunk_size: '%ld'.\n", file_size);
+done:
+  ratelimit_destroy(&peer_limit);
+  if (seeder->use_ledbat) {
+    ledbat_close(&seeder->ledbat);
+  }
+  if (pipefd[0] != -1) {
+    close(pipefd[0]);
+    close(pipefd[1]);
+  }
+  return NULL;
+}
+
+static int recv_run(struct SeederInfo *seeder, 
+  struct token_bucket *peer_limit, int pipefd[2])
+{
+  struct UsageInfo *request_info = seeder->request_info;
+  struct stream *stream = request_info->stream;
+  int chunk_size = request_info->info_dict->chunk_size;
+  int fd = request_info->download_fd;
+  long int file_size;
+  ssize_t len;
+  int chunk_id;
+  struct disk_buf *b;
 
-    long int remain_data = file_size;
-    if (chunk_id == 0) {
-      fseek(file, 0, SEEK_SET);
-      // printf("Setting seek to 0\n");
+  if (recv_from_peer(seeder, &chunk_id, sizeof(int)) != sizeof(int) ||
+    recv_from_peer(seeder, &file_size, sizeof(long int)) != 
+    sizeof(long int)) {
+    return -1;
+  }
+  // printf("DEBUG: run of '%ld' bytes at chunk_id %d.\n", file_size, 
+  //  chunk_id);
+
+  /* pay for the whole run before reading it off the socket */
+  ratelimit_consume(peer_limit, file_size);
+
+  /* the run body is its chunks back to back (only the file's last chunk
+   * is short): take each one off the socket whole, then write it */
+  long int remain_data = file_size;
+  off_t offset = (off_t)chunk_size * chunk_id;
+  while (remain_data > 0)
+  {
+    len = (remain_data < chunk_size) ? remain_data : chunk_size;
+    if (pipefd[0] != -1) {
+      if (splice_chunk(seeder->sockfd, pipefd, fd, len, offset) == -1) {
+        break;
+      }
+      if (request_info->sync_policy == SYNC_CHUNK) {
+        fdatasync(fd);
+      }
+      if (stream != NULL) {
+        stream_written(stream, offset / chunk_size, 1);
+      }
     }
     else {
-      fseek(file, (chunk_size*chunk_id), SEEK_SET);
-      // printf("Setting seek to %d\n", (chunk_size*chunk_id));
-    }
-    int total_received_bytes;
-    while (remain_data > 0)
-    {
-      if (remain_data < BUFSIZ) { // we want our buffer size of data
-        len = recv(seeder->sockfd, buf, remain_data, MSG_WAITALL);
+      /* the disk writers take it from here, we only wait for them when
+       * every queue buffer is still in flight */
+      b = diskq_get(request_info->disk_queue);
+      if (recv_from_peer(seeder, b->data, len) != len) {
+        diskq_put(request_info->disk_queue, b);
+        break;
       }
-      else { // we want to recieve only the remaining data
-        len = recv(seeder->sockfd, buf, BUFSIZ, MSG_WAITALL);
+      b->fd = (len % DISKQ_ALIGN == 0) ? fd : request_info->tail_fd;
+      b->len = len;
+      b->offset = offset;
+      b->sync = (request_info->sync_policy == SYNC_CHUNK);
+      b->done = (stream != NULL) ? stream_buf_done : NULL;
+      b->arg = stream;
+      diskq_write(request_info->disk_queue, b);
+    }
+    offset += len;
+    remain_data -= len;
+  }
+  if (remain_data > 0) {
+    log_record("Peer %s hung up mid-run at chunk_id %d.\n", 
+      seeder->ip_addr, chunk_id);
+    return -1;
+  }
+  return (file_size + chunk_size - 1) / chunk_size;
+}
+
+static void stream_from_peer(struct SeederInfo *seeder, 
+  struct token_bucket *peer_limit, int pipefd[2])
+{
+  struct UsageInfo *request_info = seeder->request_info;
+  struct stream *stream = request_info->stream;
+  int chunk_total = request_info->info_dict->chunk_total;
+  int batch_left[STREAM_PIPELINE];    // chunks still due per request
+  int head = 0, nbatches = 0, n;
+  int *requested;
+
+  requested = malloc(sizeof(int) * chunk_total);
+  if (!requested) {
+    perror("ERROR: malloc(requested) failed.");
+    exit(1); }
+  printf("Streaming from peer %s\n", seeder->ip_addr);
+
+  for (;;) {
+    /* the seeder answers requests in order, so the next one can already
+     * be waiting on its side while it sends this one */
+    while (nbatches < STREAM_PIPELINE) {
+      n = stream_next_batch(stream, seeder, seeder->piece_states, requested,
+        nbatches == 0);
+      if (n == 0) {
+        break;
       }
-      if (len < 0) {
-        fprintf(stderr, "Error (%d): %s\n", errno, strerror(errno));
-        exit(EXIT_FAILURE);
+      if (send(seeder->sockfd, requested, sizeof(int) * chunk_total, 
+        MSG_NOSIGNAL) != sizeof(int) * chunk_total) {
+        nbatches = 0;
+        break;
       }
-      fwrite(buf, sizeof(char), len, file);
-      remain_data -= len;
-      total_received_bytes += len;
-      //fprintf(stdout, "Receive %ld bytes and we hope :- %ld bytes\n", 
-      //  len, remain_data);
-    }  
-    // printf("I received '%d' many bytes!\n", total_received_bytes);
-  }
-  fclose(file);
-  return NULL;
+      batch_left[(head + nbatches) % STREAM_PIPELINE] = n;
+      nbatches++;
+    }
+    if (nbatches == 0) {
+      break;
+    }
+    n = recv_run(seeder, peer_limit, pipefd);
+    if (n == -1) {
+      log_record("Peer %s hung up while streaming.\n", seeder->ip_addr);
+      break;
+    }
+    /* runs never span two requests */
+    batch_left[head] -= n;
+    if (batch_left[head] <= 0) {
+      head = (head + 1) % STREAM_PIPELINE;
+      nbatches--;
+    }
+  }
+  stream_peer_done(stream, seeder);
+  free(requested);
 }
 
 void generate_file(char *filePath) 
@@ -463,6 +833,10 @@ void generate_file(char *filePath)
 void request_file(struct UsageInfo *request_info)
 {
   tsize_t send_tag, recv_tag;
+  unsigned char *peers;
+  struct in_addr addr;
+  uint16_t port;
+  size_t len;
   char *p_tracker_ip = request_info->info_dict->tracker_ip;
   char *p_filename = request_info->info_dict->file_name;
 
@@ -474,10 +848,15 @@ void request_file(struct UsageInfo *request_info)
     exit(EXIT_FAILURE); 
   }
   printf("File request accepted by tracker (%s).\n", p_tracker_ip);
-  send(request_info->sockfd, &(request_info->info_dict->sha256sum), 
-    sizeof(char)*65, MSG_NOSIGNAL);
+  send_info_hash(request_info->sockfd, request_info->info_dict, 
+    request_info->numwant);
   printf("Searching for file '%s'...\n", p_filename);
   recv(request_info->sockfd, &recv_tag, 1, 0);
+  if (recv_tag == INVALID_NUMWANT) {
+    printf("ERROR: Tracker refused to send (%d) peers. Exiting.\n", 
+      request_info->numwant);
+    exit(EXIT_FAILURE); 
+  }
   if (recv_tag == REQUEST_NOT_FOUND) {
     printf("File was not available on the network. Cannot fetch peers."
       " Exiting.\n");
@@ -490,23 +869,44 @@ void request_file(struct UsageInfo *request_info)
   printf("Your request '%s' is available on the torrent network," 
     " fetching peers.\n", p_filename);
 
-  recv(request_info->sockfd, &request_info->num_peers, sizeof(int), 0);
-  request_info->peer_set = malloc(sizeof(char*)*request_info->num_peers);
-  for (int i = 0; i < request_info->num_peers; i++) {
-    request_info->peer_set[i] = malloc(INET_ADDRSTRLEN);
+  recv(request_info->sockfd, &request_info->num_peers, sizeof(int), 
+    MSG_WAITALL);
+  if (request_info->num_peers < 0) {
+    printf("ERROR: Unknown exception has occured. Exiting.\n");
+    exit(EXIT_FAILURE); 
   }
   printf("Found (%d) peers seeding on the network.\n", 
     request_info->num_peers);
+
+  /* the peers come packed, COMPACT_PEER_LEN bytes each, in one piece */
+  len = (size_t)request_info->num_peers * COMPACT_PEER_LEN;
+  peers = malloc(len + 1);
+  request_info->peer_set = malloc(sizeof(char*)*(request_info->num_peers + 1));
+  if (!peers || !request_info->peer_set) {
+    perror("ERROR: malloc(peer_set) failed.");
+    exit(1); }
+  if (recv(request_info->sockfd, peers, len, MSG_WAITALL) != (ssize_t)len) {
+    printf("ERROR: Tracker hung up while sending peers. Exiting.\n");
+    exit(EXIT_FAILURE); 
+  }
   for (int i = 0; i < request_info->num_peers; i++) {
-    recv(request_info->sockfd, request_info->peer_set[i], 
-      INET_ADDRSTRLEN, 0);
-    printf("\tPeer %d: (%s)\n", i+1, request_info->peer_set[i]);
+    memcpy(&addr.s_addr, peers + i * COMPACT_PEER_LEN, 4);
+    memcpy(&port, peers + i * COMPACT_PEER_LEN + 4, 2);
+    request_info->peer_set[i] = malloc(INET_ADDRSTRLEN);
+    if (!request_info->peer_set[i]) {
+      perror("ERROR: malloc(peer_set) failed.");
+      exit(1); }
+    inet_ntop(AF_INET, &addr, request_info->peer_set[i], INET_ADDRSTRLEN);
+    printf("\tPeer %d: (%s:%u)\n", i+1, request_info->peer_set[i], 
+      ntohs(port));
   }
+  free(peers);
 }
 
 void seed_file(struct UsageInfo *seed_info)
 {
   tsize_t send_tag, recv_tag;
+  int event = STARTED;
   char *p_tracker_ip = seed_info->info_dict->tracker_ip;
   char *p_filename = seed_info->info_dict->tracker_ip;
 
@@ -521,18 +921,234 @@ void seed_file(struct UsageInfo *seed_info)
       sleep(10); }
   }
   // (2) send to tracker server the hash of file to seed (and now provide)
-  send(seed_info->sockfd, &(seed_info->info_dict->sha256sum), sizeof(char)*65, 
-    MSG_NOSIGNAL);
+  send_info_hash(seed_info->sockfd, seed_info->info_dict, event);
   recv(seed_info->sockfd, &recv_tag, 1, 0);
-  if (recv_tag != SEED_SUCCESS) {
+  if (recv_tag != SEED_SUCCESS || recv(seed_info->sockfd, 
+    &seed_info->announce_interval, sizeof(int), MSG_WAITALL) != sizeof(int)) {
     perror("ERROR: Failed to seed file. Maybe the file doesn't exist?\n");
     exit(1); }
+  /* the announcer keeps us in the swarm from here on */
+  seeding = realloc(seeding, sizeof(struct UsageInfo *) * (num_seeding + 1));
+  if (!seeding) {
+    perror("ERROR: realloc(seeding) failed.");
+    exit(1); }
+  seeding[num_seeding++] = seed_info;
   printf("Seed request accepted by tracker (%s).\n", p_tracker_ip);
   printf("You are currently seeding file: '%s' on the torrent network.\n", 
     p_filename);
   printf("Awaiting leechers...\n");
 }
 
+struct UsageInfo *init_seed_info(struct ArgsInfo *args, 
+  struct InfoDictionary *info_dict)
+{
+  struct UsageInfo *seed_info;
+
+  seed_info = malloc(sizeof(struct UsageInfo));
+  if (!seed_info) {
+    perror("ERROR: malloc(seed_info) failed.");
+    exit(1); }
+  memset(seed_info, 0, sizeof(struct UsageInfo));
+  seed_info->upload_path = args->upload_path;
+  seed_info->info_dict = info_dict;
+  seed_info->peer_rate = args->peer_rate;
+  seed_info->drop_cache = args->drop_cache;
+  seed_info->chunk_states = malloc(sizeof(int) * info_dict->chunk_total);
+  if (!seed_info->chunk_states) {
+    perror("ERROR: malloc(chunk_states) failed.");
+    exit(1); }
+  ratelimit_init(&seed_info->upload_limit, RATE_UNLIMITED, &global_upload);
+  return seed_info;
+}
+
+void seed_torrent(struct ArgsInfo *args, char *torrent_path)
+{
+  struct InfoDictionary *info_dict;
+  struct UsageInfo *seed_info;
+
+  info_dict = malloc(sizeof(struct InfoDictionary));
+  if (!info_dict) {
+    perror("ERROR: malloc(info_dict) failed.");
+    exit(1); }
+  info_dict->file_path = torrent_path;
+  init_from_file(info_dict);
+
+  seed_info = init_seed_info(args, info_dict);
+  init_connection(P2T_PORTNUM, &seed_info->sockfd, info_dict->tracker_ip);
+  tracker_handshake(seed_info->sockfd);
+  seed_file(seed_info);
+  close(seed_info->sockfd);
+  seed_info->sockfd = -1;       // announces open their own connection
+  session_add(seed_info);
+}
+
+/* check that the tracker's next tag is (expect) */
+static int tracker_expect(int sockfd, tsize_t expect)
+{
+  tsize_t recv_tag;
+
+  if (recv(sockfd, &recv_tag, sizeof(tsize_t), 0) != sizeof(tsize_t)) {
+    return -1;
+  }
+  return (recv_tag == expect) ? 0 : -1;
+}
+
+/* send (send_tag) to the tracker and check that (expect) comes back */
+static int tracker_exchange(int sockfd, tsize_t send_tag, tsize_t expect)
+{
+  if (send(sockfd, &send_tag, sizeof(tsize_t), MSG_NOSIGNAL) == -1) {
+    return -1;
+  }
+  return tracker_expect(sockfd, expect);
+}
+
+static int announce(struct UsageInfo *info, int event)
+{
+  struct sockaddr_in saddr;
+  int sockfd = info->sockfd;
+  int interval, ret;
+
+  if (sockfd == -1) {
+    /* unlike init_connection(), a tracker that is down isn't fatal here */
+    saddr.sin_port = htons(P2T_PORTNUM);
+    saddr.sin_family = AF_INET;
+    if (!inet_aton(info->info_dict->tracker_ip, &saddr.sin_addr)) {
+      return -1;
+    }
+    sockfd = socket(PF_INET, SOCK_STREAM, 0);
+    if (sockfd == -1) {
+      return -1;
+    }
+    if (connect(sockfd, (struct sockaddr *)&saddr, sizeof(saddr)) == -1) {
+      close(sockfd);
+      return -1;
+    }
+  }
+
+  ret = -1;
+  if (tracker_exchange(sockfd, HANDSHAKE, HANDSHAKE_OK) == 0 &&
+    tracker_exchange(sockfd, SEED_REQUEST, SEED_APPROVED) == 0 &&
+    send_info_hash(sockfd, info->info_dict, event) != -1 &&
+    tracker_expect(sockfd, SEED_SUCCESS) == 0 &&
+    recv(sockfd, &interval, sizeof(int), MSG_WAITALL) == sizeof(int)) {
+    info->announce_interval = interval;
+    ret = 0;
+  }
+
+  if (sockfd != info->sockfd) {
+    close(sockfd);
+  }
+  else if (ret == -1) {
+    /* the kept connection is gone, the next announce makes a new one */
+    close(sockfd);
+    info->sockfd = -1;
+  }
+  return ret;
+}
+
+static void *announce_torrents(void *args)
+{
+  sigset_t *stop_signals = (sigset_t *)args;
+  struct timespec timeout;
+  int interval, sig, event;
+
+  while (1) {
+    interval = 0;
+    for (int i = 0; i < num_seeding; i++) {
+      if (seeding[i]->announce_interval > 0 && (interval == 0 || 
+        seeding[i]->announce_interval < interval)) {
+        interval = seeding[i]->announce_interval;
+      }
+    }
+    timeout.tv_sec = interval ? interval : DEFAULT_INTERVAL;
+    timeout.tv_nsec = 0;
+    sig = sigtimedwait(stop_signals, NULL, &timeout);
+    if (sig == -1 && errno == EINTR) {
+      continue;
+    }
+    event = (sig > 0) ? STOPPED : REANNOUNCE;
+    for (int i = 0; i < num_seeding; i++) {
+      if (announce(seeding[i], event) == -1) {
+        log_record("Announce of '%s' failed, retrying next interval.\n",
+          seeding[i]->info_dict->file_name);
+      }
+    }
+    if (sig > 0) {
+      printf("Stopped seeding (%d) torrents.\n", num_seeding);
+      log_record("Announced STOPPED for (%d) torrents. Exiting.\n",
+        num_seeding);
+      exit(EXIT_SUCCESS);
+    }
+  }
+  return NULL;
+}
+
+static int read_limits(char *path, struct ArgsInfo *args)
+{
+  FILE *fp;
+  char key[16];
+  long kib;
+
+  fp = fopen(path, "r");
+  if (!fp) {
+    return -1;
+  }
+  while (fscanf(fp, "%15s %ld", key, &kib) == 2) {
+    if (strcmp(key, "upload") == 0) {
+      args->upload_rate = kib * 1024;
+    }
+    else if (strcmp(key, "download") == 0) {
+      args->download_rate = kib * 1024;
+    }
+    else if (strcmp(key, "peer") == 0) {
+      args->peer_rate = kib * 1024;
+    }
+    else {
+      log_record("Unknown limit '%s' in %s.\n", key, path);
+    }
+  }
+  fclose(fp);
+  return 0;
+}
+
+static void *watch_limits(void *args)
+{
+  struct ArgsInfo *limits = (struct ArgsInfo *)args;
+  sigset_t hup_signal;
+  int sig;
+
+  sigemptyset(&hup_signal);
+  sigaddset(&hup_signal, SIGHUP);
+  while (1) {
+    if (sigwait(&hup_signal, &sig) != 0) {
+      continue;
+    }
+    if (read_limits(LIMITS_FILE, limits) == -1) {
+      log_record("SIGHUP: can't read %s, rate limits unchanged.\n",
+        LIMITS_FILE);
+      continue;
+    }
+    ratelimit_set(&global_upload, limits->upload_rate);
+    ratelimit_set(&global_download, limits->download_rate);
+    /* torrent buckets have no limit of their own, the peer buckets are
+     * the ones below them. new peers start at the new rate too */
+    ratelimit_set_below(&global_upload, 2, limits->peer_rate);
+    ratelimit_set_below(&global_download, 2, limits->peer_rate);
+    for (int i = 0; i < num_seeding; i++) {
+      __atomic_store_n(&seeding[i]->peer_rate, limits->peer_rate, 
+        __ATOMIC_RELAXED);
+    }
+    if (downloading != NULL) {
+      __atomic_store_n(&downloading->peer_rate, limits->peer_rate, 
+        __ATOMIC_RELAXED);
+    }
+    log_record("SIGHUP: rate limits now upload %ld, download %ld, peer %ld "
+      "KiB/s (0 is unlimited).\n", limits->upload_rate / 1024, 
+      limits->download_rate / 1024, limits->peer_rate / 1024);
+  }
+  return NULL;
+}
+
 void add_file(struct UsageInfo *add_info) 
 {
   tsize_t send_tag, recv_tag;
@@ -590,7 +1206,7 @@ void init_from_file(struct InfoDictionary *data)
       fprintf(stderr, "ERROR: Name could not be found!\n");
       exit(EXIT_FAILURE); }
 
-    ret = fscanf(infile, "%d", &data->file_size);
+    ret = fscanf(infile, "%ld", &data->file_size);
     if(ret == 0) {
       fprintf(stderr, "ERROR: Invalid filesize value initilaized!\n");
       exit(EXIT_FAILURE); }
@@ -647,6 +1263,157 @@ void tracker_handshake(int sockfd)
   }
 }
 
+static ssize_t send_info_hash(int sockfd, struct InfoDictionary *info_dict,
+  int arg)
+{
+  char msg[sizeof(info_dict->sha256sum) + sizeof(int)];
+
+  /* one write: sent apart, Nagle holds the int back until the tracker
+   * (delayed) ACKs the hash */
+  memcpy(msg, info_dict->sha256sum, sizeof(info_dict->sha256sum));
+  memcpy(msg + sizeof(info_dict->sha256sum), &arg, sizeof(int));
+  return send(sockfd, msg, sizeof(msg), MSG_NOSIGNAL);
+}
+
+int peer_handshake(struct SeederInfo *seeder)
+{
+  char msg[sizeof(tsize_t) + 65 + 1];
+  tsize_t comm_tag;
+  uint16_t port, retry_ms;
+  int ret;
+
+  /* the info hash tells a multi-torrent seeder which file we want, the
+   * flags whether to keep the connection open for more requests */
+  seeder->use_ledbat = 0;
+  comm_tag = seeder->request_info->use_ledbat ? HANDSHAKE_LEDBAT : HANDSHAKE;
+  memcpy(msg, &comm_tag, sizeof(tsize_t));
+  memcpy(msg + sizeof(tsize_t), seeder->request_info->info_dict->sha256sum,
+    65);
+  msg[sizeof(tsize_t) + 65] = 
+    (seeder->request_info->stream != NULL) ? PEER_STREAMING : 0;
+  ret = send(seeder->sockfd, msg, sizeof(msg), MSG_NOSIGNAL);
+  if (ret == -1 || recv(seeder->sockfd, &comm_tag, 1, 0) != 1) {
+    perror("ERROR: client-peer connection lost.\n");
+    exit(EXIT_FAILURE); 
+  }
+  switch (comm_tag) {
+    case HANDSHAKE_LEDBAT_OK:
+        recv(seeder->sockfd, &port, sizeof(uint16_t), MSG_WAITALL);
+        if (ledbat_connect(&seeder->ledbat, seeder->ip_addr, ntohs(port)) 
+          == -1) {
+          log_record("(%s) FATAL: LEDBAT stream could not be opened.\n",
+            seeder->ip_addr);
+          fprintf(stderr, "ERROR: LEDBAT stream to peer (%s) failed.\n",
+            seeder->ip_addr);
+          exit(EXIT_FAILURE); 
+        }
+        seeder->use_ledbat = 1;
+        log_record("(%s) Receiving chunks over LEDBAT.\n", seeder->ip_addr);
+        break;
+
+    case HANDSHAKE_OK:
+        if (seeder->request_info->use_ledbat) {
+          log_record("(%s) Peer could not open LEDBAT, using TCP.\n", 
+            seeder->ip_addr);
+        }
+        break;
+
+    case HANDSHAKE_BUSY:
+        if (recv(seeder->sockfd, &retry_ms, sizeof(uint16_t), MSG_WAITALL) 
+          != sizeof(uint16_t)) {
+          retry_ms = htons(BACKOFF_MIN_MS);
+        }
+        return ntohs(retry_ms) > 0 ? ntohs(retry_ms) : BACKOFF_MIN_MS;
+
+    default:
+        perror("ERROR: Failed to make client-peer handshake."
+          " Maybe the peer does not seed this file?\n");
+        exit(EXIT_FAILURE); 
+  }
+  return 0;
+}
+
+static void hash_download(struct UsageInfo *request_info, char *path,
+  char *sha256sum_output)
+{
+  if (request_info->direct_io) {
+    sha256sum_direct(path, sha256sum_output);
+  }
+  else {
+    sha256sum(path, sha256sum_output);
+  }
+}
+
+static int create_download_file(char *path, off_t size, int sparse)
+{
+  int fd, ret = -1;
+
+  fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    return -1;
+  }
+  /* reserve every block now: chunks come in out of order from several 
+   * peers, and a sparse file would get its extents in arrival order */
+  if (!sparse && size > 0) {
+    ret = fallocate(fd, 0, 0, size);
+    if (ret == -1 && errno != EOPNOTSUPP && errno != ENOSYS) {
+      close(fd);
+      return -1;
+    }
+    if (ret == -1) {
+      log_record("'%s' can't be preallocated here, creating it sparse.\n",
+        path);
+    }
+  }
+  if (ret == -1 && ftruncate(fd, size) == -1) {
+    close(fd);
+    return -1;
+  }
+  close(fd);
+  return 0;
+}
+
+static int splice_chunk(int sockfd, int pipefd[2], int fd, size_t len, 
+  off_t offset)
+{
+  loff_t off = offset;
+  ssize_t in, out;
+
+  while (len > 0) {
+    in = splice(sockfd, NULL, pipefd[1], NULL, len, 
+      SPLICE_F_MOVE | SPLICE_F_MORE);
+    if (in == -1 && errno == EINTR) {
+      continue;
+    }
+    if (in <= 0) {
+      return -1;    // error, or the peer hung up
+    }
+    len -= in;
+    /* drain the pipe completely so it never holds a stale partial chunk */
+    while (in > 0) {
+      out = splice(pipefd[0], NULL, fd, &off, in, SPLICE_F_MOVE);
+      if (out == -1 && errno == EINTR) {
+        continue;
+      }
+      if (out <= 0) {
+        log_record("Writing at offset %ld failed: %s\n", (long)off, 
+          strerror(errno));
+        return -1;
+      }
+      in -= out;
+    }
+  }
+  return 0;
+}
+
+static ssize_t recv_from_peer(struct SeederInfo *seeder, void *buf, 
+  size_t len)
+{
+  if (seeder->use_ledbat) {
+    return ledbat_recv(&seeder->ledbat, buf, len);
+  }
+  return recv(seeder->sockfd, buf, len, MSG_WAITALL);
+}
 
 void init_connection(int portnum, int *sockfd, char *ip_addr)
 {
@@ -684,18 +1451,42 @@ void init_connection(int portnum, int *sockfd, char *ip_addr)
 static void parse_args(int ac, char *av[], struct ArgsInfo *args, 
   struct InfoDictionary *info_dict)
 {
-  int c, usage_mode;
+  int c, usage_mode, upload_slots;
+  long upload_rate, download_rate, peer_rate;
+  int use_ledbat;
+  long cache_size;
+  int drop_cache, sync_policy, sparse, zero_copy, direct_io;
   char *torrent_path, *upload_path, *download_dir, *generate_path;
+  char *stream_path;
+  char *range;
+  int numwant;
 
   torrent_path = NULL;            // path to torrent file (.sly) (-a/-s/-r)
   usage_mode = USAGE_NULL;        // delcares usage of our cli (see usages)
   upload_path = NULL;             // path to directory of file to seed (-s)
   download_dir = NULL;            // path to directory to download file (-r)
   generate_path = NULL;           // path of torrent file to be generated (-g)
+  args->torrent_paths = NULL;     // every .sly given with -f (-s seeds all)
+  args->num_torrents = 0;
+  upload_slots = DEFAULT_UPLOAD_SLOTS; // # of leechers served at once (-u)
+  upload_rate = RATE_UNLIMITED;   // global upload limit in KiB/s (-U)
+  download_rate = RATE_UNLIMITED; // global download limit in KiB/s (-D)
+  peer_rate = RATE_UNLIMITED;     // per-peer limit in KiB/s (-P)
+  use_ledbat = 0;                 // background LEDBAT transfers (-b)
+  cache_size = (long)PIECECACHE_DEFAULT_MB << 20; // seeder piece cache (-C)
+  drop_cache = 0;                 // seed around the page cache (-N)
+  sync_policy = SYNC_NONE;        // when downloads hit the disk (-S)
+  sparse = 0;                     // preallocate downloads (-z)
+  zero_copy = 0;                  // recv() + pwrite() downloads (-Z)
+  direct_io = 0;                  // buffered downloads (-O)
+  stream_path = NULL;             // only write the download to disk (-T)
+  args->ranges = NULL;            // byte/chunk ranges to fetch (-R)
+  args->num_ranges = 0;
+  numwant = 0;                    // as many peers as the tracker sends (-n)
 
   while (1)
   {
-    c = getopt(ac, av, "has:r:g:f:");
+    c = getopt(ac, av, "has:r:g:f:u:U:D:P:bC:NS:zZOT:R:n:");
     if (c == -1)
     { break; } // no more args to parse!
     switch (c)
@@ -716,7 +1507,79 @@ static void parse_args(int ac, char *av[], struct ArgsInfo *args,
         generate_path = optarg;
       break;
     case 'f':
-        torrent_path = optarg;
+        add_torrent_path(args, optarg);
+        torrent_path = args->torrent_paths[0];
+        break;
+    case 'u':
+        upload_slots = atoi(optarg);
+        if (upload_slots <= 0) {
+          fprintf(stderr, "ERROR: -u <upload_slots> must be positive\n");
+          usage();
+        }
+        break;
+    case 'U':
+        upload_rate = atol(optarg) * 1024;
+        break;
+    case 'D':
+        download_rate = atol(optarg) * 1024;
+        break;
+    case 'P':
+        peer_rate = atol(optarg) * 1024;
+        break;
+    case 'b':
+        use_ledbat = 1;
+        break;
+    case 'C':
+        cache_size = atol(optarg) << 20;
+        break;
+    case 'N':
+        drop_cache = 1;
+        break;
+    case 'S':
+        if (strcmp(optarg, "none") == 0) {
+          sync_policy = SYNC_NONE;
+        }
+        else if (strcmp(optarg, "end") == 0) {
+          sync_policy = SYNC_END;
+        }
+        else if (strcmp(optarg, "chunk") == 0) {
+          sync_policy = SYNC_CHUNK;
+        }
+        else {
+          fprintf(stderr, "ERROR: -S <sync> must be none, end or chunk\n");
+          usage();
+        }
+        break;
+    case 'z':
+        sparse = 1;
+        break;
+    case 'Z':
+        zero_copy = 1;
+        break;
+    case 'O':
+        direct_io = 1;
+        break;
+    case 'T':
+        stream_path = optarg;
+        break;
+    case 'R':
+        /* several ranges per -R (comma separated) and several -R */
+        for (range = strtok(optarg, ","); range != NULL; 
+          range = strtok(NULL, ",")) {
+          args->ranges = realloc(args->ranges, 
+            sizeof(char *) * (args->num_ranges + 1));
+          if (!args->ranges) {
+            perror("ERROR: realloc(ranges) failed.");
+            exit(1); }
+          args->ranges[args->num_ranges++] = range;
+        }
+        break;
+    case 'n':
+        numwant = atoi(optarg);
+        if (numwant <= 0) {
+          fprintf(stderr, "ERROR: -n <numwant> must be positive\n");
+          usage();
+        }
         break;
     case ':':
         fprintf(stderr, "\n Error -%c missing arg\n", optopt);
@@ -757,6 +1620,11 @@ static void parse_args(int ac, char *av[], struct ArgsInfo *args,
     fprintf(stderr, "ERROR: No file defined -f <file_name>\n");
     usage();
     exit(EXIT_FAILURE);
+
+  } if (args->num_ranges > 0 && stream_path != NULL) {
+    fprintf(stderr, "ERROR: -R can't be combined with -T\n");
+    usage();
+    exit(EXIT_FAILURE);
   }
   
   /* intialize datafields of ArgsInfo struct */
@@ -766,6 +1634,113 @@ static void parse_args(int ac, char *av[], struct ArgsInfo *args,
   args->upload_path = upload_path;
   args->download_dir = download_dir;
   args->generate_path = generate_path;
+  args->upload_slots = upload_slots;
+  args->upload_rate = upload_rate;
+  args->download_rate = download_rate;
+  args->numwant = numwant;
+  args->peer_rate = peer_rate;
+  args->use_ledbat = use_ledbat;
+  args->cache_size = drop_cache ? 0 : cache_size;
+  args->drop_cache = drop_cache;
+  args->sync_policy = sync_policy;
+  args->sparse = sparse;
+  args->zero_copy = zero_copy;
+  args->direct_io = direct_io;
+  args->stream_path = stream_path;
+}
+
+static int *parse_ranges(struct ArgsInfo *args, 
+  struct InfoDictionary *info_dict)
+{
+  int *wanted;
+  long first, last, limit;
+  char *spec, *end;
+  int chunks = 0;
+
+  if (args->num_ranges == 0) {
+    return NULL;
+  }
+  wanted = calloc(info_dict->chunk_total, sizeof(int));
+  if (!wanted) {
+    perror("ERROR: calloc(wanted) failed.");
+    exit(1); }
+
+  for (int i = 0; i < args->num_ranges; i++) {
+    /* [c]first[-[last]]: a missing last runs to the end of the file */
+    spec = args->ranges[i];
+    limit = (spec[0] == 'c') ? info_dict->chunk_total : 
+      info_dict->file_size;
+    if (spec[0] == 'c') {
+      spec++;
+    }
+    first = strtol(spec, &end, 10);
+    last = first;
+    if (*end == '-' && end[1] == '\0') {
+      last = limit - 1;
+      end++;
+    }
+    else if (*end == '-') {
+      last = strtol(end + 1, &end, 10);
+    }
+    if (end == spec || *end != '\0' || first < 0 || last < first || 
+      first >= limit) {
+      fprintf(stderr, "ERROR: bad range '%s', the file has %ld bytes in "
+        "(%d) chunks\n", args->ranges[i], info_dict->file_size, 
+        info_dict->chunk_total);
+      exit(EXIT_FAILURE);
+    }
+    if (last >= limit) {
+      last = limit - 1;
+    }
+    if (args->ranges[i][0] != 'c') {
+      first /= info_dict->chunk_size;
+      last /= info_dict->chunk_size;
+    }
+    for (long j = first; j <= last; j++) {
+      chunks += !wanted[j];
+      wanted[j] = 1;
+    }
+  }
+  log_record("Downloading (%d) of (%d) chunks for (%d) ranges.\n", chunks,
+    info_dict->chunk_total, args->num_ranges);
+  return wanted;
+}
+
+static void add_torrent_path(struct ArgsInfo *args, char *path)
+{
+  struct stat st;
+  struct dirent *entry;
+  DIR *dir;
+  char *sly_path;
+  size_t len;
+
+  if (stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+    dir = opendir(path);
+    if (dir == NULL) {
+      fprintf(stderr, "ERROR: Could not open directory '%s'\n", path);
+      exit(EXIT_FAILURE);
+    }
+    while ((entry = readdir(dir)) != NULL) {
+      len = strlen(entry->d_name);
+      if (len > 4 && strcmp(entry->d_name + len - 4, ".sly") == 0) {
+        sly_path = malloc(strlen(path) + len + 2);
+        if (!sly_path) {
+          perror("ERROR: malloc(sly_path) failed.");
+          exit(1); }
+        sprintf(sly_path, "%s/%s", path, entry->d_name);
+        add_torrent_path(args, sly_path);
+      }
+    }
+    closedir(dir);
+    return;
+  }
+
+  args->torrent_paths = realloc(args->torrent_paths, 
+    sizeof(char *) * (args->num_torrents + 1));
+  if (!args->torrent_paths) {
+    perror("ERROR: realloc(torrent_paths) failed.");
+    exit(1); }
+  args->torrent_paths[args->num_torrents++] = path;
 }
 
 static void usage(void)
@@ -778,6 +1753,35 @@ static void usage(void)
           "\t-r request a file from peers on the torrent network\n"
           "\t-g generate a torrent from file\n"
           "\t-f file_name read in configuration info from a file\n"
-          "\t-h print out this message\n");
+          "\t   (with -s, repeat -f or give a directory of .sly files to seed"
+            " them all)\n"
+          "\t-u upload_slots # of leechers to seed to at once (default: %d)\n"
+          "\t-U KiB/s cap total upload rate (default: unlimited)\n"
+          "\t-D KiB/s cap total download rate (default: unlimited)\n"
+          "\t-P KiB/s cap the rate to/from each single peer\n"
+          "\t   (-U, -D and -P are re-read from ./" LIMITS_FILE " on SIGHUP)\n"
+          "\t-b download in the background over LEDBAT (UDP) when peers"
+            " support it\n"
+          "\t-C MiB memory for caching popular chunks when seeding, 0 to"
+            " turn it off (default: %d)\n"
+          "\t-N seed without caching: no piece cache, and chunks are"
+            " dropped from the page cache once sent\n"
+          "\t-S none|end|chunk when a download is synced to disk: left to"
+            " the kernel, once at the end, or after every chunk"
+            " (default: none)\n"
+          "\t-z create the download sparse instead of preallocating it\n"
+          "\t-Z receive chunks zero copy, spliced from the socket to the"
+            " file\n"
+          "\t-O write and verify downloads with O_DIRECT, keeping them out"
+            " of the page cache\n"
+          "\t-T path stream the download in order to a file or FIFO ('-'"
+            " for stdout) while it is still downloading\n"
+          "\t-R ranges only download these parts of the file, as byte"
+            " ranges (0-4095, 1048576-) or chunk ranges (c0-3, c7);"
+            " comma separated or repeated\n"
+          "\t-n numwant ask the tracker for at most this many peers, picked"
+            " at random (default: the tracker's choice)\n"
+          "\t-h print out this message\n", DEFAULT_UPLOAD_SLOTS, 
+          PIECECACHE_DEFAULT_MB);
   exit(-1);
 }
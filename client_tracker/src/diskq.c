@@ -0,0 +1,146 @@
+/*
+ * Swarthmore College, CS 87
+ * Copyright (c) 2020 Swarthmore College Computer Science Department,
+ * Swarthmore PA, Professor Tia Newhall
+ *
+ * SLY: diskq.c
+ * Authors: Sasha Casada, Yatin Lala, and Leo Douhovnikoff (12-18-2023)
+ */
+
+/**
+ * Write-behind queue for the leecher. Peer threads receive a chunk into a
+ * pooled buffer and queue it; writer threads pwrite() it at its offset and
+ * recycle the buffer. A slow or bursty disk then only costs buffers, and
+ * the TCP windows of the peers keep moving until all DISKQ_BUFFERS are in
+ * flight. Only then does a receiver block, which is the backpressure.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "shared.h"
+#include "diskq.h"
+
+///////////////////////////////////////////////////////////////////////////////
+
+/* pwrite all of (len) bytes of (buf) at (offset) of (fd) */
+static int write_all(int fd, char *buf, size_t len, off_t offset)
+{
+  ssize_t ret;
+
+  while (len > 0) {
+    ret = pwrite(fd, buf, len, offset);
+    if (ret == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    buf += ret;
+    offset += ret;
+    len -= ret;
+  }
+  return 0;
+}
+
+/* writer pool job: write one buffer out and recycle it */
+static void write_job(void *args)
+{
+  struct disk_buf *b = (struct disk_buf *)args;
+  struct diskq *q = b->q;
+  int failed = 0;
+
+  if (write_all(b->fd, b->data, b->len, b->offset) == -1) {
+    log_record("Writing %ld bytes at offset %ld failed: %s\n",
+      (long)b->len, (long)b->offset, strerror(errno));
+    failed = 1;
+  }
+  else if (b->sync) {
+    fdatasync(b->fd);
+  }
+  if (b->done != NULL) {
+    b->done(b, failed);
+  }
+  pthread_mutex_lock(&q->lock);
+  q->errors += failed;
+  pthread_mutex_unlock(&q->lock);
+  diskq_put(q, b);
+}
+
+void diskq_init(struct diskq *q, size_t buf_size, int nbufs, int nwriters)
+{
+  struct disk_buf *b;
+
+  pthread_mutex_init(&q->lock, NULL);
+  pthread_cond_init(&q->cond, NULL);
+  q->free_bufs = NULL;
+  q->nbufs = nbufs;
+  q->nfree = nbufs;
+  q->stalls = 0;
+  q->errors = 0;
+  for (int i = 0; i < nbufs; i++) {
+    /* aligned so the buffers also work for O_DIRECT */
+    b = malloc(sizeof(struct disk_buf));
+    if (!b || posix_memalign((void **)&b->data, DISKQ_ALIGN, buf_size)) {
+      perror("ERROR: malloc(disk_buf) failed.");
+      exit(1); }
+    b->q = q;
+    b->next = q->free_bufs;
+    q->free_bufs = b;
+  }
+  workpool_init(&q->pool, "disk writer", nwriters);
+}
+
+struct disk_buf *diskq_get(struct diskq *q)
+{
+  struct disk_buf *b;
+
+  pthread_mutex_lock(&q->lock);
+  if (q->free_bufs == NULL) {
+    q->stalls++;
+  }
+  while (q->free_bufs == NULL) {
+    pthread_cond_wait(&q->cond, &q->lock);
+  }
+  b = q->free_bufs;
+  q->free_bufs = b->next;
+  q->nfree--;
+  pthread_mutex_unlock(&q->lock);
+  return b;
+}
+
+void diskq_put(struct diskq *q, struct disk_buf *b)
+{
+  pthread_mutex_lock(&q->lock);
+  b->next = q->free_bufs;
+  q->free_bufs = b;
+  q->nfree++;
+  pthread_cond_broadcast(&q->cond);
+  pthread_mutex_unlock(&q->lock);
+}
+
+void diskq_write(struct diskq *q, struct disk_buf *b)
+{
+  workpool_submit(&q->pool, write_job, b);
+}
+
+int diskq_drain(struct diskq *q)
+{
+  int errors;
+
+  pthread_mutex_lock(&q->lock);
+  while (q->nfree < q->nbufs) {
+    pthread_cond_wait(&q->cond, &q->lock);
+  }
+  errors = q->errors;
+  q->errors = 0;
+  if (q->stalls > 0) {
+    log_record("Disk queue: receivers waited on the disk (%ld) times.\n",
+      q->stalls);
+  }
+  q->stalls = 0;
+  pthread_mutex_unlock(&q->lock);
+  return errors;
+}
@@ -0,0 +1,267 @@
+/*
+ * Swarthmore College, CS 87
+ * Copyright (c) 2020 Swarthmore College Computer Science Department,
+ * Swarthmore PA, Professor Tia Newhall
+ *
+ * SLY: filecache.c
+ * Authors: Sasha Casada, Yatin Lala, and Leo Douhovnikoff (12-18-2023)
+ */
+
+/**
+ * Open seed files, shared by all the connections serving them, so a new
+ * leecher costs a hash lookup instead of open() + fstat(). Entries are
+ * keyed by path and remember the inode they were opened as. An inotify
+ * watch on each file marks its entry stale as soon as the file is
+ * written, truncated, moved or deleted; the next connection then opens
+ * the file afresh, and the old descriptor is closed once the last
+ * connection using it lets go. The piece cache is keyed by the entry, so
+ * its pieces of the old file are dropped along with it.
+ *
+ * https://man7.org/linux/man-pages/man7/inotify.7.html
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include "shared.h"
+#include "filecache.h"
+#include "piececache.h"
+
+////////////////////////////// DEFINITIONS ////////////////////////////////////
+
+static struct seed_file *files[FILECACHE_HASHSIZE];
+static pthread_mutex_t file_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct seed_file *stale_files;   // out of the table, still in use
+static int inotify_fd = -1;
+
+///////////////////////////////////////////////////////////////////////////////
+
+static unsigned file_hash(char *s)
+{
+  unsigned hashval;
+  for (hashval = 0; *s != '\0'; s++)
+    hashval = *s + 31 * hashval;
+  return hashval % FILECACHE_HASHSIZE;
+}
+
+/* 1 if an entry of (list) other than (f) uses the watch of (f) */
+static int watch_used(struct seed_file *list, struct seed_file *f)
+{
+  for (; list != NULL; list = list->next) {
+    if (list != f && list->wd == f->wd) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* free (f) for good, and its watch if it was the last entry on it
+ * (file_lock held, no references left) */
+static void file_free(struct seed_file *f)
+{
+  struct seed_file **pp;
+  int used;
+
+  for (pp = &stale_files; *pp != NULL; pp = &(*pp)->next) {
+    if (*pp == f) {
+      *pp = f->next;
+      break;
+    }
+  }
+  if (f->wd != -1) {
+    used = watch_used(stale_files, f);
+    for (int i = 0; i < FILECACHE_HASHSIZE && !used; i++) {
+      used = watch_used(files[i], f);
+    }
+    /* fails harmlessly if the kernel dropped it with the file */
+    if (!used) {
+      inotify_rm_watch(inotify_fd, f->wd);
+    }
+  }
+  piececache_drop_owner(f);
+  if (f->fd != -1) {
+    close(f->fd);
+  }
+  free(f->path);
+  free(f);
+}
+
+/* take (f) out of the table; it is freed now or by its last user
+ * (file_lock held) */
+static void file_unlink(struct seed_file *f)
+{
+  struct seed_file **pp;
+
+  for (pp = &files[file_hash(f->path)]; *pp != NULL; pp = &(*pp)->next) {
+    if (*pp == f) {
+      *pp = f->next;
+      break;
+    }
+  }
+  f->stale = 1;
+  if (f->refs == 0) {
+    file_free(f);
+    return;
+  }
+  f->next = stale_files;
+  stale_files = f;
+  /* nobody asks for its pieces anymore, don't wait for the last user */
+  piececache_drop_owner(f);
+}
+
+/* mark every entry watched by (wd) stale (file_lock held) */
+static void file_invalidate(int wd)
+{
+  struct seed_file *f, *next;
+
+  for (int i = 0; i < FILECACHE_HASHSIZE; i++) {
+    for (f = files[i]; f != NULL; f = next) {
+      next = f->next;
+      if (f->wd == wd) {
+        log_record("Seed file '%s' changed on disk, reopening it.\n", 
+          f->path);
+        file_unlink(f);
+      }
+    }
+  }
+}
+
+/* thread that turns inotify events into stale entries */
+static void *inotify_thread(void *args)
+{
+  char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  struct inotify_event *ev;
+  ssize_t len;
+
+  while (1) {
+    len = read(inotify_fd, buf, sizeof(buf));
+    if (len <= 0) {
+      if (len == -1 && errno == EINTR) {
+        continue;
+      }
+      perror("ERROR: read(inotify) failed.");
+      return NULL;
+    }
+    pthread_mutex_lock(&file_lock);
+    for (char *p = buf; p < buf + len; 
+      p += sizeof(struct inotify_event) + ev->len) {
+      ev = (struct inotify_event *)p;
+      file_invalidate(ev->wd);
+    }
+    pthread_mutex_unlock(&file_lock);
+  }
+  return NULL;
+}
+
+void filecache_init(void)
+{
+  pthread_t tid;
+  int ret;
+
+  for (int i = 0; i < FILECACHE_HASHSIZE; i++) {
+    files[i] = NULL;
+  }
+  stale_files = NULL;
+  inotify_fd = inotify_init1(IN_CLOEXEC);
+  if (inotify_fd == -1) {
+    /* still share descriptors, we just won't notice changes */
+    log_record("inotify unavailable (%s), seed file changes won't be "
+      "noticed.\n", strerror(errno));
+    return;
+  }
+  ret = pthread_create(&tid, NULL, inotify_thread, NULL);
+  if (ret) {
+    perror("ERROR: pthread_create() failed.");
+    exit(1); }
+  pthread_detach(tid);
+}
+
+struct seed_file *filecache_open(char *path)
+{
+  struct seed_file *f;
+  struct stat st;
+  unsigned hashval = file_hash(path);
+
+  pthread_mutex_lock(&file_lock);
+  for (f = files[hashval]; f != NULL; f = f->next) {
+    if (strcmp(f->path, path) == 0) {
+      f->refs++;
+      pthread_mutex_unlock(&file_lock);
+      return f;
+    }
+  }
+  pthread_mutex_unlock(&file_lock);
+
+  /* not open yet: open it without holding the table */
+  f = malloc(sizeof(struct seed_file));
+  if (!f) {
+    perror("ERROR: malloc(seed_file) failed.");
+    exit(1); }
+  f->path = strdup(path);
+  /* watch first, so a change between open() and the watch isn't missed */
+  f->wd = (inotify_fd != -1) ? 
+    inotify_add_watch(inotify_fd, path, FILECACHE_EVENTS) : -1;
+  f->fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (f->fd == -1 || fstat(f->fd, &st) == -1) {
+    fprintf(stderr, "Could not open file for seeding. %s", strerror(errno));
+    pthread_mutex_lock(&file_lock);
+    file_free(f);
+    pthread_mutex_unlock(&file_lock);
+    return NULL;
+  }
+  f->dev = st.st_dev;
+  f->ino = st.st_ino;
+  f->size = st.st_size;
+  f->refs = 1;
+  f->stale = 0;
+
+  pthread_mutex_lock(&file_lock);
+  struct seed_file *other, *next;
+  for (other = files[hashval]; other != NULL; other = next) {
+    next = other->next;
+    if (strcmp(other->path, path) != 0) {
+      continue;
+    }
+    if (other->dev == f->dev && other->ino == f->ino) {
+      break;
+    }
+    file_unlink(other);   // the path points at a new file now
+  }
+  if (other != NULL) {
+    /* another connection opened the same file meanwhile, use theirs */
+    other->refs++;
+    f->refs = 0;
+    file_free(f);
+    f = other;
+  }
+  else {
+    f->next = files[hashval];
+    files[hashval] = f;
+  }
+  pthread_mutex_unlock(&file_lock);
+  return f;
+}
+
+void filecache_ref(struct seed_file *f)
+{
+  pthread_mutex_lock(&file_lock);
+  f->refs++;
+  pthread_mutex_unlock(&file_lock);
+}
+
+void filecache_close(struct seed_file *f)
+{
+  pthread_mutex_lock(&file_lock);
+  f->refs--;
+  if (f->refs == 0 && f->stale) {
+    file_free(f);
+  }
+  pthread_mutex_unlock(&file_lock);
+}
@@ -1,13 +1,21 @@
-/* 
- * C dictionary implementation from: 
+/*
+ * C dictionary implementation from:
  * https://stackoverflow.com/questions/4384359/quick-way-to-implement-dictionary-in-c
- * 
+ *
  * Written by Vijay Mathew <http://vmathew.in/>.
  *
  *
  * Edited for CS87 @ Swarthmore College by Sasha Casada
  */
 
+/**
+ * The table is split into HASH_SHARDS shards by the low bits of the hash,
+ * each with its own rwlock, so requests for different torrents don't
+ * wait on each other and lookups of the same one run side by side. Each
+ * shard doubles its buckets once it holds HASH_MAX_LOAD entries per
+ * bucket, which keeps chains short however many torrents there are.
+ **/
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -20,41 +28,140 @@
 
 /////////////////////////////////////////////////////////////////////
 
-struct nlist *hashtab[HASHSIZE];
+static struct hash_shard shards[HASH_SHARDS];
+static pthread_once_t shards_once = PTHREAD_ONCE_INIT;
+
+static void shards_init(void)
+{
+	for (int i = 0; i < HASH_SHARDS; i++) {
+		pthread_rwlock_init(&shards[i].lock, NULL);
+		shards[i].nbuckets = HASH_MIN_BUCKETS;
+		shards[i].buckets = calloc(HASH_MIN_BUCKETS, sizeof(struct nlist *));
+		shards[i].count = 0;
+		if (!shards[i].buckets) {
+			perror("ERROR: calloc(buckets) failed.");
+			exit(1); }
+	}
+}
 
+static struct hash_shard *shard_of(unsigned hashval)
+{
+	pthread_once(&shards_once, shards_init);
+	return &shards[hashval % HASH_SHARDS];
+}
+
+/* the bits below HASH_SHARDS picked the shard, use the ones above */
+static struct nlist **bucket_of(struct hash_shard *s, unsigned hashval)
+{
+	return &s->buckets[(hashval / HASH_SHARDS) & (s->nbuckets - 1)];
+}
+
+/* double the buckets of (s) (s->lock write held) */
+static void shard_grow(struct hash_shard *s)
+{
+	struct nlist **old = s->buckets, *np, *next, **bp;
+	unsigned nold = s->nbuckets;
+
+	s->buckets = calloc(nold * 2, sizeof(struct nlist *));
+	if (!s->buckets) {
+		/* keep going with longer chains */
+		s->buckets = old;
+		return;
+	}
+	s->nbuckets = nold * 2;
+	for (unsigned i = 0; i < nold; i++) {
+		for (np = old[i]; np != NULL; np = next) {
+			next = np->next;
+			bp = bucket_of(s, np->hashval);
+			np->next = *bp;
+			*bp = np;
+		}
+	}
+	free(old);
+}
+
+/* FNV-1a */
 unsigned hash(char *s)
 {
 	unsigned hashval;
-	for (hashval = 0; *s != '\0'; s++)
-		hashval = *s + 31 * hashval;
-	return hashval % HASHSIZE;
+	for (hashval = 2166136261u; *s != '\0'; s++)
+		hashval = (hashval ^ (unsigned char)*s) * 16777619u;
+	return hashval;
+}
+
+unsigned hash_shard(char *s)
+{
+	return hash(s) % HASH_SHARDS;
+}
+
+void hash_lock(char *s, int mode)
+{
+	struct hash_shard *sh = shard_of(hash(s));
+	if (mode == HASH_WRITE)
+		pthread_rwlock_wrlock(&sh->lock);
+	else
+		pthread_rwlock_rdlock(&sh->lock);
+}
+
+void hash_unlock(char *s)
+{
+	pthread_rwlock_unlock(&shard_of(hash(s))->lock);
 }
 
 struct nlist *hash_lookup(char *s)
 {
 	struct nlist *np;
-	for (np = hashtab[hash(s)]; np != NULL; np = np->next)
-		if (strcmp(s, np->name) == 0)
+	unsigned hashval = hash(s);
+	for (np = *bucket_of(shard_of(hashval), hashval); np != NULL; np = np->next)
+		if (np->hashval == hashval && strcmp(s, np->name) == 0)
 			return np; /* found */
 	return NULL; /* not found */
 }
 
 struct nlist *hash_install(char *name, struct peer_info *defn)
 {
-	struct nlist *np;
+	struct nlist *np, **bp;
+	struct hash_shard *s;
 	unsigned hashval;
-	if ((np = hash_lookup(name)) == NULL) { /* not found */
-		np = (struct nlist *) malloc(sizeof(*np));
-		if (np == NULL || (np->name = strdupl(name)) == NULL)
-			return NULL;
-		hashval = hash(name);
-		np->next = hashtab[hashval];
-		hashtab[hashval] = np;
-	} else /* already there */
-		free((void *) np->defn); /*free previous defn */
+	if ((np = hash_lookup(name)) != NULL) /* already there */
+		return np;
+	np = (struct nlist *) malloc(sizeof(*np));
+	if (np == NULL || (np->name = strdupl(name)) == NULL)
+		return NULL;
+	np->defn = defn;
+	np->hashval = hashval = hash(name);
+	s = shard_of(hashval);
+	if (s->count >= (long)s->nbuckets * HASH_MAX_LOAD)
+		shard_grow(s);
+	bp = bucket_of(s, hashval);
+	np->next = *bp;
+	*bp = np;
+	__atomic_add_fetch(&s->count, 1, __ATOMIC_RELAXED);
 	return np;
 }
 
+void hash_foreach(void (*fn)(struct nlist *np, void *arg), void *arg)
+{
+	struct nlist *np;
+	pthread_once(&shards_once, shards_init);
+	for (int i = 0; i < HASH_SHARDS; i++) {
+		pthread_rwlock_rdlock(&shards[i].lock);
+		for (unsigned b = 0; b < shards[i].nbuckets; b++)
+			for (np = shards[i].buckets[b]; np != NULL; np = np->next)
+				fn(np, arg);
+		pthread_rwlock_unlock(&shards[i].lock);
+	}
+}
+
+long hash_count(void)
+{
+	long count = 0;
+	pthread_once(&shards_once, shards_init);
+	for (int i = 0; i < HASH_SHARDS; i++)
+		count += __atomic_load_n(&shards[i].count, __ATOMIC_RELAXED);
+	return count;
+}
+
 char *strdupl(char *s) /* make a duplicate of s */
 {
 	char *p;
@@ -62,4 +169,4 @@ char *strdupl(char *s) /* make a duplicate of s */
 	if (p != NULL)
 		strcpy(p, s);
 	return p;
-}
\ No newline at end of file
+}
@@ -0,0 +1,567 @@
+/*
+ * Swarthmore College, CS 87
+ * Copyright (c) 2020 Swarthmore College Computer Science Department,
+ * Swarthmore PA, Professor Tia Newhall
+ *
+ * SLY: ledbat.c
+ * Authors: Sasha Casada, Yatin Lala, and Leo Douhovnikoff (12-18-2023)
+ */
+
+/**
+ * A small uTP-style reliable stream over UDP using LEDBAT congestion
+ * control, for background transfers which should get out of the way of
+ * everything else on the link. The sender measures the one-way delay of
+ * every packet (as echoed back in acks), and grows its congestion window
+ * only while the queuing delay it adds stays under LEDBAT_TARGET.
+ *
+ * Loss recovery is go-back-N: the receiver only keeps in-order packets, and
+ * on 3 duplicate acks or a timeout the sender rewinds to the oldest unacked
+ * packet. Chunk data is a one-way bulk stream, so this keeps both ends tiny.
+ *
+ * https://datatracker.ietf.org/doc/html/rfc6817
+ * https://www.bittorrent.org/beps/bep_0029.html
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include "shared.h"
+#include "ledbat.h"
+
+////////////////////////////// DEFINITIONS ////////////////////////////////////
+
+#define LEDBAT_SYN              1
+#define LEDBAT_SYNACK           2
+#define LEDBAT_DATA             3
+#define LEDBAT_ACK              4
+#define LEDBAT_FIN              5
+#define LEDBAT_FINACK           6
+
+#define LEDBAT_SYN_TRIES        20      // # of SYNs sent before giving up
+#define LEDBAT_SYN_WAIT         250     // ms to wait for each SYNACK
+#define LEDBAT_FIN_TRIES        5       // # of FINs sent before giving up
+#define LEDBAT_SOCKBUF          (4 * 1024 * 1024)
+
+/* on-the-wire packet header, all fields in network byte order */
+struct ledbat_header {
+  uint8_t type;
+  uint8_t unused;
+  uint16_t len;             // payload length
+  uint32_t seq;             // packet sequence number
+  uint32_t ack;             // next sequence number the receiver expects
+  uint32_t ts_us;           // sender's clock when the packet left
+  uint32_t ts_diff_us;      // one-way delay the receiver measured
+} __attribute__((packed));
+
+///////////////////////////////////////////////////////////////////////////////
+
+static uint64_t now_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int seq_lt(uint32_t a, uint32_t b) { return (int32_t)(a - b) < 0; }
+static int seq_le(uint32_t a, uint32_t b) { return (int32_t)(a - b) <= 0; }
+
+/* send a single packet on (s); payload may be NULL */
+static int send_packet(struct ledbat_sock *s, uint8_t type, uint32_t seq,
+  uint32_t ack, uint32_t ts_diff, const char *payload, uint16_t len)
+{
+  char buf[sizeof(struct ledbat_header) + LEDBAT_MSS];
+  struct ledbat_header *hdr = (struct ledbat_header *)buf;
+
+  hdr->type = type;
+  hdr->unused = 0;
+  hdr->len = htons(len);
+  hdr->seq = htonl(seq);
+  hdr->ack = htonl(ack);
+  hdr->ts_us = htonl((uint32_t)now_us());
+  hdr->ts_diff_us = htonl(ts_diff);
+  if (len > 0) {
+    memcpy(buf + sizeof(*hdr), payload, len);
+  }
+  if (send(s->fd, buf, sizeof(*hdr) + len, MSG_NOSIGNAL) == -1) {
+    return -1;
+  }
+  return 0;
+}
+
+/* wait up to (timeout_ms) for a packet. returns its length, 0 on timeout
+ * or -1 if the socket failed (e.g. the peer's port is gone) */
+static int recv_packet(struct ledbat_sock *s, char *buf, int timeout_ms)
+{
+  struct pollfd pfd = { .fd = s->fd, .events = POLLIN };
+  int ret;
+
+  ret = poll(&pfd, 1, timeout_ms);
+  if (ret <= 0) {
+    return (ret == 0 || errno == EINTR) ? 0 : -1;
+  }
+  ret = recv(s->fd, buf, sizeof(struct ledbat_header) + LEDBAT_MSS, 0);
+  if (ret < (int)sizeof(struct ledbat_header)) {
+    return (ret == -1) ? -1 : 0;
+  }
+  return ret;
+}
+
+static int new_socket(struct ledbat_sock *s)
+{
+  int bufsize = LEDBAT_SOCKBUF;
+
+  memset(s, 0, sizeof(*s));
+  s->fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (s->fd == -1) {
+    return -1;
+  }
+  setsockopt(s->fd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+  setsockopt(s->fd, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+  return 0;
+}
+
+/* give up on (s) while opening it. its descriptor is closed here and only
+ * here, ledbat_close() leaves it alone after that. returns -1 */
+static int drop_socket(struct ledbat_sock *s)
+{
+  close(s->fd);
+  s->fd = -1;
+  free(s->pending);
+  s->pending = NULL;
+  return -1;
+}
+
+/////////////////////////// DELAY MEASUREMENT /////////////////////////////////
+
+/* record a one-way delay sample in the base and current delay filters */
+static void update_delay(struct ledbat_sock *s, uint32_t delay)
+{
+  uint64_t minute = now_us() / 60000000;
+
+  if (minute != s->base_minute) {
+    /* start a fresh per-minute minimum, dropping any minutes we skipped */
+    for (uint64_t m = s->base_minute + 1; m <= minute &&
+      m <= s->base_minute + LEDBAT_BASE_HISTORY; m++) {
+      s->base_delay[m % LEDBAT_BASE_HISTORY] = UINT32_MAX;
+    }
+    s->base_minute = minute;
+  }
+  if (delay < s->base_delay[minute % LEDBAT_BASE_HISTORY]) {
+    s->base_delay[minute % LEDBAT_BASE_HISTORY] = delay;
+  }
+  s->cur_delay[s->cur_delay_idx] = delay;
+  s->cur_delay_idx = (s->cur_delay_idx + 1) % LEDBAT_CURRENT_FILTER;
+}
+
+/* queuing delay = filtered current delay minus the smallest delay seen
+ * over the base history; the clock offset between hosts cancels out */
+static uint32_t queuing_delay(struct ledbat_sock *s)
+{
+  uint32_t base = UINT32_MAX, cur = UINT32_MAX;
+
+  for (int i = 0; i < LEDBAT_BASE_HISTORY; i++) {
+    if (s->base_delay[i] < base) {
+      base = s->base_delay[i];
+    }
+  }
+  for (int i = 0; i < LEDBAT_CURRENT_FILTER; i++) {
+    if (s->cur_delay[i] < cur) {
+      cur = s->cur_delay[i];
+    }
+  }
+  if (base == UINT32_MAX || cur == UINT32_MAX || cur < base) {
+    return 0;
+  }
+  return cur - base;
+}
+
+//////////////////////////////// SENDER ///////////////////////////////////////
+
+/* recompute the # of unacked payload bytes in [snd_una, snd_nxt) */
+static long flight_size(struct ledbat_sock *s)
+{
+  long bytes = 0;
+  for (uint32_t seq = s->snd_una; seq_lt(seq, s->snd_nxt); seq++) {
+    bytes += s->window[seq % LEDBAT_WINDOW].len;
+  }
+  return bytes;
+}
+
+/* go-back-N: everything after snd_una will be sent again */
+static void rewind_window(struct ledbat_sock *s)
+{
+  s->snd_nxt = s->snd_una;
+  s->flight = 0;
+  s->dup_acks = 0;
+}
+
+/* send as many built or new packets as the congestion window allows,
+ * taking new payload from (buf) at (*off). returns -1 on socket error */
+static int fill_window(struct ledbat_sock *s, const char *buf, size_t len,
+  size_t *off)
+{
+  struct ledbat_packet *pkt;
+
+  while (s->flight + LEDBAT_MSS <= (long)s->cwnd ||
+    s->snd_nxt == s->snd_una) {
+    pkt = &s->window[s->snd_nxt % LEDBAT_WINDOW];
+    if (seq_lt(s->snd_nxt, s->snd_max)) {
+      pkt->retransmitted = 1;     // rewound packet, resend it as-is
+    }
+    else if (*off < len && s->snd_max - s->snd_una < LEDBAT_WINDOW) {
+      pkt->seq = s->snd_max++;
+      pkt->len = (len - *off > LEDBAT_MSS) ? LEDBAT_MSS : len - *off;
+      pkt->retransmitted = 0;
+      memcpy(pkt->data, buf + *off, pkt->len);
+      *off += pkt->len;
+    }
+    else {
+      break;
+    }
+    pkt->sent_us = now_us();
+    if (send_packet(s, LEDBAT_DATA, pkt->seq, 0, 0, pkt->data, pkt->len)
+      == -1) {
+      return -1;
+    }
+    s->flight += pkt->len;
+    s->snd_nxt++;
+  }
+  return 0;
+}
+
+/* handle an ack from the receiver: slide the window, take an RTT sample
+ * and apply the LEDBAT window update */
+static void process_ack(struct ledbat_sock *s, struct ledbat_header *hdr)
+{
+  uint32_t ack = ntohl(hdr->ack);
+  long acked = 0, prev_flight;
+  struct ledbat_packet *pkt;
+  double off_target, max_allowed;
+  uint64_t rtt;
+
+  update_delay(s, ntohl(hdr->ts_diff_us));
+
+  if (seq_lt(s->snd_una, ack) && seq_le(ack, s->snd_max)) {
+    for (uint32_t seq = s->snd_una; seq_lt(seq, ack); seq++) {
+      pkt = &s->window[seq % LEDBAT_WINDOW];
+      acked += pkt->len;
+      if (!pkt->retransmitted && seq + 1 == ack) {
+        rtt = now_us() - pkt->sent_us;
+        if (s->srtt == 0) {
+          s->srtt = rtt;
+          s->rttvar = rtt / 2;
+        }
+        else {
+          uint64_t err = (rtt > s->srtt) ? rtt - s->srtt : s->srtt - rtt;
+          s->rttvar = (3 * s->rttvar + err) / 4;
+          s->srtt = (7 * s->srtt + rtt) / 8;
+        }
+        s->rto = s->srtt + 4 * s->rttvar;
+        if (s->rto < LEDBAT_MIN_RTO) s->rto = LEDBAT_MIN_RTO;
+        if (s->rto > LEDBAT_MAX_RTO) s->rto = LEDBAT_MAX_RTO;
+      }
+    }
+    prev_flight = s->flight;
+    s->snd_una = ack;
+    if (seq_lt(s->snd_nxt, ack)) {
+      s->snd_nxt = ack;           // late ack for packets we had rewound
+    }
+    s->flight = flight_size(s);
+    s->last_ack = ack;
+    s->dup_acks = 0;
+    s->timeouts = 0;
+
+    off_target = (LEDBAT_TARGET - (double)queuing_delay(s)) / LEDBAT_TARGET;
+    s->cwnd += LEDBAT_GAIN * off_target * acked * LEDBAT_MSS / s->cwnd;
+    max_allowed = prev_flight + LEDBAT_ALLOWED_INCREASE * LEDBAT_MSS;
+    if (s->cwnd > max_allowed) s->cwnd = max_allowed;
+    if (s->cwnd < LEDBAT_MIN_CWND * LEDBAT_MSS) {
+      s->cwnd = LEDBAT_MIN_CWND * LEDBAT_MSS;
+    }
+    if (s->cwnd > (double)LEDBAT_WINDOW * LEDBAT_MSS) {
+      s->cwnd = (double)LEDBAT_WINDOW * LEDBAT_MSS;
+    }
+  }
+  else if (ack == s->last_ack && s->snd_una != s->snd_max) {
+    /* 3 duplicate acks: the receiver lost a packet. halve the window,
+     * at most once per window of data, and go back to the hole */
+    if (++s->dup_acks == 3) {
+      if (!seq_lt(s->snd_una, s->recover)) {
+        s->cwnd /= 2;
+        if (s->cwnd < LEDBAT_MIN_CWND * LEDBAT_MSS) {
+          s->cwnd = LEDBAT_MIN_CWND * LEDBAT_MSS;
+        }
+        s->recover = s->snd_max;
+      }
+      rewind_window(s);
+    }
+  }
+}
+
+/* wait for acks until the oldest unacked packet times out. returns -1 once
+ * the receiver has stopped answering altogether */
+static int wait_for_acks(struct ledbat_sock *s)
+{
+  char buf[sizeof(struct ledbat_header) + LEDBAT_MSS];
+  struct ledbat_header *hdr = (struct ledbat_header *)buf;
+  struct ledbat_packet *oldest;
+  int64_t wait;
+  int ret;
+
+  oldest = &s->window[s->snd_una % LEDBAT_WINDOW];
+  wait = (int64_t)(oldest->sent_us + s->rto) - (int64_t)now_us();
+  ret = recv_packet(s, buf, (wait > 0) ? (int)(wait / 1000) + 1 : 0);
+  if (ret == -1) {
+    return -1;
+  }
+  if (ret == 0) {
+    if (now_us() < oldest->sent_us + s->rto) {
+      return 0;
+    }
+    /* retransmission timeout: back to a 1 packet window */
+    if (++s->timeouts > LEDBAT_MAX_RETRIES) {
+      return -1;
+    }
+    s->rto = (s->rto * 2 > LEDBAT_MAX_RTO) ? LEDBAT_MAX_RTO : s->rto * 2;
+    s->cwnd = LEDBAT_MSS;
+    rewind_window(s);
+    return 0;
+  }
+
+  do {
+    if (hdr->type == LEDBAT_ACK) {
+      process_ack(s, hdr);
+    }
+    else if (hdr->type == LEDBAT_SYN) {
+      send_packet(s, LEDBAT_SYNACK, 0, 0, 0, NULL, 0); // our SYNACK was lost
+    }
+    /* drain everything already queued before sending again */
+    ret = recv(s->fd, buf, sizeof(buf), MSG_DONTWAIT);
+  } while (ret >= (int)sizeof(struct ledbat_header));
+  return 0;
+}
+
+int ledbat_listen(struct ledbat_sock *s, unsigned short *port)
+{
+  struct sockaddr_in saddr;
+  socklen_t socklen = sizeof(saddr);
+
+  if (new_socket(s) == -1) {
+    return -1;
+  }
+  memset(&saddr, 0, sizeof(saddr));
+  saddr.sin_family = AF_INET;
+  saddr.sin_port = 0;
+  saddr.sin_addr.s_addr = INADDR_ANY;
+  if (bind(s->fd, (struct sockaddr *)&saddr, sizeof(saddr)) == -1 ||
+    getsockname(s->fd, (struct sockaddr *)&saddr, &socklen) == -1) {
+    return drop_socket(s);
+  }
+  *port = ntohs(saddr.sin_port);
+  return 0;
+}
+
+int ledbat_accept(struct ledbat_sock *s, const char *peer_ip, int timeout_ms)
+{
+  char buf[sizeof(struct ledbat_header) + LEDBAT_MSS];
+  struct ledbat_header *hdr = (struct ledbat_header *)buf;
+  struct sockaddr_in caddr;
+  struct in_addr peer;
+  socklen_t socklen;
+  struct pollfd pfd = { .fd = s->fd, .events = POLLIN };
+  uint64_t deadline = now_us() + (uint64_t)timeout_ms * 1000;
+  int64_t left;
+
+  if (inet_pton(AF_INET, peer_ip, &peer) != 1) {
+    return drop_socket(s);
+  }
+  /* the port is announced over TCP, but anybody could send to it. only
+   * the leecher that asked for it may take the stream, and stray packets
+   * don't buy anyone more time */
+  while (1) {
+    left = (int64_t)(deadline - now_us());
+    if (left <= 0 || poll(&pfd, 1, (int)((left + 999) / 1000)) <= 0) {
+      return drop_socket(s);
+    }
+    socklen = sizeof(caddr);
+    if (recvfrom(s->fd, buf, sizeof(buf), 0, (struct sockaddr *)&caddr,
+      &socklen) < (int)sizeof(struct ledbat_header)) {
+      continue;
+    }
+    if (hdr->type == LEDBAT_SYN && 
+      caddr.sin_addr.s_addr == peer.s_addr) {
+      break;
+    }
+  }
+
+  if (connect(s->fd, (struct sockaddr *)&caddr, socklen) == -1) {
+    return drop_socket(s);
+  }
+
+  s->window = malloc(sizeof(struct ledbat_packet) * LEDBAT_WINDOW);
+  if (!s->window) {
+    perror("ERROR: malloc(window) failed.");
+    exit(1); }
+  s->cwnd = LEDBAT_INIT_CWND * LEDBAT_MSS;
+  s->rto = LEDBAT_MAX_RTO / 2;
+  s->base_minute = now_us() / 60000000;
+  for (int i = 0; i < LEDBAT_BASE_HISTORY; i++) {
+    s->base_delay[i] = UINT32_MAX;
+  }
+  for (int i = 0; i < LEDBAT_CURRENT_FILTER; i++) {
+    s->cur_delay[i] = UINT32_MAX;
+  }
+  return send_packet(s, LEDBAT_SYNACK, 0, 0, 0, NULL, 0);
+}
+
+ssize_t ledbat_send(struct ledbat_sock *s, const void *buf, size_t len)
+{
+  size_t off = 0;
+
+  while (1) {
+    if (fill_window(s, buf, len, &off) == -1) {
+      return -1;
+    }
+    if (off == len) {
+      return len;     // the rest is in flight; acks are reaped next time
+    }
+    if (wait_for_acks(s) == -1) {
+      return -1;
+    }
+  }
+}
+
+/////////////////////////////// RECEIVER //////////////////////////////////////
+
+int ledbat_connect(struct ledbat_sock *s, char *ip_addr, unsigned short port)
+{
+  char buf[sizeof(struct ledbat_header) + LEDBAT_MSS];
+  struct ledbat_header *hdr = (struct ledbat_header *)buf;
+  struct sockaddr_in saddr;
+  int ret;
+
+  if (new_socket(s) == -1) {
+    return -1;
+  }
+  saddr.sin_family = AF_INET;
+  saddr.sin_port = htons(port);
+  if (!inet_aton(ip_addr, &saddr.sin_addr) ||
+    connect(s->fd, (struct sockaddr *)&saddr, sizeof(saddr)) == -1) {
+    return drop_socket(s);
+  }
+  s->pending = malloc(LEDBAT_MSS);
+  if (!s->pending) {
+    perror("ERROR: malloc(pending) failed.");
+    exit(1); }
+
+  for (int i = 0; i < LEDBAT_SYN_TRIES; i++) {
+    send_packet(s, LEDBAT_SYN, 0, 0, 0, NULL, 0);
+    ret = recv_packet(s, buf, LEDBAT_SYN_WAIT);
+    /* a data packet means the SYNACK got lost; it will be resent */
+    if (ret > 0 && (hdr->type == LEDBAT_SYNACK || hdr->type == LEDBAT_DATA)) {
+      return 0;
+    }
+  }
+  return drop_socket(s);
+}
+
+ssize_t ledbat_recv(struct ledbat_sock *s, void *buf, size_t len)
+{
+  char pkt[sizeof(struct ledbat_header) + LEDBAT_MSS];
+  struct ledbat_header *hdr = (struct ledbat_header *)pkt;
+  uint32_t seq, delay;
+  size_t got = 0;
+  int n, ret;
+
+  while (got < len) {
+    if (s->pending_off < s->pending_len) {
+      n = s->pending_len - s->pending_off;
+      if ((size_t)n > len - got) {
+        n = len - got;
+      }
+      memcpy((char *)buf + got, s->pending + s->pending_off, n);
+      s->pending_off += n;
+      got += n;
+      continue;
+    }
+    if (s->eof) {
+      break;
+    }
+
+    ret = recv_packet(s, pkt, LEDBAT_IDLE_TIMEOUT * 1000);
+    if (ret <= 0) {
+      return -1;
+    }
+    seq = ntohl(hdr->seq);
+    delay = (uint32_t)now_us() - ntohl(hdr->ts_us);
+
+    if (hdr->type == LEDBAT_DATA) {
+      if (seq == s->rcv_nxt) {
+        s->pending_len = ntohs(hdr->len);
+        if (s->pending_len > ret - (int)sizeof(struct ledbat_header)) {
+          s->pending_len = 0;   // truncated packet, wait for a resend
+          continue;
+        }
+        memcpy(s->pending, pkt + sizeof(struct ledbat_header),
+          s->pending_len);
+        s->pending_off = 0;
+        s->rcv_nxt++;
+      }
+      /* out of order packets are dropped; the dup ack makes them resent */
+      send_packet(s, LEDBAT_ACK, 0, s->rcv_nxt, delay, NULL, 0);
+    }
+    else if (hdr->type == LEDBAT_FIN) {
+      if (seq == s->rcv_nxt) {
+        s->eof = 1;
+        send_packet(s, LEDBAT_FINACK, 0, s->rcv_nxt, delay, NULL, 0);
+      }
+      else {
+        send_packet(s, LEDBAT_ACK, 0, s->rcv_nxt, delay, NULL, 0);
+      }
+    }
+  }
+  return got;
+}
+
+int ledbat_close(struct ledbat_sock *s)
+{
+  char buf[sizeof(struct ledbat_header) + LEDBAT_MSS];
+  struct ledbat_header *hdr = (struct ledbat_header *)buf;
+  int ret = 0;
+
+  if (s->fd == -1) {
+    return 0;   // it never opened, drop_socket() cleaned up
+  }
+  if (s->window != NULL) {
+    /* sender: everything must be acked before we say FIN */
+    while (s->snd_una != s->snd_max) {
+      if (fill_window(s, NULL, 0, &(size_t){0}) == -1 ||
+        wait_for_acks(s) == -1) {
+        ret = -1;
+        break;
+      }
+    }
+    for (int i = 0; ret == 0 && i < LEDBAT_FIN_TRIES; i++) {
+      send_packet(s, LEDBAT_FIN, s->snd_max, 0, 0, NULL, 0);
+      if (recv_packet(s, buf, s->rto / 1000) > 0 &&
+        hdr->type == LEDBAT_FINACK) {
+        break;
+      }
+    }
+    free(s->window);
+  }
+  free(s->pending);
+  s->pending = NULL;
+  close(s->fd);
+  s->fd = -1;
+  return ret;
+}
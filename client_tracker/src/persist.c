@@ -0,0 +1,315 @@
+/*
+ * Swarthmore College, CS 87
+ * Copyright (c) 2020 Swarthmore College Computer Science Department,
+ * Swarthmore PA, Professor Tia Newhall
+ *
+ * SLY: persist.c
+ * Authors: Sasha Casada, Yatin Lala, and Leo Douhovnikoff (12-18-2023)
+ */
+
+/**
+ * Keeps the tracker's file index across restarts. Every change is one
+ * fixed size record appended to the WAL, and every SNAPSHOT_INTERVAL the
+ * whole index is written out as a snapshot in the same record format,
+ * after which the WAL it covers is dropped. Recovery maps the snapshot
+ * and then the WAL(s) and applies their records front to back, one pass.
+ *
+ * Taking a snapshot first moves the WAL aside to PERSIST_WAL_OLD, so
+ * changes made while the index is written out land in a fresh WAL. Some
+ * of them may then be in both, which is fine: replaying a record over an
+ * index that already has it changes nothing (except for the count of
+ * completed downloads, which is only a statistic). A crash at any point
+ * leaves a snapshot plus the WAL(s) needed on top of it.
+ *
+ * The WAL is fdatasync()ed as a group every WAL_SYNC_INTERVAL by the
+ * snapshot thread, not by each append, so a record is on disk at most
+ * that long after the change was answered. Recovery is one mmap()ed pass
+ * over fixed size records, which takes seconds and not milliseconds: 1-2 s
+ * for an index of 1M files and 3M records with the tracker built at -O0.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shared.h"
+#include "hashtable.h"
+#include "persist.h"
+
+/* start of a snapshot, (records) follow it */
+struct snapshot_header {
+  char magic[8];                  // SNAPSHOT_MAGIC, not terminated
+  uint64_t records;
+};
+
+/* where the snapshot being written is */
+struct snapshot_writer {
+  FILE *fp;
+  uint64_t records;
+};
+
+static int wal_fd = -1;
+static off_t wal_size;                  // bytes of whole records in the WAL
+static off_t wal_valid = -1;            // of PERSIST_WAL, found by recovery
+static long wal_records;                // logged since the last snapshot
+static int wal_dirty;                   // written since the last fdatasync
+static pthread_mutex_t wal_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t snapshot_lock = PTHREAD_MUTEX_INITIALIZER;
+
+///////////////////////////////////////////////////////////////////////////////
+
+/* hand every record of (path) to (apply). records end at the end of the
+ * file or at the first that isn't whole, which is where a crash stopped
+ * an append. returns the # applied */
+static long replay(char *path, int snapshot,
+  void (*apply)(struct persist_record *r, int snapshot))
+{
+  struct snapshot_header *hdr = NULL;
+  struct persist_record *r;
+  struct stat st;
+  char *base;
+  off_t off = 0;
+  long n = 0;
+  int fd;
+
+  fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    if (errno == ENOENT) {
+      return 0;
+    }
+    perror("ERROR: open(persist) failed.");
+    exit(1); }
+  if (fstat(fd, &st) == -1) {
+    perror("ERROR: fstat(persist) failed.");
+    exit(1); }
+  if (st.st_size == 0) {
+    close(fd);
+    return 0;
+  }
+  base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+  if (base == MAP_FAILED) {
+    perror("ERROR: mmap(persist) failed.");
+    exit(1); }
+  madvise(base, st.st_size, MADV_SEQUENTIAL);
+
+  if (snapshot) {
+    hdr = (struct snapshot_header *)base;
+    if (st.st_size < sizeof(*hdr) ||
+      memcmp(hdr->magic, SNAPSHOT_MAGIC, sizeof(hdr->magic)) != 0) {
+      log_record("Persist: %s is not a snapshot, ignoring it.\n", path);
+      munmap(base, st.st_size);
+      close(fd);
+      return 0;
+    }
+    off = sizeof(*hdr);
+  }
+  while (off + sizeof(*r) <= st.st_size) {
+    r = (struct persist_record *)(base + off);
+    if (r->type < PERSIST_ADD || r->type > PERSIST_COMPLETED) {
+      break;
+    }
+    apply(r, snapshot);
+    off += sizeof(*r);
+    n++;
+  }
+  if (snapshot && n != hdr->records) {
+    log_record("Persist: %s holds (%ld) of its (%lu) records.\n", path, n,
+      (unsigned long)hdr->records);
+  }
+  if (!snapshot && strcmp(path, PERSIST_WAL) == 0) {
+    wal_valid = off;
+  }
+  munmap(base, st.st_size);
+  close(fd);
+  return n;
+}
+
+long persist_recover(void (*apply)(struct persist_record *r, int snapshot))
+{
+  long n, wal;
+
+  n = replay(PERSIST_SNAPSHOT, 1, apply);
+  /* a snapshot that didn't finish leaves the WAL before it aside */
+  wal = replay(PERSIST_WAL_OLD, 0, apply);
+  wal += replay(PERSIST_WAL, 0, apply);
+  /* the next snapshot folds the WAL(s) into it */
+  wal_records = wal;
+  return n + wal;
+}
+
+void persist_init(void)
+{
+  wal_fd = open(PERSIST_WAL, O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (wal_fd == -1) {
+    perror("ERROR: open(wal) failed.");
+    exit(1); }
+  /* anything after the last whole record would hide what comes next */
+  if (wal_valid != -1 && ftruncate(wal_fd, wal_valid) == -1) {
+    perror("ERROR: ftruncate(wal) failed.");
+    exit(1); }
+  wal_size = lseek(wal_fd, 0, SEEK_END);
+}
+
+void persist_log(int type, char *name, unsigned char *peer)
+{
+  struct persist_record r;
+
+  memset(&r, 0, sizeof(r));
+  r.type = type;
+  if (peer != NULL) {
+    memcpy(r.peer, peer, COMPACT_PEER_LEN);
+  }
+  memcpy(r.name, name, strnlen(name, sizeof(r.name)));
+
+  pthread_mutex_lock(&wal_lock);
+  if (wal_fd != -1) {
+    if (write(wal_fd, &r, sizeof(r)) == sizeof(r)) {
+      wal_size += sizeof(r);
+      wal_records++;
+      wal_dirty = 1;
+    }
+    else {
+      /* don't leave half a record for the next one to go after */
+      log_record("Persist: WAL write failed: %s\n", strerror(errno));
+      if (ftruncate(wal_fd, wal_size) == -1) {
+        log_record("Persist: WAL truncate failed: %s\n", strerror(errno));
+      }
+    }
+  }
+  pthread_mutex_unlock(&wal_lock);
+}
+
+/* hash_foreach() callback: a file and its peers as snapshot records */
+static void snapshot_torrent(struct nlist *np, void *arg)
+{
+  struct snapshot_writer *sw = (struct snapshot_writer *)arg;
+  struct peer_info *p_info = np->defn;
+  struct persist_record r;
+
+  memset(&r, 0, sizeof(r));
+  r.type = PERSIST_ADD;
+  r.count = p_info->completed;
+  memcpy(r.name, np->name, strnlen(np->name, sizeof(r.name)));
+  fwrite(&r, sizeof(r), 1, sw->fp);
+  sw->records++;
+
+  r.type = PERSIST_SEED;
+  r.count = 0;
+  /* file requests reorder the peers under their read lock */
+  pthread_mutex_lock(&p_info->shuffle_lock);
+  for (int i = 0; i < p_info->curr_peers; i++) {
+    memcpy(r.peer, p_info->peers + i * COMPACT_PEER_LEN, COMPACT_PEER_LEN);
+    fwrite(&r, sizeof(r), 1, sw->fp);
+  }
+  sw->records += p_info->curr_peers;
+  pthread_mutex_unlock(&p_info->shuffle_lock);
+}
+
+int persist_snapshot(void)
+{
+  struct snapshot_header hdr;
+  struct snapshot_writer sw;
+  struct timeval start, end;
+  int ok;
+
+  pthread_mutex_lock(&snapshot_lock);
+  gettimeofday(&start, NULL);
+
+  /* changes from here on go to a fresh WAL. if the last snapshot failed
+   * its WAL is still aside and this one keeps going on top of it */
+  pthread_mutex_lock(&wal_lock);
+  if (access(PERSIST_WAL_OLD, F_OK) == -1 &&
+    rename(PERSIST_WAL, PERSIST_WAL_OLD) == 0) {
+    /* the old WAL is all there is until the snapshot is in place */
+    if (wal_dirty && fdatasync(wal_fd) == -1) {
+      log_record("Persist: WAL sync failed: %s\n", strerror(errno));
+    }
+    wal_dirty = 0;
+    close(wal_fd);
+    wal_fd = open(PERSIST_WAL, O_WRONLY | O_CREAT | O_APPEND | O_TRUNC, 0644);
+    if (wal_fd == -1) {
+      perror("ERROR: open(wal) failed.");
+      exit(1); }
+    wal_size = 0;
+  }
+  wal_records = 0;
+  pthread_mutex_unlock(&wal_lock);
+
+  sw.fp = fopen(PERSIST_SNAPSHOT ".tmp", "w");
+  if (!sw.fp) {
+    log_record("Persist: can't create snapshot: %s\n", strerror(errno));
+    pthread_mutex_unlock(&snapshot_lock);
+    return -1;
+  }
+  sw.records = 0;
+  memcpy(hdr.magic, SNAPSHOT_MAGIC, sizeof(hdr.magic));
+  hdr.records = 0;
+  fwrite(&hdr, sizeof(hdr), 1, sw.fp);
+  hash_foreach(snapshot_torrent, &sw);
+  hdr.records = sw.records;
+  fseek(sw.fp, 0, SEEK_SET);
+  fwrite(&hdr, sizeof(hdr), 1, sw.fp);
+
+  /* the new snapshot is only put in place once it is all on disk */
+  ok = (fflush(sw.fp) == 0 && fsync(fileno(sw.fp)) == 0);
+  ok = (fclose(sw.fp) == 0) && ok;
+  if (!ok || rename(PERSIST_SNAPSHOT ".tmp", PERSIST_SNAPSHOT) == -1) {
+    log_record("Persist: snapshot failed: %s\n", strerror(errno));
+    unlink(PERSIST_SNAPSHOT ".tmp");
+    pthread_mutex_unlock(&snapshot_lock);
+    return -1;
+  }
+  unlink(PERSIST_WAL_OLD);
+
+  gettimeofday(&end, NULL);
+  log_record("Persist: snapshot of (%lu) records took %.1f ms.\n",
+    (unsigned long)sw.records, (end.tv_sec - start.tv_sec) * 1000.0 +
+    (end.tv_usec - start.tv_usec) / 1000.0);
+  pthread_mutex_unlock(&snapshot_lock);
+  return 0;
+}
+
+/* group commit: one fdatasync() for everything appended since the last.
+ * it runs without wal_lock so appends go on meanwhile, snapshot_lock
+ * keeps persist_snapshot() from closing the WAL under it */
+static void wal_sync(void)
+{
+  int fd = -1;
+
+  pthread_mutex_lock(&snapshot_lock);
+  pthread_mutex_lock(&wal_lock);
+  if (wal_dirty) {
+    fd = wal_fd;
+    wal_dirty = 0;
+  }
+  pthread_mutex_unlock(&wal_lock);
+  if (fd != -1 && fdatasync(fd) == -1) {
+    log_record("Persist: WAL sync failed: %s\n", strerror(errno));
+  }
+  pthread_mutex_unlock(&snapshot_lock);
+}
+
+void *persist_loop(void *args)
+{
+  long ticks = SNAPSHOT_INTERVAL * 1000 / WAL_SYNC_INTERVAL;
+  long pending;
+
+  for (long tick = 0; ; tick++) {
+    if (tick % ticks == 0) {
+      pthread_mutex_lock(&wal_lock);
+      pending = wal_records;
+      pthread_mutex_unlock(&wal_lock);
+      if (pending > 0) {
+        persist_snapshot();
+      }
+    }
+    usleep(WAL_SYNC_INTERVAL * 1000);
+    wal_sync();
+  }
+  return NULL;
+}
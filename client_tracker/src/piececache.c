@@ -0,0 +1,380 @@
+/*
+ * Swarthmore College, CS 87
+ * Copyright (c) 2020 Swarthmore College Computer Science Department,
+ * Swarthmore PA, Professor Tia Newhall
+ *
+ * SLY: piececache.c
+ * Authors: Sasha Casada, Yatin Lala, and Leo Douhovnikoff (12-18-2023)
+ */
+
+/**
+ * Hot-piece cache for the seeder, so popular chunks are served from RAM
+ * instead of being read from disk for every leecher.
+ *
+ * Each shard runs the 2Q policy. A chunk requested for the first time
+ * goes on the small FIFO "in" queue. When it falls off that queue only
+ * its key is kept, on the "out" ghost queue. A chunk requested again
+ * while it is resident or a ghost has shown real frequency and moves to
+ * the LRU "hot" queue, which holds most of the memory. A leecher reading
+ * a whole cold file once just cycles through "in" without pushing hot
+ * pieces out. When "hot" has to give something up, the victim is the
+ * least requested of its PIECECACHE_SAMPLE least recently used pieces.
+ *
+ * Pieces are refcounted. An evicted piece that a connection is still
+ * sending from is unlinked right away, and its memory is freed by the
+ * last piececache_put().
+ *
+ * https://www.vldb.org/conf/1994/P439.PDF
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "shared.h"
+#include "piececache.h"
+
+////////////////////////////// DEFINITIONS ////////////////////////////////////
+
+static struct piece_shard shards[PIECECACHE_SHARDS];
+static long shard_capacity;             // resident bytes allowed per shard
+static long cache_capacity;
+
+///////////////////////////////////////////////////////////////////////////////
+
+static unsigned piece_hash(const void *owner, int chunk)
+{
+  unsigned long h = (unsigned long)owner;
+  h ^= (unsigned long)chunk * 2654435761UL;
+  h ^= h >> 15;
+  return (unsigned)h;
+}
+
+static struct piece_shard *shard_of(unsigned hash)
+{
+  return &shards[hash % PIECECACHE_SHARDS];
+}
+
+/* unlink (p) from queue (q) */
+static void queue_remove(struct piece_queue *q, struct piece *p)
+{
+  if (p->prev) p->prev->next = p->next; else q->head = p->next;
+  if (p->next) p->next->prev = p->prev; else q->tail = p->prev;
+  p->prev = p->next = NULL;
+  q->bytes -= p->len;
+  q->count--;
+}
+
+/* add (p) at the head of queue (q) */
+static void queue_push(struct piece_queue *q, struct piece *p)
+{
+  p->prev = NULL;
+  p->next = q->head;
+  if (q->head) q->head->prev = p; else q->tail = p;
+  q->head = p;
+  q->bytes += p->len;
+  q->count++;
+}
+
+/* find (owner, chunk) in (s) (s->lock held) */
+static struct piece *shard_find(struct piece_shard *s, unsigned hash,
+  const void *owner, int chunk)
+{
+  struct piece *p;
+
+  for (p = s->buckets[(hash / PIECECACHE_SHARDS) % PIECECACHE_BUCKETS];
+    p != NULL; p = p->hash_next) {
+    if (p->owner == owner && p->chunk == chunk) {
+      return p;
+    }
+  }
+  return NULL;
+}
+
+static void shard_unhash(struct piece_shard *s, struct piece *p)
+{
+  struct piece **pp;
+  unsigned hash = piece_hash(p->owner, p->chunk);
+
+  for (pp = &s->buckets[(hash / PIECECACHE_SHARDS) % PIECECACHE_BUCKETS];
+    *pp != NULL; pp = &(*pp)->hash_next) {
+    if (*pp == p) {
+      *pp = p->hash_next;
+      return;
+    }
+  }
+}
+
+/* forget (p) entirely, freeing it unless someone still sends from it
+ * (s->lock held) */
+static void piece_drop(struct piece_shard *s, struct piece *p)
+{
+  shard_unhash(s, p);
+  if (p->refs > 0) {
+    p->queue = PIECE_GONE;
+    return;
+  }
+  free(p->data);
+  free(p);
+}
+
+/* of the least recently used hot pieces, pick the least requested one
+ * (s->lock held) */
+static struct piece *hot_victim(struct piece_shard *s)
+{
+  struct piece *p, *victim = s->hot.tail;
+  int n = 0;
+
+  for (p = s->hot.tail; p != NULL && n < PIECECACHE_SAMPLE; p = p->prev) {
+    if (p->hits < victim->hits) {
+      victim = p;
+    }
+    n++;
+  }
+  return victim;
+}
+
+/* remember the key of (len) bytes of (chunk) on the "out" queue
+ * (s->lock held) */
+static void ghost_add(struct piece_shard *s, const void *owner, int chunk,
+  long len, long hits)
+{
+  struct piece *ghost;
+  unsigned hash = piece_hash(owner, chunk);
+  unsigned b = (hash / PIECECACHE_SHARDS) % PIECECACHE_BUCKETS;
+
+  ghost = malloc(sizeof(struct piece));
+  if (!ghost) {
+    perror("ERROR: malloc(piece) failed.");
+    exit(1); }
+  ghost->owner = owner;
+  ghost->chunk = chunk;
+  ghost->data = NULL;
+  ghost->len = len;
+  ghost->queue = PIECE_OUT;
+  ghost->refs = 0;
+  ghost->hits = hits;
+  ghost->hash_next = s->buckets[b];
+  s->buckets[b] = ghost;
+  queue_push(&s->out, ghost);
+}
+
+/* evict until (s) fits its share of the cache again (s->lock held) */
+static void shard_trim(struct piece_shard *s)
+{
+  struct piece *p;
+  long in_limit = shard_capacity * PIECECACHE_IN_PCT / 100;
+
+  while (s->in.bytes + s->hot.bytes > shard_capacity) {
+    if (s->in.tail != NULL && 
+      (s->in.bytes > in_limit || s->hot.tail == NULL)) {
+      /* first-timer falls off "in", remember only its key */
+      p = s->in.tail;
+      queue_remove(&s->in, p);
+      ghost_add(s, p->owner, p->chunk, p->len, p->hits);
+      piece_drop(s, p);
+    }
+    else {
+      p = hot_victim(s);
+      queue_remove(&s->hot, p);
+      piece_drop(s, p);
+    }
+    s->evictions++;
+  }
+
+  /* ghosts only cost their struct, keep as many as half the cache holds */
+  while (s->out.tail != NULL && 
+    s->out.bytes > shard_capacity * PIECECACHE_OUT_PCT / 100) {
+    p = s->out.tail;
+    queue_remove(&s->out, p);
+    piece_drop(s, p);
+  }
+}
+
+void piececache_init(long capacity)
+{
+  cache_capacity = (capacity > 0) ? capacity : 0;
+  shard_capacity = cache_capacity / PIECECACHE_SHARDS;
+  for (int i = 0; i < PIECECACHE_SHARDS; i++) {
+    pthread_mutex_init(&shards[i].lock, NULL);
+    for (int j = 0; j < PIECECACHE_BUCKETS; j++) {
+      shards[i].buckets[j] = NULL;
+    }
+    shards[i].in = shards[i].out = shards[i].hot = 
+      (struct piece_queue){NULL, NULL, 0, 0};
+    shards[i].hits = shards[i].misses = 0;
+    shards[i].ghost_hits = shards[i].evictions = 0;
+  }
+  if (cache_capacity > 0) {
+    log_record("Piece cache initialized with (%ld) MiB.\n", 
+      cache_capacity / (1024 * 1024));
+  }
+}
+
+int piececache_enabled(void)
+{
+  return cache_capacity > 0;
+}
+
+struct piece *piececache_get(const void *owner, int chunk, int file, 
+  off_t offset, long len)
+{
+  unsigned hash = piece_hash(owner, chunk);
+  struct piece_shard *s = shard_of(hash);
+  struct piece *p, *found;
+  char *data;
+  int ghost;
+
+  pthread_mutex_lock(&s->lock);
+  p = shard_find(s, hash, owner, chunk);
+  if (p != NULL && p->data != NULL) {
+    /* resident: a second request makes a first-timer hot */
+    queue_remove((p->queue == PIECE_IN) ? &s->in : &s->hot, p);
+    p->queue = PIECE_HOT;
+    queue_push(&s->hot, p);
+    p->refs++;
+    p->hits++;
+    s->hits++;
+    pthread_mutex_unlock(&s->lock);
+    return p;
+  }
+  ghost = (p != NULL);
+  s->misses++;
+  pthread_mutex_unlock(&s->lock);
+
+  /* miss: read the chunk without holding the shard */
+  data = malloc(len);
+  if (!data) {
+    perror("ERROR: malloc(piece) failed.");
+    exit(1); }
+  for (long done = 0; done < len; ) {
+    ssize_t ret = pread(file, data + done, len - done, offset + done);
+    if (ret <= 0) {
+      free(data);
+      return NULL;
+    }
+    done += ret;
+  }
+
+  pthread_mutex_lock(&s->lock);
+  found = shard_find(s, hash, owner, chunk);
+  if (found != NULL && found->data != NULL) {
+    /* somebody else loaded it meanwhile */
+    free(data);
+    found->refs++;
+    found->hits++;
+    pthread_mutex_unlock(&s->lock);
+    return found;
+  }
+  if (found != NULL) {
+    /* a ghost: it was requested before, so it goes straight to "hot" */
+    queue_remove(&s->out, found);
+    p = found;
+    s->ghost_hits++;
+    ghost = 1;
+  }
+  else {
+    p = malloc(sizeof(struct piece));
+    if (!p) {
+      perror("ERROR: malloc(piece) failed.");
+      exit(1); }
+    p->owner = owner;
+    p->chunk = chunk;
+    p->hits = 0;
+    unsigned b = (hash / PIECECACHE_SHARDS) % PIECECACHE_BUCKETS;
+    p->hash_next = s->buckets[b];
+    s->buckets[b] = p;
+    ghost = 0;
+  }
+  p->data = data;
+  p->len = len;
+  p->refs = 1;
+  p->hits++;
+  p->queue = ghost ? PIECE_HOT : PIECE_IN;
+  queue_push(ghost ? &s->hot : &s->in, p);
+  shard_trim(s);
+  pthread_mutex_unlock(&s->lock);
+  return p;
+}
+
+int piececache_wanted(const void *owner, int chunk, long len)
+{
+  unsigned hash = piece_hash(owner, chunk);
+  struct piece_shard *s = shard_of(hash);
+  int wanted = 1;
+
+  pthread_mutex_lock(&s->lock);
+  if (shard_find(s, hash, owner, chunk) == NULL) {
+    /* a first-timer: the caller reads it, we only note that it was */
+    ghost_add(s, owner, chunk, len, 1);
+    s->misses++;
+    shard_trim(s);
+    wanted = 0;
+  }
+  pthread_mutex_unlock(&s->lock);
+  return wanted;
+}
+
+void piececache_put(struct piece *p)
+{
+  struct piece_shard *s = shard_of(piece_hash(p->owner, p->chunk));
+
+  pthread_mutex_lock(&s->lock);
+  p->refs--;
+  if (p->refs == 0 && p->queue == PIECE_GONE) {
+    free(p->data);
+    free(p);
+  }
+  pthread_mutex_unlock(&s->lock);
+}
+
+/* drop the pieces of (owner) on queue (q) (s->lock held) */
+static void queue_drop_owner(struct piece_shard *s, struct piece_queue *q,
+  const void *owner)
+{
+  struct piece *p, *next;
+
+  for (p = q->head; p != NULL; p = next) {
+    next = p->next;
+    if (p->owner == owner) {
+      queue_remove(q, p);
+      piece_drop(s, p);
+    }
+  }
+}
+
+void piececache_drop_owner(const void *owner)
+{
+  struct piece_shard *s;
+
+  if (!piececache_enabled()) {
+    return;
+  }
+  for (int i = 0; i < PIECECACHE_SHARDS; i++) {
+    s = &shards[i];
+    pthread_mutex_lock(&s->lock);
+    queue_drop_owner(s, &s->in, owner);
+    queue_drop_owner(s, &s->hot, owner);
+    queue_drop_owner(s, &s->out, owner);
+    pthread_mutex_unlock(&s->lock);
+  }
+}
+
+void piececache_get_stats(struct piececache_stats *stats)
+{
+  struct piece_shard *s;
+
+  stats->bytes = stats->hits = stats->misses = 0;
+  stats->ghost_hits = stats->evictions = 0;
+  stats->capacity = cache_capacity;
+  for (int i = 0; i < PIECECACHE_SHARDS; i++) {
+    s = &shards[i];
+    pthread_mutex_lock(&s->lock);
+    stats->bytes += s->in.bytes + s->hot.bytes;
+    stats->hits += s->hits;
+    stats->misses += s->misses;
+    stats->ghost_hits += s->ghost_hits;
+    stats->evictions += s->evictions;
+    pthread_mutex_unlock(&s->lock);
+  }
+}
@@ -0,0 +1,157 @@
+/*
+ * Swarthmore College, CS 87
+ * Copyright (c) 2020 Swarthmore College Computer Science Department,
+ * Swarthmore PA, Professor Tia Newhall
+ *
+ * SLY: ratelimit.c
+ * Authors: Sasha Casada, Yatin Lala, and Leo Douhovnikoff (12-18-2023)
+ */
+
+/**
+ * Hierarchical token bucket rate limiting. Transfers are charged a whole
+ * chunk at a time: a bucket is allowed to go into debt, and the caller
+ * sleeps once for as long as the most indebted bucket in its chain needs to
+ * pay it back. This keeps throttling to at most one nanosleep() per chunk.
+ *
+ * https://en.wikipedia.org/wiki/Token_bucket
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include "ratelimit.h"
+
+////////////////////////////// DEFINITIONS ////////////////////////////////////
+
+struct token_bucket global_upload;
+struct token_bucket global_download;
+
+///////////////////////////////////////////////////////////////////////////////
+
+/* top up (tb) for the time since its last refill (tb->lock held) */
+static void refill(struct token_bucket *tb)
+{
+  struct timeval now;
+  double elapsed;
+
+  gettimeofday(&now, NULL);
+  elapsed = (now.tv_sec - tb->last.tv_sec) +
+    (now.tv_usec - tb->last.tv_usec) / 1000000.0;
+  tb->last = now;
+  if (tb->rate == RATE_UNLIMITED || elapsed <= 0) {
+    return;
+  }
+  tb->tokens += elapsed * tb->rate;
+  if (tb->tokens > tb->burst) {
+    tb->tokens = tb->burst;
+  }
+}
+
+/* take (bytes) from a single bucket, returning how many seconds the caller
+ * must wait before the bucket is out of debt again */
+static double bucket_take(struct token_bucket *tb, long bytes)
+{
+  double wait = 0;
+
+  pthread_mutex_lock(&tb->lock);
+  if (tb->rate != RATE_UNLIMITED) {
+    refill(tb);
+    tb->tokens -= bytes;
+    if (tb->tokens < 0) {
+      wait = -tb->tokens / tb->rate;
+    }
+  }
+  pthread_mutex_unlock(&tb->lock);
+  return wait;
+}
+
+void ratelimit_init(struct token_bucket *tb, long rate,
+  struct token_bucket *parent)
+{
+  pthread_mutex_init(&tb->lock, NULL);
+  tb->rate = (rate > 0) ? rate : RATE_UNLIMITED;
+  tb->burst = tb->rate;
+  tb->tokens = tb->burst;
+  tb->parent = parent;
+  tb->children = NULL;
+  gettimeofday(&tb->last, NULL);
+  if (parent != NULL) {
+    pthread_mutex_lock(&parent->lock);
+    tb->sibling = parent->children;
+    parent->children = tb;
+    pthread_mutex_unlock(&parent->lock);
+  }
+}
+
+void ratelimit_set(struct token_bucket *tb, long rate)
+{
+  pthread_mutex_lock(&tb->lock);
+  refill(tb);
+  tb->rate = (rate > 0) ? rate : RATE_UNLIMITED;
+  tb->burst = tb->rate;
+  if (tb->tokens > tb->burst) {
+    tb->tokens = tb->burst;
+  }
+  pthread_mutex_unlock(&tb->lock);
+}
+
+void ratelimit_set_below(struct token_bucket *tb, int depth, long rate)
+{
+  struct token_bucket *child;
+
+  if (depth == 0) {
+    ratelimit_set(tb, rate);
+    return;
+  }
+  /* always parent before child, so nobody can lock the other way round */
+  pthread_mutex_lock(&tb->lock);
+  for (child = tb->children; child != NULL; child = child->sibling) {
+    ratelimit_set_below(child, depth - 1, rate);
+  }
+  pthread_mutex_unlock(&tb->lock);
+}
+
+double ratelimit_reserve(struct token_bucket *tb, long bytes)
+{
+  double wait, longest = 0;
+
+  for (; tb != NULL; tb = tb->parent) {
+    wait = bucket_take(tb, bytes);
+    if (wait > longest) {
+      longest = wait;
+    }
+  }
+  return longest;
+}
+
+void ratelimit_consume(struct token_bucket *tb, long bytes)
+{
+  struct timespec ts;
+  double longest = ratelimit_reserve(tb, bytes);
+
+  if (longest <= 0) {
+    return;
+  }
+  ts.tv_sec = (time_t)longest;
+  ts.tv_nsec = (long)((longest - ts.tv_sec) * 1000000000.0);
+  while (nanosleep(&ts, &ts) == -1 && errno == EINTR);
+}
+
+void ratelimit_destroy(struct token_bucket *tb)
+{
+  struct token_bucket **pp;
+
+  if (tb->parent != NULL) {
+    pthread_mutex_lock(&tb->parent->lock);
+    for (pp = &tb->parent->children; *pp != NULL; pp = &(*pp)->sibling) {
+      if (*pp == tb) {
+        *pp = tb->sibling;
+        break;
+      }
+    }
+    pthread_mutex_unlock(&tb->parent->lock);
+  }
+  pthread_mutex_destroy(&tb->lock);
+}
@@ -15,8 +15,31 @@
  * https://stackoverflow.com/questions/11720079/linux-command-to-get-size-of-files-and-directories-present-in-a-particular-folde
  * https://www.reddit.com/r/learnprogramming/comments/2w0m1j/google_says_a_kilobyte_is_1000_bytes_is_it_1024/
  * https://stackoverflow.com/questions/11952898/c-send-and-receive-file
+ * https://man7.org/linux/man-pages/man7/epoll.7.html
+ *
+ * The seeder is a single epoll event loop feeding a work-stealing pool of
+ * SEEDER_IO_THREADS threads. Every leecher connection is a small state
+ * machine (enum conn_state) over a non-blocking socket, registered
+ * EPOLLONESHOT so only one thread ever works on it at a time. A ready
+ * connection becomes a pool job that sends at most one run of chunks and
+ * then yields itself back to the pool, so a 10,000 chunk transfer is just
+ * as many small jobs and idle threads can steal them. A connection that
+ * can't make progress for a reason other than its socket (torrent still
+ * hashing, no upload slot, rate limit debt) is parked off the epoll set
+ * and handed back to the pool by the event loop once it is due.
+ *
+ * Where the kernel supports it, run bodies that don't come out of the
+ * piece cache go through io_uring: the seed file sits in a registered
+ * file slot (the connection's clients[] index) and each chunk is one
+ * linked read -> send through a registered buffer. The completion is
+ * reaped by the event loop, which queues the connection again.
+ *
+ * Admission control (admission.c) decides after the handshake whether a
+ * leecher starts its transfer now, waits in a bounded FIFO parked off the
+ * epoll set, or is sent HANDSHAKE_BUSY with a retry-after hint.
  **/
 
+#define _GNU_SOURCE     // accept4()
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -35,183 +58,1161 @@
 #include <getopt.h>
 #include <math.h>
 #include <fcntl.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
 #include "shared.h"
 #include "seeder.h"
+#include "choker.h"
+#include "session.h"
+#include "workpool.h"
+#include "uring.h"
+#include "filecache.h"
+#include "admission.h"
 
 ////////////////////////////// DEFINITIONS ////////////////////////////////////
 
 struct client clients[MAX_CONNECTIONS];
 int connected_clients;  
 
+static int epfd, listenfd, choke_efd;
+static int listen_mark, choke_mark;       // epoll tags for the two fds
+static struct workpool io_pool;           // runs connection state machines
+static struct uring ring;                 // disk -> socket path, if uring_ok
+static int uring_ok, uring_mark;
+
+static struct client *free_clients;       // slots ready for a new leecher
+static pthread_mutex_t slot_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct client *timed_conns;        // parked until their wake time
+static struct client *timed_tail;         // the one that wakes last
+static struct client *choked_conns;       // parked until a slot frees up
+static struct client *queued_head, *queued_tail;  // waiting for admission
+static pthread_mutex_t park_lock = PTHREAD_MUTEX_INITIALIZER;
+
 ///////////////////////////////////////////////////////////////////////////////
 
-void *provide_chunkset_to_peer(void *args) 
+/* sendfile (len) bytes of (file) from (offset), looping over short sends.
+ * returns the # of bytes that made it into the socket, or if there were
+ * none -1 (errno set) or 0 at the end of (file) */
+static long int sendfile_range(int sockfd, int file, off_t offset, 
+  long int len)
 {
-  tsize_t send_tag, recv_tag;
-  struct thread_info *t_info;
+  long int sent = 0;
+  ssize_t ret;
 
-  t_info = (struct thread_info *)args;
-  struct UsageInfo *seed_info = t_info->seed_info;
+  while (sent < len) {
+    ret = sendfile(sockfd, file, &offset, len - sent);
+    if (ret == -1 && errno == EINTR) {
+      continue;
+    }
+    if (ret == -1) {
+      return (sent > 0) ? sent : -1;
+    }
+    if (ret == 0) {
+      break;
+    }
+    sent += ret;
+  }
+  return sent;
+}
 
-  // Client handshake
-  recv(clients[t_info->id].sockfd, &recv_tag, 1, 0);
+/* find the next run of contiguous chunks (at most SEND_BATCH_CHUNKS) that
+ * (c) asked for and we have, starting at c->next_chunk.
+ * returns 0 once there is nothing left to send */
+static int find_run(struct client *c)
+{
+  struct InfoDictionary *info = c->seed_info->info_dict;
+  int *p_chunk_states = c->seed_info->chunk_states;
+  int i = c->next_chunk;
+  int run = 0;
 
-  send_tag = HANDSHAKE_OK;
-  if (recv_tag != HANDSHAKE) {
-    send_tag = HANDSHAKE_ERROR;
-    perror("ERROR: failed to make client-server handshake.\n"); 
+  while (i < info->chunk_total && 
+    (c->requested[i] != 1 || p_chunk_states[i] != 1)) {
+    i++;
+  }
+  while (run < SEND_BATCH_CHUNKS && i + run < info->chunk_total &&
+    c->requested[i + run] == 1 && p_chunk_states[i + run] == 1) {
+    run++;
+  }
+  c->next_chunk = i;
+  if (run == 0) {
+    return 0;
+  }
+  c->run_chunk = i;
+  c->run_len = run;
+  c->run_bytes = (long)info->chunk_size * run;
+  if (i + run == info->chunk_total) {
+    /* the last chunk is short */
+    c->run_bytes -= (long)info->chunk_size * info->chunk_total - 
+      info->file_size;
   }
-  send(clients[t_info->id].sockfd, &send_tag, sizeof(tsize_t),
-             MSG_NOSIGNAL);
-  char client_ip[INET_ADDRSTRLEN];
+  c->run_sent = 0;
+  c->header_off = 0;
+  memcpy(c->header, &c->run_chunk, sizeof(int));
+  memcpy(c->header + sizeof(int), &c->run_bytes, sizeof(long int));
+  return 1;
+}
 
-  // STEP (5) update struct clients[] with new client information
-  strcpy(client_ip, clients[t_info->id].ip);
+/* a posix_fadvise() call, run on the disk pool so a slow device can't
+ * stall an I/O thread */
+struct advice {
+  struct seed_file *f;      // referenced until the advice has been given
+  off_t offset, len;
+  int advice;
+};
 
-  log_record("(%s) Shook hands with new client.\n", client_ip);
+static void advise_job(void *args)
+{
+  struct advice *a = (struct advice *)args;
 
-  // NOTE: Files are in KiB 128*(1024), not 128*(1000).
-  int sent_bytes = 0;
-  struct stat file_stat;
-  off_t offset;
-  long int remain_data;
+  posix_fadvise(a->f->fd, a->offset, a->len, a->advice);
+  filecache_close(a->f);
+  free(a);
+}
+
+/* queue (advice) for (len) bytes at (offset) of (c)'s seed file */
+static void conn_advise(struct client *c, off_t offset, off_t len, 
+  int advice)
+{
+  struct advice *a = malloc(sizeof(struct advice));
+  if (!a) {
+    perror("ERROR: malloc(advice) failed.");
+    exit(1); }
+  filecache_ref(c->seed_file);
+  a->f = c->seed_file;
+  a->offset = offset;
+  a->len = len;
+  a->advice = advice;
+  workpool_submit(&disk_pool, advise_job, a);
+}
+
+/* ask the kernel to start reading the next (c->ra_window) requested chunks
+ * from the current run on, skipping what it was already asked for. the
+ * window doubles every run the peer keeps streaming and falls back to
+ * READAHEAD_MIN whenever it has to wait for an upload slot */
+static void conn_readahead(struct client *c)
+{
+  struct InfoDictionary *info = c->seed_info->info_dict;
+  int *p_chunk_states = c->seed_info->chunk_states;
+  int i, start, wanted = 0;
+
+  for (i = c->run_chunk; i < info->chunk_total && wanted < c->ra_window; 
+    i++) {
+    if (c->requested[i] != 1 || p_chunk_states[i] != 1) {
+      continue;
+    }
+    /* one hint per stretch of contiguous chunks not yet prefetched */
+    start = i;
+    while (i < info->chunk_total && wanted < c->ra_window &&
+      c->requested[i] == 1 && p_chunk_states[i] == 1) {
+      wanted++;
+      i++;
+    }
+    if (i > c->ra_next) {
+      if (start < c->ra_next) {
+        start = c->ra_next;
+      }
+      conn_advise(c, (off_t)info->chunk_size * start, 
+        (off_t)info->chunk_size * (i - start), POSIX_FADV_WILLNEED);
+      c->ra_next = i;
+    }
+  }
+  if (c->ra_window < READAHEAD_MAX) {
+    c->ra_window *= 2;
+  }
+}
 
-  char *p_upload_path = seed_info->upload_path;
-  char *p_filename = seed_info->info_dict->file_name;
+/* get the shared descriptor of (c)'s seed file and make sure the file is
+ * still the right size */
+static int open_seed_file(struct client *c)
+{
   char upload_file_path[MAX_FILENAME];
 
-  int file_size = seed_info->info_dict->file_size;
-  int chunk_size = seed_info->info_dict->chunk_size; 
-  int chunk_total = seed_info->info_dict->chunk_total; 
-  int last_chunk_size = file_size - (chunk_size * (chunk_total-1) );
-  
-  int *p_chunk_states = seed_info->chunk_states;
-  int *p_requested_chunks = malloc(sizeof(int) * chunk_total);
+  sprintf(upload_file_path, "%s/%s", c->seed_info->upload_path, 
+    c->seed_info->info_dict->file_name);
+  c->seed_file = filecache_open(upload_file_path);
+  if (c->seed_file == NULL) {
+    return -1;
+  }
+  c->file = c->seed_file->fd;
+  if (c->seed_file->size != c->seed_info->info_dict->file_size) {
+    fprintf(stderr, "Bad seed. File size not correct.\n");
+    return -1;
+  }
+  return 0;
+}
+
+/* hand out a free slot of clients[], or NULL if we are full */
+static struct client *slot_get(void)
+{
+  struct client *c;
+
+  pthread_mutex_lock(&slot_lock);
+  c = free_clients;
+  if (c != NULL) {
+    free_clients = c->next;
+    c->isActive = 1;
+    connected_clients++;
+  }
+  pthread_mutex_unlock(&slot_lock);
+  return c;
+}
 
-  sprintf(upload_file_path , "%s/%s", p_upload_path, p_filename);
+/* the transfer of (c) is done, let admission count it out */
+static void transfer_done(struct client *c)
+{
+  struct timeval now;
 
-  struct stat st = {0};
-  if (stat(p_upload_path, &st) == -1) {
-    log_record("Path '%s' does not exist. Exiting\n", p_upload_path);
-    printf("Path '%s' does not exist. Exiting\n", p_upload_path);
-    fprintf(stderr, "Error (%d): %s\n", errno, strerror(errno));
-    exit(1);
+  if (c->admitted) {
+    gettimeofday(&now, NULL);
+    admission_exit((now.tv_sec - c->admit_tv.tv_sec) * 1000 +
+      (now.tv_usec - c->admit_tv.tv_usec) / 1000);
+    c->admitted = 0;
+  }
+}
+
+/* tear down (c) and put its slot back on the free list */
+static void slot_release(struct client *c)
+{
+  transfer_done(c);
+  if (c->registered) {
+    if (!c->idle) {
+      choker_unregister(&c->choke_state);
     }
+    ratelimit_destroy(&c->peer_limit);
+    c->registered = 0;
+  }
+  c->idle = 0;
+  if (c->piece != NULL) {
+    piececache_put(c->piece);
+    c->piece = NULL;
+  }
+  if (c->uring_file) {
+    uring_set_file(&ring, c - clients, -1);
+    c->uring_file = 0;
+  }
+  if (c->seed_file != NULL) {
+    filecache_close(c->seed_file);
+    c->seed_file = NULL;
+    c->file = -1;
+  }
+  close(c->sockfd);
+  free(c->io_buf);
+  free(c->requested);
+  c->io_buf = NULL;
+  c->requested = NULL;
+  log_record("(%s) Connection closed.\n", c->ip);
+
+  pthread_mutex_lock(&slot_lock);
+  c->isActive = 0;
+  c->next = free_clients;
+  free_clients = c;
+  connected_clients--;
+  pthread_mutex_unlock(&slot_lock);
+}
+
+/* re-arm (c) in the epoll set for (events) */
+static void conn_arm(struct client *c, uint32_t events)
+{
+  struct epoll_event ev;
+
+  ev.events = events | EPOLLONESHOT;
+  ev.data.ptr = c;
+  if (epoll_ctl(epfd, EPOLL_CTL_MOD, c->sockfd, &ev) == -1) {
+    perror("ERROR: epoll_ctl(MOD) failed.");
+    exit(1); }
+}
+
+/* park (c) off the epoll set for (ms) milliseconds. timed_conns is kept
+ * sorted by wake time, and as wake times mostly come in order (c) usually
+ * goes at the tail without a walk */
+static void park_timed(struct client *c, long ms)
+{
+  struct client **pp;
 
-  get_chunk_states(seed_info, upload_file_path);
-  for (int i=0; i<chunk_total; i++) {
-    // printf(" %d", p_chunk_states[i]);
-  } 
+  gettimeofday(&c->wake, NULL);
+  c->wake.tv_sec += ms / 1000;
+  c->wake.tv_usec += (ms % 1000) * 1000;
+  if (c->wake.tv_usec >= 1000000) {
+    c->wake.tv_sec++;
+    c->wake.tv_usec -= 1000000;
+  }
+  pthread_mutex_lock(&park_lock);
+  if (timed_tail == NULL || !timercmp(&c->wake, &timed_tail->wake, <)) {
+    pp = (timed_tail != NULL) ? &timed_tail->next : &timed_conns;
+  }
+  else {
+    for (pp = &timed_conns; !timercmp(&c->wake, &(*pp)->wake, <);
+      pp = &(*pp)->next);
+  }
+  c->next = *pp;
+  *pp = c;
+  if (c->next == NULL) {
+    timed_tail = c;
+  }
+  pthread_mutex_unlock(&park_lock);
+}
+
+/* park (c) until the choker gives it a slot. returns 0 if it was parked, 
+ * 1 if it got a slot in the meantime. the check happens under park_lock
+ * so a choker wakeup can't slip in between the check and the park */
+static int park_choked(struct client *c)
+{
+  int unchoked;
+
+  pthread_mutex_lock(&park_lock);
+  unchoked = choker_is_unchoked(&c->choke_state);
+  if (!unchoked) {
+    c->next = choked_conns;
+    choked_conns = c;
+  }
+  pthread_mutex_unlock(&park_lock);
+  return unchoked;
+}
 
-  // printf("Providing piece_states: [");
-  for (int i = 0; i < chunk_total-1; i++) {
-    // printf("%d, ", p_chunk_states[i]);
+/* park (c) at the back of the admission queue */
+static void park_queued(struct client *c)
+{
+  pthread_mutex_lock(&park_lock);
+  c->next = NULL;
+  if (queued_tail != NULL) {
+    queued_tail->next = c;
+  }
+  else {
+    queued_head = c;
   }
-  // printf("%d]\n", p_chunk_states[chunk_total-1]);
+  queued_tail = c;
+  pthread_mutex_unlock(&park_lock);
+}
 
-  /* Send list of present chunks */ 
-  send(clients[t_info->id].sockfd, p_chunk_states, sizeof(int) * 
-    chunk_total, MSG_NOSIGNAL);
-  // printf("Sending chunks...\n");
+/* tell a leecher we are too busy for it and when to come back. best
+ * effort, the socket buffer is empty at this point */
+static void send_busy(int sockfd)
+{
+  char reply[sizeof(tsize_t) + sizeof(uint16_t)];
+  tsize_t send_tag = HANDSHAKE_BUSY;
+  uint16_t retry_ms = htons(admission_retry_ms());
 
-  /* recieve the list of wanted chunks */
-  recv(clients[t_info->id].sockfd, p_requested_chunks, sizeof(int) * 
-    chunk_total, MSG_WAITALL);
+  memcpy(reply, &send_tag, sizeof(tsize_t));
+  memcpy(reply + sizeof(tsize_t), &retry_ms, sizeof(uint16_t));
+  send(sockfd, reply, sizeof(reply), MSG_NOSIGNAL);
+}
 
-  // printf("Requested piece_states: [");
-  for (int i = 0; i < chunk_total-1; i++) {
-    // printf("%d, ", p_requested_chunks[i]);
+/* move the part of c->io_buf that is still pending over the socket.
+ * returns 1 when done, 0 if the socket would block, -1 on error/hangup */
+static int conn_io(struct client *c, int reading)
+{
+  ssize_t ret;
+
+  while (c->io_off < c->io_len) {
+    if (reading) {
+      ret = recv(c->sockfd, c->io_buf + c->io_off, c->io_len - c->io_off, 0);
+    }
+    else {
+      ret = send(c->sockfd, c->io_buf + c->io_off, c->io_len - c->io_off,
+        MSG_NOSIGNAL);
+    }
+    if (ret == -1 && errno == EINTR) {
+      continue;
+    }
+    if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return 0;
+    }
+    if (ret <= 0) {
+      return -1;
+    }
+    c->io_off += ret;
   }
-  // printf("%d]\n", p_requested_chunks[chunk_total-1]);
-  
-  int file;
-  /* open our file for upload */
-  file = open(upload_file_path, O_RDONLY);
-  if (file == -1) {
-    fprintf(stderr, "Could not open file for seeding. %s", strerror(errno));
-    return NULL; // exit and destory objects
+  return 1;
+}
+
+/* start a buffered read or write of (len) bytes for the next state */
+static void conn_io_start(struct client *c, char *buf, size_t len)
+{
+  if (c->io_buf != buf) {
+    free(c->io_buf);
   }
-  // printf("We have opened file...!\n");
+  c->io_buf = buf;
+  c->io_len = len;
+  c->io_off = 0;
+}
 
+/* send the rest of the current run out of the piece cache, one chunk at a
+ * time. returns like conn_io */
+static int conn_send_cached(struct client *c)
+{
+  int chunk_size = c->seed_info->info_dict->chunk_size;
+  int chunk;
+  long off;
+  ssize_t ret;
+
+  while (c->run_sent < c->run_bytes) {
+    chunk = c->run_chunk + c->run_sent / chunk_size;
+    off = c->run_sent % chunk_size;
+    if (c->piece == NULL || c->piece->chunk != chunk) {
+      if (c->piece != NULL) {
+        piececache_put(c->piece);
+      }
+      c->piece = piececache_get(c->seed_file, chunk, c->file, 
+        (off_t)chunk_size * chunk, (c->run_bytes - c->run_sent + off < 
+        chunk_size) ? c->run_bytes - c->run_sent + off : chunk_size);
+      if (c->piece == NULL) {
+        return -1;
+      }
+    }
+    ret = send(c->sockfd, c->piece->data + off, c->piece->len - off, 
+      MSG_MORE | MSG_NOSIGNAL);
+    if (ret == -1 && errno == EINTR) {
+      continue;
+    }
+    if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return 0;
+    }
+    if (ret <= 0) {
+      return -1;
+    }
+    c->run_sent += ret;
+    choker_record(&c->choke_state, ret);
+  }
+  piececache_put(c->piece);
+  c->piece = NULL;
+  return 1;
+}
 
+/* queue the next piece of the current run as an io_uring read -> send.
+ * returns 2 once it is in flight, -1 if the ring can't take it now */
+static int conn_send_uring(struct client *c, off_t offset)
+{
+  long len = c->run_bytes - c->run_sent;
 
-  /* Get file stats */
-  if (fstat(file, &file_stat) < 0) {
-    fprintf(stderr, "Error fstat. Could not read file. %s", strerror(errno));
-    return NULL; // exit and destory objects
+  c->uring_buf = uring_get_buf(&ring);
+  if (c->uring_buf == -1) {
+    return -1;
+  }
+  if (len > URING_BUF_SIZE) {
+    len = URING_BUF_SIZE;
   }
-  if (file_stat.st_size != file_size) {
-    fprintf(stderr, "Bad seed. File size not correct. %s", strerror(errno));
-    return NULL; // exit and destory objects
+  /* the completion may run (c) on another thread before this returns */
+  if (uring_read_send(&ring, c - clients, offset, c->sockfd, c->uring_buf,
+    len, (uint64_t)(c - clients) << 1) == -1) {
+    uring_put_buf(&ring, c->uring_buf);
+    return -1;
   }
+  return 2;
+}
 
-  long int chunk_size_long = (long int)chunk_size;
-  long int last_chunk_size_long = (long int)last_chunk_size;
+/* whether the current run goes out of the piece cache. with io_uring, a
+ * run whose first chunk nobody asked for before is read and sent by the
+ * ring instead, the cache only takes it the next time round */
+static int conn_use_cache(struct client *c)
+{
+  int chunk_size = c->seed_info->info_dict->chunk_size;
 
-  /* Sending chunks loop */
-  for (int i = 0; i<chunk_total; i++) {
+  if (!piececache_enabled()) {
+    return 0;
+  }
+  if (!c->uring_file) {
+    return 1;
+  }
+  return piececache_wanted(c->seed_file, c->run_chunk, 
+    (c->run_bytes < chunk_size) ? c->run_bytes : chunk_size);
+}
 
-    if (p_requested_chunks[i] != 1) {
-      // printf("DEBUG: Client does not want chunk_id: %d!\n", i);
+/* write the current run header then the run body. returns like conn_io,
+ * or 2 if the body is now in flight on the io_uring */
+static int conn_send_run(struct client *c)
+{
+  ssize_t ret;
+  long sent;
+  off_t offset;
+
+  while (c->header_off < sizeof(c->header)) {
+    ret = send(c->sockfd, c->header + c->header_off, 
+      sizeof(c->header) - c->header_off, MSG_MORE | MSG_NOSIGNAL);
+    if (ret == -1 && errno == EINTR) {
       continue;
     }
+    if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return 0;
+    }
+    if (ret <= 0) {
+      return -1;
+    }
+    c->header_off += ret;
+  }
+  if (c->run_cached) {
+    return conn_send_cached(c);
+  }
+  offset = (off_t)c->seed_info->info_dict->chunk_size * c->run_chunk + 
+    c->run_sent;
+  if (c->run_sent == c->run_bytes) {
+    return 1;
+  }
+  if (c->uring_file && conn_send_uring(c, offset) == 2) {
+    return 2;
+  }
+  while (c->run_sent < c->run_bytes) {
+    offset = (off_t)c->seed_info->info_dict->chunk_size * c->run_chunk + 
+      c->run_sent;
+    sent = sendfile_range(c->sockfd, c->file, offset, 
+      c->run_bytes - c->run_sent);
+    if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return 0;
+    }
+    if (sent == 0) {
+      log_record("(%s) Seed file ends before chunk %d does.\n", c->ip,
+        c->run_chunk + (int)(c->run_sent / 
+        c->seed_info->info_dict->chunk_size));
+    }
+    if (sent <= 0) {
+      return -1;
+    }
+    /* a short send leaves the reason to the next call */
+    c->run_sent += sent;
+    choker_record(&c->choke_state, sent);
+  }
+  return 1;
+}
 
-    /* sending chunk id */
-    int chunk_id = i;
-    send(clients[t_info->id].sockfd, &chunk_id, sizeof(int), 0);
-    // printf("I am going to send chunk_id: %d.\n", chunk_id);
+/* the first bytes of a connection: handshake tag + info hash */
+static void conn_start(struct client *c)
+{
+  c->state = CONN_HANDSHAKE;
+  c->seed_info = NULL;
+  c->io_buf = NULL;
+  c->requested = NULL;
+  c->file = -1;
+  c->next_chunk = 0;
+  c->registered = 0;
+  c->streaming = 0;
+  c->idle = 0;
+  c->admitted = 0;
+  c->piece = NULL;
+  c->uring_file = 0;
+  c->ra_next = 0;
+  c->ra_window = READAHEAD_MIN;
+  c->io_buf = c->msg_buffer;
+  c->io_len = sizeof(tsize_t) + 65 + 1;
+  c->io_off = 0;
+}
 
-    /* sending file size */
-    if (i == chunk_total-1) {
-      send(clients[t_info->id].sockfd, &last_chunk_size_long, 
-        sizeof(long int), 0);
-      // fprintf(stdout, "File Size: %ld bytes\n", last_chunk_size_long);
+static void conn_task(void *args);
+
+/* advance (c) through the seeding protocol as far as possible without
+ * blocking. on return (c) is re-armed, parked, handed off or released */
+static void conn_run(struct client *c)
+{
+  tsize_t send_tag;
+  int ret, cork;
+  double wait;
+
+  while (1) {
+    switch (c->state) {
+
+      case CONN_HANDSHAKE:
+        ret = conn_io(c, 1);
+        if (ret == 0) {
+          conn_arm(c, EPOLLIN);
+          return;
+        }
+        c->io_buf = NULL;   // msg_buffer is part of the slot, don't free it
+        if (ret == -1) {
+          c->state = CONN_CLOSE;
+          break;
+        }
+        c->streaming = (c->msg_buffer[sizeof(tsize_t) + 65] & PEER_STREAMING);
+        c->msg_buffer[sizeof(tsize_t) + 64] = '\0';
+        c->state = CONN_LOOKUP;
+        break;
+
+      case CONN_LOOKUP: {
+        char *info_hash = c->msg_buffer + sizeof(tsize_t);
+        tsize_t recv_tag = (tsize_t)c->msg_buffer[0];
+        int status = session_find(info_hash, &c->seed_info);
+
+        if (status == SESSION_PENDING) {
+          park_timed(c, LOOKUP_RETRY_MS);
+          return;
+        }
+        send_tag = HANDSHAKE_OK;
+        if (status == SESSION_UNKNOWN) {
+          send_tag = HANDSHAKE_ERROR;
+          log_record("(%s) Requested torrent (%.8s...) is not seeded here.\n",
+            c->ip, info_hash);
+        }
+        else if (recv_tag != HANDSHAKE && recv_tag != HANDSHAKE_LEDBAT) {
+          send_tag = HANDSHAKE_ERROR;
+          log_record("(%s) Failed to make client-server handshake.\n", c->ip);
+        }
+        if (send_tag == HANDSHAKE_ERROR) {
+          /* best effort, the socket buffer is empty at this point */
+          send(c->sockfd, &send_tag, sizeof(tsize_t), MSG_NOSIGNAL);
+          c->state = CONN_CLOSE;
+          break;
+        }
+
+        /* from here on the leecher costs us a transfer */
+        ret = admission_enter();
+        if (ret == ADMIT_BUSY) {
+          send_busy(c->sockfd);
+          log_record("(%s) Turned away, admission queue is full.\n", c->ip);
+          c->state = CONN_CLOSE;
+          break;
+        }
+        c->state = CONN_ADMIT;
+        if (ret == ADMIT_QUEUED) {
+          park_queued(c);
+          return;
+        }
+        break;
+      }
+
+      case CONN_ADMIT: {
+        if (!c->admitted) {
+          c->admitted = 1;
+          gettimeofday(&c->admit_tv, NULL);
+        }
+        if (c->idle) {
+          /* a streaming leecher's next request, back in line for a slot */
+          choker_register(&c->choke_state);
+          c->idle = 0;
+          c->state = CONN_NEXT_RUN;
+          break;
+        }
+        if ((tsize_t)c->msg_buffer[0] == HANDSHAKE_LEDBAT) {
+          /* LEDBAT runs on its own thread; plain TCP if that fails */
+          if (thread_init(c, c - clients) == 0) {
+            return;
+          }
+        }
+        log_record("(%s) Shook hands with new client.\n", c->ip);
+        send_tag = HANDSHAKE_OK;
+
+        /* handshake reply and the list of present chunks in one write */
+        int chunk_total = c->seed_info->info_dict->chunk_total;
+        char *buf = malloc(sizeof(tsize_t) + sizeof(int) * chunk_total);
+        if (!buf) {
+          perror("ERROR: malloc(buf) failed.");
+          exit(1); }
+        memcpy(buf, &send_tag, sizeof(tsize_t));
+        memcpy(buf + sizeof(tsize_t), c->seed_info->chunk_states, 
+          sizeof(int) * chunk_total);
+        conn_io_start(c, buf, sizeof(tsize_t) + sizeof(int) * chunk_total);
+        c->state = CONN_SEND_STATES;
+        break;
+      }
+
+      case CONN_SEND_STATES:
+        ret = conn_io(c, 0);
+        if (ret == 0) {
+          conn_arm(c, EPOLLOUT);
+          return;
+        }
+        if (ret == -1) {
+          c->state = CONN_CLOSE;
+          break;
+        }
+        c->requested = malloc(sizeof(int) * 
+          c->seed_info->info_dict->chunk_total);
+        if (!c->requested) {
+          perror("ERROR: malloc(requested) failed.");
+          exit(1); }
+        conn_io_start(c, NULL, 0);
+        c->io_buf = (char *)c->requested;
+        c->io_len = sizeof(int) * c->seed_info->info_dict->chunk_total;
+        c->state = CONN_RECV_REQUEST;
+        break;
+
+      case CONN_RECV_REQUEST:
+        ret = conn_io(c, 1);
+        if (ret == 0) {
+          if (c->registered && !c->idle) {
+            /* nothing to send until the next request shows up, so the
+             * transfer and the upload slot go to somebody else */
+            transfer_done(c);
+            choker_unregister(&c->choke_state);
+            c->idle = 1;
+          }
+          conn_arm(c, EPOLLIN);
+          return;
+        }
+        c->io_buf = NULL;   // that was c->requested
+        if (ret == -1) {
+          c->state = CONN_CLOSE;
+          break;
+        }
+        if (c->idle) {
+          /* everything is set up already, but this is a new transfer */
+          ret = admission_enter();
+          if (ret == ADMIT_BUSY) {
+            log_record("(%s) Dropped stream, admission queue is full.\n",
+              c->ip);
+            c->state = CONN_CLOSE;
+            break;
+          }
+          c->state = CONN_ADMIT;
+          if (ret == ADMIT_QUEUED) {
+            park_queued(c);
+            return;
+          }
+          break;
+        }
+        if (c->registered) {
+          /* a pipelined request that was here before we ran dry */
+          c->state = CONN_NEXT_RUN;
+          break;
+        }
+        if (open_seed_file(c) == -1) {
+          c->state = CONN_CLOSE;
+          break;
+        }
+        if (uring_ok && uring_set_file(&ring, c - clients, c->file) == 0) {
+          c->uring_file = 1;
+        }
+        /* hold back partial segments so each header rides with its data */
+        cork = 1;
+        setsockopt(c->sockfd, IPPROTO_TCP, TCP_CORK, &cork, sizeof(cork));
+
+        /* queue up for an upload slot, we stay choked until picked */
+        choker_register(&c->choke_state);
+        ratelimit_init(&c->peer_limit, c->seed_info->peer_rate, 
+          &c->seed_info->upload_limit);
+        c->registered = 1;
+        c->state = CONN_NEXT_RUN;
+        break;
+
+      case CONN_NEXT_RUN:
+        if (!find_run(c)) {
+          if (!c->streaming) {
+            c->state = CONN_CLOSE;
+            break;
+          }
+          /* request done, a streaming leecher's next one comes in on the
+           * same connection. push out what the cork still holds first */
+          cork = 0;
+          setsockopt(c->sockfd, IPPROTO_TCP, TCP_CORK, &cork, sizeof(cork));
+          cork = 1;
+          setsockopt(c->sockfd, IPPROTO_TCP, TCP_CORK, &cork, sizeof(cork));
+          c->next_chunk = 0;
+          c->ra_next = 0;
+          c->ra_window = READAHEAD_MIN;
+          conn_io_start(c, NULL, 0);
+          c->io_buf = (char *)c->requested;
+          c->io_len = sizeof(int) * c->seed_info->info_dict->chunk_total;
+          c->state = CONN_RECV_REQUEST;
+          break;
+        }
+        /* the slot may be handed to another peer between any two runs */
+        if (!park_choked(c)) {
+          /* what we prefetched may be evicted before we get back */
+          c->ra_next = 0;
+          c->ra_window = READAHEAD_MIN;
+          return;
+        }
+        /* pay for the whole run up front (peer -> torrent -> global) */
+        wait = ratelimit_reserve(&c->peer_limit, c->run_bytes);
+        /* the disk can read ahead while we wait out the rate limit */
+        conn_readahead(c);
+        c->run_cached = conn_use_cache(c);
+        c->state = CONN_SEND_RUN;
+        if (wait > 0) {
+          c->state = CONN_THROTTLED;
+          park_timed(c, (long)(wait * 1000) + 1);
+          return;
+        }
+        break;
+
+      case CONN_THROTTLED:
+        c->state = CONN_SEND_RUN;
+        break;
+
+      case CONN_SEND_RUN:
+        ret = conn_send_run(c);
+        if (ret == 2) {
+          return;   // (c) belongs to the io_uring completion now
+        }
+        if (ret == -1) {
+          log_record("(%s) Connection lost after sending %ld of %ld bytes.\n", 
+            c->ip, c->run_sent, c->run_bytes);
+          c->state = CONN_CLOSE;
+          break;
+        }
+        if (ret == 0) {
+          conn_arm(c, EPOLLOUT);
+          return;
+        }
+        if (c->seed_info->drop_cache) {
+          conn_advise(c, (off_t)c->seed_info->info_dict->chunk_size * 
+            c->run_chunk, c->run_bytes, POSIX_FADV_DONTNEED);
+        }
+        admission_sent(c->run_bytes);
+        /* one run per job, so one big transfer can't hog a thread */
+        c->next_chunk = c->run_chunk + c->run_len;
+        c->state = CONN_NEXT_RUN;
+        workpool_yield(&io_pool, conn_task, c);
+        return;
+
+      case CONN_CLOSE:
+        if (c->registered) {
+          cork = 0;   // flush whatever is still held back
+          setsockopt(c->sockfd, IPPROTO_TCP, TCP_CORK, &cork, sizeof(cork));
+        }
+        slot_release(c);
+        return;
     }
-    else {
-      send(clients[t_info->id].sockfd, &chunk_size_long, sizeof(long int), 0);
-      // fprintf(stdout, "File Size: %ld bytes\n", chunk_size_long);
+  }
+}
+
+/* pool job: advance one connection */
+static void conn_task(void *args)
+{
+  conn_run((struct client *)args);
+}
+
+/* hand every parked connection that is due back to the pool. timed ones
+ * are sorted, so only the due ones are looked at. choked ones are only
+ * retried when (choke) is set, i.e. the choker just reassigned slots */
+static void unpark(int choke)
+{
+  struct timeval now;
+  struct client *due = NULL, *c, **pp;
+
+  gettimeofday(&now, NULL);
+  pthread_mutex_lock(&park_lock);
+  while (timed_conns != NULL && timercmp(&timed_conns->wake, &now, <=)) {
+    c = timed_conns;
+    timed_conns = c->next;
+    c->next = due;
+    due = c;
+  }
+  if (timed_conns == NULL) {
+    timed_tail = NULL;
+  }
+  if (choke) {
+    for (pp = &choked_conns; *pp != NULL; ) {
+      c = *pp;
+      if (choker_is_unchoked(&c->choke_state)) {
+        *pp = c->next;
+        c->next = due;
+        due = c;
+      }
+      else {
+        pp = &c->next;
+      }
+    }
+  }
+  /* admission slots go to the queue in arrival order */
+  while (queued_head != NULL && admission_dequeue()) {
+    c = queued_head;
+    queued_head = c->next;
+    if (queued_head == NULL) {
+      queued_tail = NULL;
     }
+    c->next = due;
+    due = c;
+  }
+  pthread_mutex_unlock(&park_lock);
 
-    if (p_chunk_states[chunk_id] != 1) {
+  while (due != NULL) {
+    c = due;
+    due = c->next;
+    workpool_submit(&io_pool, conn_task, c);
+  }
+}
+
+/* accept every pending leecher and give each one a slot */
+static void accept_clients(void)
+{
+  struct sockaddr_in caddr;
+  socklen_t socklen;
+  struct client *c;
+  struct epoll_event ev;
+  int sockfd;
+
+  while (1) {
+    socklen = sizeof(caddr);
+    sockfd = accept4(listenfd, (struct sockaddr *)&caddr, &socklen, 
+      SOCK_NONBLOCK);
+    if (sockfd == -1) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR &&
+        errno != ECONNABORTED) {
+        perror("ERROR: client failed to accept.\n");
+      }
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      return;
+    }
+    c = slot_get();
+    if (c == NULL) {
+      send_busy(sockfd);
+      close(sockfd);
+      log_record("Client attempted to connect when MAX_CONNECTIONS has "
+        "been reached.\n");
       continue;
     }
+    c->sockfd = sockfd;
+    inet_ntop(AF_INET, &(caddr.sin_addr), c->ip, INET_ADDRSTRLEN);
+    conn_start(c);
+    log_record("(%s) Accepted new client socket.\n", c->ip);
 
-    remain_data = (long int)chunk_size;
-    remain_data = remain_data - 8192;
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.ptr = c;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, sockfd, &ev) == -1) {
+      perror("ERROR: epoll_ctl(ADD) failed.");
+      exit(1); }
+  }
+}
+
+/* hand connections whose io_uring send finished back to the pool */
+static void uring_complete(void)
+{
+  struct io_uring_cqe cqes[SEEDER_EVENTS];
+  struct client *c;
+  int n;
 
-    if (chunk_id == 0) {
-      offset = 0;
-      // printf("I have set offset to: %d\n.", chunk_id);
+  while ((n = uring_reap(&ring, cqes, SEEDER_EVENTS)) > 0) {
+    for (int i = 0; i < n; i++) {
+      c = &clients[cqes[i].user_data >> 1];
+      if (!(cqes[i].user_data & URING_SEND)) {
+        /* a failed read cancels the linked send, handled below */
+        continue;
+      }
+      uring_put_buf(&ring, c->uring_buf);
+      if (cqes[i].res == -EAGAIN) {
+        /* the socket is full, what was read goes again once it drains */
+        conn_arm(c, EPOLLOUT);
+        continue;
+      }
+      if (cqes[i].res < 0) {
+        log_record("(%s) io_uring send failed: %s\n", c->ip, 
+          strerror(-cqes[i].res));
+        c->state = CONN_CLOSE;
+      }
+      else {
+        c->run_sent += cqes[i].res;
+        choker_record(&c->choke_state, cqes[i].res);
+      }
+      workpool_submit(&io_pool, conn_task, c);
     }
-    else {
-      offset = chunk_size*chunk_id;
+  }
+}
+
+/* log how far behind the I/O pool is */
+static void log_pool_stats(void)
+{
+  struct workpool_stats stats;
+  struct piececache_stats cache;
+  struct admission_stats admit;
+
+  workpool_get_stats(&io_pool, &stats);
+  log_record("I/O pool: (%d) connections, (%d) jobs queued (max %d per "
+    "thread), %ld run, %ld stolen.\n", connected_clients, stats.depth, 
+    stats.max_depth, stats.executed, stats.stolen);
+  if (piececache_enabled()) {
+    piececache_get_stats(&cache);
+    log_record("Piece cache: %ld/%ld KiB, %ld hits %ld misses (%.1f%% hit "
+      "rate), %ld promoted from ghosts, %ld evicted.\n", cache.bytes / 1024,
+      cache.capacity / 1024, cache.hits, cache.misses, 
+      (cache.hits + cache.misses > 0) ? 
+      100.0 * cache.hits / (cache.hits + cache.misses) : 0.0, 
+      cache.ghost_hits, cache.evictions);
+  }
+  admission_get_stats(&admit);
+  log_record("Admission: (%d/%d) transfers, (%d) queued, %ld admitted %ld "
+    "turned away, %.0f KiB/s.\n", admit.active, admit.limit, admit.queued,
+    admit.admitted, admit.rejected, admit.rate / 1024);
+}
+
+/* jobs waiting on the disk and I/O pools, the admission saturation signal */
+static int pool_backlog(void)
+{
+  struct workpool_stats io, disk;
+
+  workpool_get_stats(&io_pool, &io);
+  workpool_get_stats(&disk_pool, &disk);
+  return io.depth + disk.depth;
+}
+
+/* the event loop: wait for events, queue the connections they belong to */
+static void seed_loop(void)
+{
+  struct epoll_event events[SEEDER_EVENTS], ev;
+  struct timeval now, last_stats;
+  uint64_t count;
+  int n;
+
+  gettimeofday(&last_stats, NULL);
+  while (1) {
+    n = epoll_wait(epfd, events, SEEDER_EVENTS, SEEDER_TICK_MS);
+    if (n == -1 && errno != EINTR) {
+      perror("ERROR: epoll_wait() failed.");
+      exit(1); }
+
+    for (int i = 0; i < n; i++) {
+      if (events[i].data.ptr == &listen_mark) {
+        accept_clients();
+        ev.events = EPOLLIN | EPOLLONESHOT;
+        ev.data.ptr = &listen_mark;
+        epoll_ctl(epfd, EPOLL_CTL_MOD, listenfd, &ev);
+      }
+      else if (events[i].data.ptr == &uring_mark) {
+        uring_complete();
+      }
+      else if (events[i].data.ptr == &choke_mark) {
+        if (read(choke_efd, &count, sizeof(count)) == -1) {
+          // already drained by another thread
+        }
+        ev.events = EPOLLIN | EPOLLONESHOT;
+        ev.data.ptr = &choke_mark;
+        epoll_ctl(epfd, EPOLL_CTL_MOD, choke_efd, &ev);
+        unpark(1);
+      }
+      else {
+        workpool_submit(&io_pool, conn_task, events[i].data.ptr);
+      }
     }
-    int total_sent_bytes = 0;
-    /* Sending file data */
-    while (((sent_bytes = sendfile(clients[t_info->id].sockfd, file, 
-      &offset, BUFSIZ)) > 0) && (remain_data > 0)) {
-      fprintf(stdout, "1. Server sent %d bytes from file's data, offset is"
-        " now : %ld and remaining data = %ld\n", 
-        sent_bytes, offset, remain_data);
-      remain_data -= (long int)sent_bytes;
-      total_sent_bytes += sent_bytes;
-      fprintf(stdout, "2. Server sent %d bytes from file's data, offset is" 
-        " now : %ld and remaining data = %ld\n", 
-        sent_bytes, offset, remain_data);
+    unpark(0);
+    admission_tick(pool_backlog());
+
+    gettimeofday(&now, NULL);
+    if (now.tv_sec - last_stats.tv_sec >= SEEDER_STATS_INTERVAL) {
+      log_pool_stats();
+      last_stats = now;
     }
-    // printf("I sent '%d' many bytes!\n", total_sent_bytes);
   }
+}
 
-  if (close(file) == -1) {
-    fprintf(stderr, "Error closing file --> %s", strerror(errno));
-    return NULL; // exit and destory objects
+/* LEDBAT connection thread: the whole transfer runs blocking on this 
+ * thread, then the slot goes back to the event loop's free list */
+static void *provide_ledbat_to_peer(void *args)
+{
+  struct thread_info *t_info = (struct thread_info *)args;
+  struct client *c = &clients[t_info->id];
+  struct ledbat_sock ledbat_state, *ledbat = &ledbat_state;
+  unsigned short ledbat_port;
+  uint16_t ledbat_port_net;
+  tsize_t send_tag = HANDSHAKE_LEDBAT_OK;
+  int chunk_total = c->seed_info->info_dict->chunk_total;
+  int chunk_size = c->seed_info->info_dict->chunk_size;
+  char *chunk_buf = NULL;
+  ssize_t sent_bytes;
+  int flags;
+  char probe;
+
+  free(t_info->pthread_id);
+  free(t_info);
+  flags = fcntl(c->sockfd, F_GETFL);
+  fcntl(c->sockfd, F_SETFL, flags & ~O_NONBLOCK);
+
+  if (ledbat_listen(ledbat, &ledbat_port) == -1) {
+    /* no LEDBAT for this one, fall back to TCP through the event loop */
+    fcntl(c->sockfd, F_SETFL, flags);
+    c->msg_buffer[0] = HANDSHAKE;
+    conn_run(c);
+    return NULL;
   }
-  // printf("All chunks have been sent.\n");
+  ledbat_port_net = htons(ledbat_port);
+  send(c->sockfd, &send_tag, sizeof(tsize_t), MSG_NOSIGNAL);
+  send(c->sockfd, &ledbat_port_net, sizeof(uint16_t), MSG_NOSIGNAL);
+  if (ledbat_accept(ledbat, c->ip, LEDBAT_ACCEPT_TIMEOUT) == -1) {
+    log_record("(%s) LEDBAT stream was never opened.\n", c->ip);
+    ledbat_close(ledbat);
+    slot_release(c);
+    return NULL;
+  }
+  log_record("(%s) Sending chunks over LEDBAT.\n", c->ip);
+
+  /* Send list of present chunks, recieve the list of wanted chunks */ 
+  c->requested = malloc(sizeof(int) * chunk_total);
+  chunk_buf = malloc(chunk_size);
+  if (!c->requested || !chunk_buf) {
+    perror("ERROR: malloc(requested) failed.");
+    exit(1); }
+  send(c->sockfd, c->seed_info->chunk_states, sizeof(int) * chunk_total, 
+    MSG_NOSIGNAL);
+  if (recv(c->sockfd, c->requested, sizeof(int) * chunk_total, MSG_WAITALL) 
+    != sizeof(int) * chunk_total || open_seed_file(c) == -1) {
+    goto done;
+  }
+
+  /* queue up for an upload slot, we stay choked until the scheduler picks us */
+  choker_register(&c->choke_state);
+  ratelimit_init(&c->peer_limit, c->seed_info->peer_rate, 
+    &c->seed_info->upload_limit);
+  c->registered = 1;
+
+  /* one request, or for a streaming leecher as many as it sends */
+  for (;;) {
+    c->next_chunk = 0;
+    while (find_run(c)) {
+      choker_wait_unchoked(&c->choke_state);
+      ratelimit_consume(&c->peer_limit, c->run_bytes);
+
+      if (ledbat_send(ledbat, c->header, sizeof(c->header)) == -1) {
+        goto done;
+      }
+      off_t offset = (off_t)chunk_size * c->run_chunk;
+      while (c->run_sent < c->run_bytes) {
+        long len = (c->run_bytes - c->run_sent > chunk_size) ? 
+          chunk_size : c->run_bytes - c->run_sent;
+        char *data = chunk_buf;
+        if (piececache_enabled()) {
+          c->piece = piececache_get(c->seed_file, c->run_chunk + 
+            c->run_sent / chunk_size, c->file, offset + c->run_sent, len);
+          sent_bytes = (c->piece != NULL) ? len : -1;
+          data = (c->piece != NULL) ? c->piece->data : NULL;
+        }
+        else {
+          sent_bytes = pread(c->file, chunk_buf, len, offset + c->run_sent);
+        }
+        if (sent_bytes <= 0 || ledbat_send(ledbat, data, sent_bytes) == -1) {
+          break;
+        }
+        if (c->piece != NULL) {
+          piececache_put(c->piece);
+          c->piece = NULL;
+        }
+        c->run_sent += sent_bytes;
+      }
+      choker_record(&c->choke_state, c->run_sent);
+      admission_sent(c->run_sent);
+      if (c->run_sent != c->run_bytes) {
+        log_record("(%s) LEDBAT stream failed after %ld of %ld bytes.\n", 
+          c->ip, c->run_sent, c->run_bytes);
+        goto done;
+      }
+      c->next_chunk = c->run_chunk + c->run_len;
+    }
+    if (!c->streaming) {
+      break;
+    }
+    /* give the upload slot back while we wait for the next request. the
+     * transfer stays admitted, this thread and its LEDBAT socket do too */
+    if (recv(c->sockfd, &probe, 1, MSG_PEEK | MSG_DONTWAIT) != 1) {
+      choker_unregister(&c->choke_state);
+      c->idle = 1;
+    }
+    if (recv(c->sockfd, c->requested, sizeof(int) * chunk_total, 
+      MSG_WAITALL) != sizeof(int) * chunk_total) {
+      goto done;
+    }
+    if (c->idle) {
+      choker_register(&c->choke_state);
+      c->idle = 0;
+    }
+  }
+
+done:
+  ledbat_close(ledbat);
+  free(chunk_buf);
+  slot_release(c);
   return NULL;
 }
 
-void thread_init(struct client *client, struct UsageInfo *seed_info, 
-  int ntids) 
+int thread_init(struct client *client, int ntids) 
 {
   pthread_t *tid;
   int ret;
@@ -229,63 +1230,68 @@ void thread_init(struct client *client, struct UsageInfo *seed_info,
   tid_info->id = ntids;
   tid_info->ntids = ntids;
   tid_info->pthread_id = tid;
-  tid_info->seed_info = seed_info;
+  tid_info->seed_info = client->seed_info;
 
-  ret = pthread_create(tid, NULL, provide_chunkset_to_peer, tid_info);
+  ret = pthread_create(tid, NULL, provide_ledbat_to_peer, tid_info);
   if (ret) {
     perror("ERROR: pthread_create() failed.");
-    exit(1); }
+    free(tid);
+    free(tid_info);
+    return -1; }
   pthread_detach(*tid);
+  return 0;
 }
 
-void seed_provide(struct UsageInfo *seed_info)
+void seed_provide(void)
 {
-  int listenfd, sockfd;
   struct sockaddr_in caddr;
-  struct client *newClient;
   unsigned int socklen;
-  tsize_t send_tag;
+  struct epoll_event ev;
+  struct rlimit rl;
+
+  /* every leecher costs a socket and an open seed file */
+  rl.rlim_cur = MAX_CONNECTIONS;
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
 
-  host_connection(P2P_PORTNUM, &listenfd, &caddr, &socklen);
   connected_clients = 0;
+  free_clients = NULL;
+  for (int i = MAX_CONNECTIONS - 1; i >= 0; i--) {
+    clients[i].isActive = 0;
+    clients[i].next = free_clients;
+    free_clients = &clients[i];
+  }
 
-  // STEP (4) the server is now ready to accept connections from clients
-  //          while the server is running, add new connections <= 5.
-  while (1) {
+  host_connection(P2P_PORTNUM, &listenfd, &caddr, &socklen);
+  listen(listenfd, SEEDER_BACKLOG);   // a deeper queue than the tracker's
+  fcntl(listenfd, F_SETFL, fcntl(listenfd, F_GETFL) | O_NONBLOCK);
 
-    // STEP (5) check if new connection exceeds MAX_CONNECTIONS, and if
-    //          so, we want to send HELLO_ERROR to the client. Or accept.
-    newClient = NULL;
-    sockfd = accept(listenfd, (struct sockaddr *)&caddr, &socklen);
-    
-    char client_ip[INET_ADDRSTRLEN];
-    inet_ntop(AF_INET, &(caddr.sin_addr), client_ip, INET_ADDRSTRLEN);
-    // printf("Client connected from IP address: %s\n", client_ip);
-
-    for (int i = 0; i < MAX_CONNECTIONS; i++) {
-      if (clients[i].isActive == 0) { // only set newClient to nonActive
-        newClient = &clients[i];      // member of clients
-        break;
-      }
-    }
-    if (newClient == NULL) {
-      send(sockfd, &send_tag, sizeof(tsize_t), MSG_NOSIGNAL);
-      perror("ERROR: client attempted to connect when "
-             "MAX_CONNECTIONS has been reached.\n");
-    } else {
-      newClient->sockfd = sockfd;
-      newClient->isActive = 1;
-      strcpy(newClient->ip, client_ip);
-      if (newClient->sockfd == -1) {
-        perror("ERROR: client failed to accept.\n");
-        break;
-      }
-      log_record("(%s) Accepted new client socket.\n", newClient->ip);
+  epfd = epoll_create1(0);
+  choke_efd = eventfd(0, EFD_NONBLOCK);
+  if (epfd == -1 || choke_efd == -1) {
+    perror("ERROR: epoll_create1() failed.");
+    exit(1); }
+  choker_set_notify(choke_efd);
 
-      // STEP (6) init client thread for new connection
-      thread_init(newClient, seed_info, connected_clients);
-      connected_clients++;
-    }
+  ev.events = EPOLLIN | EPOLLONESHOT;
+  ev.data.ptr = &listen_mark;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, listenfd, &ev);
+  ev.data.ptr = &choke_mark;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, choke_efd, &ev);
+
+  /* io_uring completions are only ever reaped by the event loop thread */
+  uring_ok = (uring_init(&ring, (rl.rlim_cur < MAX_CONNECTIONS) ? 
+    (int)rl.rlim_cur : MAX_CONNECTIONS) == 0);
+  if (uring_ok) {
+    ev.events = EPOLLIN;
+    ev.data.ptr = &uring_mark;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, ring.fd, &ev);
   }
+
+  filecache_init();
+  workpool_init(&io_pool, "io", SEEDER_IO_THREADS);
+  seed_loop();
   close(listenfd);
 }
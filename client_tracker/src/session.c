@@ -0,0 +1,149 @@
+/*
+ * Swarthmore College, CS 87
+ * Copyright (c) 2020 Swarthmore College Computer Science Department,
+ * Swarthmore PA, Professor Tia Newhall
+ *
+ * SLY: session.c
+ * Authors: Sasha Casada, Yatin Lala, and Leo Douhovnikoff (12-18-2023)
+ */
+
+/**
+ * A seeding session: every torrent this process seeds lives in one table
+ * keyed by info hash, so a single P2P_PORTNUM listener can serve all of
+ * them. Adding a torrent costs two jobs on shared pools: a disk check of
+ * the seed file, followed by hashing its chunks. Connections for a torrent
+ * that is still being hashed are retried by the seeder until it is ready.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "shared.h"
+#include "seeder.h"
+#include "session.h"
+
+////////////////////////////// DEFINITIONS ////////////////////////////////////
+
+struct workpool hash_pool;
+struct workpool disk_pool;
+
+static struct torrent *torrents[SESSION_HASHSIZE];
+static pthread_mutex_t session_lock = PTHREAD_MUTEX_INITIALIZER;
+
+///////////////////////////////////////////////////////////////////////////////
+
+static unsigned session_hash(char *s)
+{
+  unsigned hashval;
+  for (hashval = 0; *s != '\0'; s++)
+    hashval = *s + 31 * hashval;
+  return hashval % SESSION_HASHSIZE;
+}
+
+/* mark (t) as done being prepared, session_find() hands it out from now */
+static void torrent_ready(struct torrent *t, int failed)
+{
+  pthread_mutex_lock(&session_lock);
+  t->failed = failed;
+  t->ready = 1;
+  pthread_mutex_unlock(&session_lock);
+}
+
+/* hash pool job: compute which chunks of the seed file are valid */
+static void hash_torrent(void *args)
+{
+  struct torrent *t = (struct torrent *)args;
+  struct UsageInfo *seed_info = t->seed_info;
+  char upload_file_path[MAX_FILENAME];
+
+  sprintf(upload_file_path, "%s/%s", seed_info->upload_path,
+    seed_info->info_dict->file_name);
+  get_chunk_states(seed_info, upload_file_path);
+  log_record("Hashed '%s', ready to seed.\n",
+    seed_info->info_dict->file_name);
+  torrent_ready(t, 0);
+}
+
+/* disk pool job: make sure the seed file exists with the right size
+ * before we spend any time hashing it */
+static void check_torrent(void *args)
+{
+  struct torrent *t = (struct torrent *)args;
+  struct UsageInfo *seed_info = t->seed_info;
+  char upload_file_path[MAX_FILENAME];
+  struct stat st;
+
+  sprintf(upload_file_path, "%s/%s", seed_info->upload_path,
+    seed_info->info_dict->file_name);
+  if (stat(upload_file_path, &st) == -1) {
+    log_record("Path '%s' does not exist. Not seeding it.\n",
+      upload_file_path);
+    fprintf(stderr, "Error (%d): %s\n", errno, strerror(errno));
+    torrent_ready(t, 1);
+    return;
+  }
+  if (st.st_size != seed_info->info_dict->file_size) {
+    log_record("Bad seed. File size of '%s' not correct.\n",
+      upload_file_path);
+    torrent_ready(t, 1);
+    return;
+  }
+  workpool_submit(&hash_pool, hash_torrent, t);
+}
+
+void session_init(void)
+{
+  for (int i = 0; i < SESSION_HASHSIZE; i++) {
+    torrents[i] = NULL;
+  }
+  workpool_init(&hash_pool, "hash", HASH_WORKERS);
+  workpool_init(&disk_pool, "disk", DISK_WORKERS);
+}
+
+void session_add(struct UsageInfo *seed_info)
+{
+  struct torrent *t;
+  unsigned hashval;
+
+  t = malloc(sizeof(struct torrent));
+  if (!t) {
+    perror("ERROR: malloc(torrent) failed.");
+    exit(1); }
+  t->seed_info = seed_info;
+  t->ready = 0;
+  t->failed = 0;
+
+  hashval = session_hash(seed_info->info_dict->sha256sum);
+  pthread_mutex_lock(&session_lock);
+  t->next = torrents[hashval];
+  torrents[hashval] = t;
+  pthread_mutex_unlock(&session_lock);
+
+  workpool_submit(&disk_pool, check_torrent, t);
+}
+
+int session_find(char *info_hash, struct UsageInfo **seed_info)
+{
+  struct torrent *t;
+  int status = SESSION_UNKNOWN;
+
+  *seed_info = NULL;
+  pthread_mutex_lock(&session_lock);
+  for (t = torrents[session_hash(info_hash)]; t != NULL; t = t->next) {
+    if (strcmp(info_hash, t->seed_info->info_dict->sha256sum) == 0) {
+      break;
+    }
+  }
+  if (t != NULL && !t->ready) {
+    status = SESSION_PENDING;
+  }
+  else if (t != NULL && !t->failed) {
+    status = SESSION_READY;
+    *seed_info = t->seed_info;
+  }
+  pthread_mutex_unlock(&session_lock);
+  return status;
+}
@@ -93,13 +93,42 @@ void host_connection(int portnum, int *listenfd, struct sockaddr_in *caddr, unsi
   *socklen = (unsigned int)sizeof(caddr);
 }
 
-void get_chunk_states(struct UsageInfo *info, char *file_path) {
+int verify_chunk(struct UsageInfo *info, char *file_path, int i) {
   struct InfoDictionary *info_dict = info->info_dict;
-  int offset_start = 0; 
-  int offset_end = info_dict->chunk_size;
+  long offset_start = ((long)info_dict->chunk_size*i)+1; 
+  long offset_end = info_dict->chunk_size;
   char command[2048];
   char sha256sum_output[65];
   char sha256sum_witness[65];
+
+  if (i == info_dict->chunk_total-1) {
+    offset_end = (info_dict->file_size - ( (long)(info_dict->chunk_total-1)* info_dict->chunk_size) );
+  }
+  if (info->direct_io) {
+    /* whole aligned chunks, O_DIRECT stops short at the end of file */
+    sprintf(command, "dd if=%s iflag=direct bs=%d skip=%d count=1 "
+      "status=none | sha256sum | awk '{ print $1 }'", file_path, 
+      info_dict->chunk_size, i);
+  }
+  else {
+    sprintf(command, "tail -c +%ld %s | head -c %ld | sha256sum | awk '{ print $1 }'", 
+      offset_start, file_path, offset_end);
+  }
+  //printf("offset_start: %ld; offset_end: %ld\n", offset_start, offset_end);
+  FILE *fp = popen(command, "r");
+  if (fp == NULL) {
+    perror("Error while hashing file");
+    exit(EXIT_FAILURE);
+  }
+  sha256sum_output[0] = '\0';
+  fgets(sha256sum_output, 65, fp);
+  pclose(fp);
+  sprintf(sha256sum_witness, "%.64s", &info_dict->chunks[i*64]);
+  return validate_sha256sum(sha256sum_witness, sha256sum_output) == 0;
+}
+
+void get_chunk_states(struct UsageInfo *info, char *file_path) {
+  struct InfoDictionary *info_dict = info->info_dict;
   struct stat st = {0};
   if (stat(file_path, &st) == -1) {
     log_record("Path '%s' does not exist\n", file_path);
@@ -110,36 +139,31 @@ void get_chunk_states(struct UsageInfo *info, char *file_path) {
     }
   }
   for (int i=0; i<info_dict->chunk_total; i++) {
-    if (i != 0) {
-      offset_start = (info_dict->chunk_size*i)+1; 
-    }
-    if (i == info_dict->chunk_total-1) {
-      offset_end = (info_dict->file_size - ( (info_dict->chunk_total-1)* info_dict->chunk_size) );
-      //printf("NOTE: I am changing offset!\n");
+    if (info->wanted != NULL && !info->wanted[i]) {
+      /* outside the requested ranges, nothing to fetch */
+      info->chunk_states[i] = 1;
+      continue;
     }
-    sprintf(command, "tail -c +%d %s | head -c %d | sha256sum | awk '{ print $1 }'", 
-      offset_start, file_path, offset_end);
-    //printf("offset_start: %d; offset_end: %d\n", offset_start, offset_end);
+    info->chunk_states[i] = verify_chunk(info, file_path, i);
+  }
+}
+
+void sha256sum(char *path_to_file, char *sha256sum_output) {
+    char command[256];
+    sprintf(command, "sha256sum %s | awk '{ print $1 }'", path_to_file);
     FILE *fp = popen(command, "r");
     if (fp == NULL) {
-      perror("Error while hashing file");
-      exit(EXIT_FAILURE);
+        perror("Error while hashing file");
+        exit(EXIT_FAILURE);
     }
     fgets(sha256sum_output, 65, fp);
     pclose(fp);
-    sprintf(sha256sum_witness, "%.64s", &info_dict->chunks[i*64]);
-    if (validate_sha256sum(sha256sum_witness, sha256sum_output) == 0) {
-      info->chunk_states[i] = 1;
-    }
-    else {
-      info->chunk_states[i] = 0;
-    }
-  }
 }
 
-void sha256sum(char *path_to_file, char *sha256sum_output) {
+void sha256sum_direct(char *path_to_file, char *sha256sum_output) {
     char command[256];
-    sprintf(command, "sha256sum %s | awk '{ print $1 }'", path_to_file);
+    sprintf(command, "dd if=%s iflag=direct bs=1M status=none | sha256sum | "
+      "awk '{ print $1 }'", path_to_file);
     FILE *fp = popen(command, "r");
     if (fp == NULL) {
         perror("Error while hashing file");
@@ -160,7 +184,7 @@ void print_info_dictionary(struct InfoDictionary *info_dict)
 {
     printf("file_path: %s\n", info_dict->file_path);
     printf("file_name: %s\n", info_dict->file_name);
-    printf("file_size: %d\n", info_dict->file_size);
+    printf("file_size: %ld\n", info_dict->file_size);
     printf("sha256sum: %s\n", info_dict->sha256sum);
     printf("chunk_size: %d\n", info_dict->chunk_size);
     printf("chunk_total: %d\n", info_dict->chunk_total);
@@ -0,0 +1,271 @@
+/*
+ * Swarthmore College, CS 87
+ * Copyright (c) 2020 Swarthmore College Computer Science Department,
+ * Swarthmore PA, Professor Tia Newhall
+ *
+ * SLY: stream.c
+ * Authors: Sasha Casada, Yatin Lala, and Leo Douhovnikoff (12-18-2023)
+ */
+
+/**
+ * Streaming downloads. Handing each peer every (j % num_peers)th chunk
+ * fills the file evenly, so the first contiguous bytes only show up near
+ * the end. Here peers instead pull small batches of the lowest missing
+ * chunks, limited to a window of STREAM_WINDOW chunks past the first hole,
+ * so the whole swarm works just ahead of the playback position. The
+ * emitter thread verifies the chunk at that position as soon as it is on
+ * disk and writes it out, then moves on to the next one.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include "shared.h"
+#include "stream.h"
+
+extern log_info_t logger;
+
+///////////////////////////////////////////////////////////////////////////////
+
+/* write all of (len) bytes of (buf) to (fd) */
+static int write_all(int fd, char *buf, size_t len)
+{
+  ssize_t ret;
+
+  while (len > 0) {
+    ret = write(fd, buf, len);
+    if (ret == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    buf += ret;
+    len -= ret;
+  }
+  return 0;
+}
+
+/* claim up to STREAM_BATCH missing chunks in [lo, hi) that (have) marks
+ * 1 for (peer). returns the # claimed (s->lock held) */
+static int claim(struct stream *s, void *peer, int *have, int *requested,
+  int lo, int hi)
+{
+  int n = 0;
+
+  for (int i = lo; i < hi && i < s->chunk_total && n < STREAM_BATCH; i++) {
+    if (s->state[i] == CHUNK_MISSING && have[i] == 1) {
+      s->state[i] = CHUNK_REQUESTED;
+      s->owner[i] = peer;
+      requested[i] = 1;
+      n++;
+    }
+  }
+  return n;
+}
+
+/* emitter thread: verify and write out chunks in order for as long as
+ * the next one is on its way */
+static void *emit_chunks(void *args)
+{
+  struct stream *s = (struct stream *)args;
+  struct InfoDictionary *info_dict = s->info->info_dict;
+  char *buf;
+  int i, state, ok;
+  long len;
+  struct timeval now;
+  float ms;
+
+  buf = malloc(info_dict->chunk_size);
+  if (!buf) {
+    perror("ERROR: malloc(stream buf) failed.");
+    exit(1); }
+
+  pthread_mutex_lock(&s->lock);
+  while (s->next < s->chunk_total && s->out_fd != -1) {
+    i = s->next;
+    state = s->state[i];
+    if (state != CHUNK_WRITTEN && state != CHUNK_VERIFIED) {
+      if (!s->fetching) {
+        break;    // nobody is bringing it this round
+      }
+      pthread_cond_wait(&s->cond, &s->lock);
+      continue;
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    if (state == CHUNK_WRITTEN) {
+      ok = verify_chunk(s->info, s->path, i);
+      pthread_mutex_lock(&s->lock);
+      s->state[i] = ok ? CHUNK_VERIFIED : CHUNK_MISSING;
+      pthread_cond_broadcast(&s->cond);
+      if (!ok) {
+        log_record("Stream: chunk %d is bad, fetching it again.\n", i);
+        continue;
+      }
+      pthread_mutex_unlock(&s->lock);
+    }
+
+    len = info_dict->chunk_size;
+    if (i == s->chunk_total - 1) {
+      len = info_dict->file_size - (long)info_dict->chunk_size * i;
+    }
+    ok = (pread(s->file_fd, buf, len, (off_t)info_dict->chunk_size * i)
+      == len && write_all(s->out_fd, buf, len) == 0);
+
+    pthread_mutex_lock(&s->lock);
+    if (!ok) {
+      /* the reader went away, the download itself carries on */
+      log_record("Stream: output closed at chunk %d: %s\n", i,
+        strerror(errno));
+      close(s->out_fd);
+      s->out_fd = -1;
+      break;
+    }
+    if (!s->started) {
+      s->started = 1;
+      gettimeofday(&now, NULL);
+      ms = (now.tv_sec - logger.start_tv.tv_sec) * 1000 +
+        (now.tv_usec - logger.start_tv.tv_usec) / 1000.0;
+      log_record("Stream: time to first byte %.0f ms.\n", ms);
+      fprintf(stderr, "Time to first byte: %.0f ms\n", ms);
+    }
+    s->next++;
+  }
+  pthread_mutex_unlock(&s->lock);
+  free(buf);
+  return NULL;
+}
+
+void stream_init(struct stream *s, struct UsageInfo *info, int out_fd)
+{
+  pthread_mutex_init(&s->lock, NULL);
+  pthread_cond_init(&s->cond, NULL);
+  s->chunk_total = info->info_dict->chunk_total;
+  s->state = malloc(sizeof(int) * s->chunk_total);
+  s->owner = malloc(sizeof(void *) * s->chunk_total);
+  if (!s->state || !s->owner) {
+    perror("ERROR: malloc(stream) failed.");
+    exit(1); }
+  s->next = 0;
+  s->fetching = 0;
+  s->out_fd = out_fd;
+  s->file_fd = -1;
+  s->started = 0;
+  s->info = info;
+  s->path = NULL;
+  /* a reader that quits early is an error on write(), not a signal */
+  signal(SIGPIPE, SIG_IGN);
+}
+
+void stream_start(struct stream *s, char *path)
+{
+  int ret;
+
+  s->path = path;
+  s->file_fd = open(path, O_RDONLY);
+  if (s->file_fd == -1) {
+    perror("ERROR: open(stream) failed.");
+    exit(1); }
+  for (int i = 0; i < s->chunk_total; i++) {
+    s->state[i] = (i < s->next || s->info->chunk_states[i] == 1) ?
+      CHUNK_VERIFIED : CHUNK_MISSING;
+    s->owner[i] = NULL;
+  }
+  s->fetching = 1;
+  ret = pthread_create(&s->emitter, NULL, emit_chunks, s);
+  if (ret) {
+    perror("ERROR: pthread_create() failed.");
+    exit(1); }
+}
+
+int stream_next_batch(struct stream *s, void *peer, int *have,
+  int *requested, int wait)
+{
+  int hole, busy, n;
+
+  memset(requested, 0, sizeof(int) * s->chunk_total);
+  pthread_mutex_lock(&s->lock);
+  for (;;) {
+    hole = s->next;
+    while (hole < s->chunk_total && s->state[hole] >= CHUNK_WRITTEN) {
+      hole++;
+    }
+    n = claim(s, peer, have, requested, hole, hole + STREAM_WINDOW);
+    if (n > 0 || !wait) {
+      break;
+    }
+    /* nothing of ours in the window. while other peers are fetching it
+     * may still move (or a chunk of theirs come back), otherwise take
+     * whatever we can still get */
+    busy = 0;
+    for (int i = hole; i < s->chunk_total && !busy; i++) {
+      busy = (s->state[i] == CHUNK_REQUESTED);
+    }
+    if (!busy) {
+      n = claim(s, peer, have, requested, hole, s->chunk_total);
+      break;
+    }
+    pthread_cond_wait(&s->cond, &s->lock);
+  }
+  pthread_mutex_unlock(&s->lock);
+  return n;
+}
+
+void stream_written(struct stream *s, int i, int ok)
+{
+  pthread_mutex_lock(&s->lock);
+  /* a peer that hung up may still have had this one on its way to disk */
+  if (s->state[i] != CHUNK_VERIFIED) {
+    s->state[i] = ok ? CHUNK_WRITTEN : CHUNK_MISSING;
+    s->owner[i] = NULL;
+  }
+  pthread_cond_broadcast(&s->cond);
+  pthread_mutex_unlock(&s->lock);
+}
+
+void stream_buf_done(struct disk_buf *b, int failed)
+{
+  struct stream *s = (struct stream *)b->arg;
+
+  stream_written(s, b->offset / s->info->info_dict->chunk_size, !failed);
+}
+
+void stream_peer_done(struct stream *s, void *peer)
+{
+  pthread_mutex_lock(&s->lock);
+  for (int i = 0; i < s->chunk_total; i++) {
+    if (s->state[i] == CHUNK_REQUESTED && s->owner[i] == peer) {
+      s->state[i] = CHUNK_MISSING;
+      s->owner[i] = NULL;
+    }
+  }
+  pthread_cond_broadcast(&s->cond);
+  pthread_mutex_unlock(&s->lock);
+}
+
+int stream_finish(struct stream *s)
+{
+  int done;
+
+  pthread_mutex_lock(&s->lock);
+  s->fetching = 0;
+  pthread_cond_broadcast(&s->cond);
+  pthread_mutex_unlock(&s->lock);
+  pthread_join(s->emitter, NULL);
+  close(s->file_fd);
+  s->file_fd = -1;
+
+  done = (s->next == s->chunk_total);
+  if (done && s->out_fd != -1) {
+    log_record("Stream: all (%d) chunks went out in order.\n",
+      s->chunk_total);
+    close(s->out_fd);
+    s->out_fd = -1;
+  }
+  return done;
+}
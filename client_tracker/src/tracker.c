@@ -2,12 +2,14 @@
  * Swarthmore College, CS 87
  * Copyright (c) 2020 Swarthmore College Computer Science Department,
  * Swarthmore PA, Professor Tia Newhall
- * 
+ *
  * SLY: tracker.c
  * Authors: Sasha Casada, Yatin Lala, and Leo Douhovnikoff (12-18-2023)
  */
 
+#define _GNU_SOURCE     // accept4()
 #include <errno.h>
+#include <fcntl.h>
 #include <pthread.h>
 #include <readline/history.h>
 #include <readline/readline.h>
@@ -15,15 +17,38 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
 #include <sys/time.h>
 #include "shared.h"
 #include "hashtable.h"
+#include "persist.h"
 
 ////////////////////////////// DEFINITIONS ////////////////////////////////////
 
-#define MAX_CONNECTIONS         200     // max # of connections for server
-#define MAX_FILES               20      // max # of files tracker can store
+#define MAX_CONNECTIONS         16384   // max # of connections for server
+#define TRACKER_THREADS         4       // threads running the event loop
+#define TRACKER_BACKLOG         4096    // listen backlog for the P2T port
+#define TRACKER_EVENTS          64      // max events taken per epoll_wait
+#define NUMWANT_DEFAULT         50      // peers sent when numwant is 0
+#define NUMWANT_MAX             200     // most peers sent in one reply
+#define ANNOUNCE_INTERVAL       60      // seconds between a seeder's announces
+#define PEER_TIMEOUT            (2 * ANNOUNCE_INTERVAL + ANNOUNCE_INTERVAL / 2)
+#define WHEEL_TICK              5       // seconds covered by a wheel slot
+#define WHEEL_SLOTS             64      // slots, must span PEER_TIMEOUT
+
+/* where a client connection is in the tracker protocol. a connection
+ * can make any number of requests, each one starting with a handshake
+ */
+enum conn_state {
+  CONN_HANDSHAKE,           // reading the handshake tag
+  CONN_REQUEST,             // reading the request tag
+  CONN_INFO_HASH,           // reading the info hash the request is about
+  CONN_REPLY,               // writing the reply, then on to (after_reply)
+  CONN_CLOSE                // done (or failed), release the slot
+};
 
 /* this struct represents all the data which encapsulates a single
  * user that may be connected to our messaging server at a given
@@ -33,16 +58,31 @@ struct client {
   int isActive;             // whether or not client is active
   int sockfd;               // socket file descriptor location
   char ip[INET_ADDRSTRLEN]; // ip of client
+  struct in_addr addr;      // the same, as it goes into a peer list
   char msg_buffer[BUFSIZE]; // message buffer per client
+  enum conn_state state;    // progress through the tracker protocol
+  enum conn_state after_reply;  // state once the reply is out
+  tsize_t request;          // request tag being served
+  size_t in_len, in_off;    // bytes of msg_buffer wanted and read so far
+  char *out_buf;            // reply being written, kept across requests
+  size_t out_len, out_off, out_cap;
+  struct client *next;      // next free slot
 };
 
-/* struct that encapsulates all of the information that is to be
- * passed to each thread during thread creation
- */
-struct thread_info {
-  int id;                // individual thread id
-  int ntids;             // total active threads
-  pthread_t *pthread_id; // current pthread id
+/* a peer that expires unless it announces again. an announce only moves
+ * (expires), the timer stays in its slot until the slot comes up and is
+ * then put where (expires) says, or dropped with its peer */
+struct peer_timer {
+  struct peer_info *swarm;  // the swarm the peer is in
+  int index;                // of the peer in swarm->peers
+  time_t expires;
+  struct peer_timer *next;  // next timer in the slot
+};
+
+/* the timers of every swarm in one hashtable shard, under its lock */
+struct peer_wheel {
+  struct peer_timer *slots[WHEEL_SLOTS];
+  long tick;                // next tick to run, 0 while empty
 };
 
 /* global variable that encapsulates an array which contains all
@@ -51,296 +91,893 @@ struct thread_info {
  */
 struct client clients[MAX_CONNECTIONS];
 
-int connected_clients;  
-char **files;
+int connected_clients;
 log_info_t logger;
 
+static struct client *free_clients;     // unused slots
+static pthread_mutex_t slot_lock = PTHREAD_MUTEX_INITIALIZER;
+static int listenfd, epfd;
+static char listen_mark;                // epoll tag of the listen socket
+static __thread unsigned shuffle_seed;  // rand_r() state of this thread
+static struct peer_wheel wheels[HASH_SHARDS];
+
 ////////////////////////// Function Prototypes ////////////////////////////////
 
-/* initializes a clients thread */
-void thread_init(struct client *client, int ntids);
+/* event loop run by every tracker thread */
+void *tracker_loop(void *args);
 
-/* function for created threads to manage a single cli_con */
-void *client_connect(void *args);
+/* advance (c) through the protocol as far as its socket allows */
+void client_connect(struct client *c);
 
 /* handles file request from connected client */
-void *handle_file_request(void *args);
+void handle_file_request(struct client *c);
 
 /* handles add request from connected client */
-void *handle_seed_request(void *args);
+void handle_seed_request(struct client *c);
 
 /* handles add request from connected client */
-void *handle_add_request(void *args);
+void handle_add_request(struct client *c);
+
+/* redo a change to the index from persist_recover(), before any other
+ * thread runs */
+static void restore_record(struct persist_record *r, int snapshot);
 
 ///////////////////////////////////////////////////////////////////////////////
 
 /**
- * NOTE: We have (2) mystery memory leaks in tracker. I think one (or both)
- * are related to the expected memory leak from lab 2, although I am not
- * entirely sure. One of them is in some library __libc_unwind_link_get,
- * and the other is due to our detatched p_thread (which does clean up).
- * 
- * Realistically, the seeder IPs need to be held inside of some dynamic
- * database which is read by the server which routine polling for active/
- * inactive peers. The hashtable cannot be gracefully destroyed in this
- * implementation, sadly. Hard to handle in C. Requires more effort.
+ * NOTE: We have a mystery memory leak in tracker, in some library
+ * __libc_unwind_link_get. I think it is related to the expected memory
+ * leak from lab 2, although I am not entirely sure.
+ *
+ * Seeders announce every ANNOUNCE_INTERVAL seconds and are dropped from
+ * their swarm PEER_TIMEOUT after the last one, see wheel_expire(). The
+ * hashtable cannot be gracefully destroyed in this implementation, sadly.
+ * Hard to handle in C. Requires more effort.
+ *
+ * The index survives restarts through persist.c: adds, new seeders and
+ * stops are logged as they happen, expiry is not. Recovered peers get a
+ * fresh PEER_TIMEOUT, the dead ones among them simply expire again.
  **/
 
-int main(int argc, char **argv) 
+int main(int argc, char **argv)
 {
-  int listenfd, sockfd;
   struct sockaddr_in caddr;
-  struct client *newClient;
   unsigned int socklen;
-  tsize_t send_tag;
+  struct epoll_event ev;
+  struct rlimit rl;
+  pthread_t tids[TRACKER_THREADS], snapshotter;
+  struct timeval start, end;
+  long records;
 
   /* initialize log_file and log start time */
   logger.log_file = fopen("tracker.log","w");
     gettimeofday(&(logger.start_tv),NULL);
 
-  host_connection(P2T_PORTNUM, &listenfd, &caddr, &socklen);
+  /* every connected client costs a socket */
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
 
   connected_clients = 0;
-  // (1) the server is now ready to accept connections from clients while the 
-  //     server is running, add new connections <= 5.
-  while (1) {
+  free_clients = NULL;
+  for (int i = MAX_CONNECTIONS - 1; i >= 0; i--) {
+    clients[i].isActive = 0;
+    clients[i].out_buf = NULL;
+    clients[i].out_cap = 0;
+    clients[i].next = free_clients;
+    free_clients = &clients[i];
+  }
 
-    // (2) check if new connection exceeds MAX_CONNECTIONS, and if so, we want 
-    //     to send HELLO_ERROR to the client. Or accept.
-    newClient = NULL;
-    sockfd = accept(listenfd, (struct sockaddr *)&caddr, &socklen);
+  /* get the index back before anyone can ask for it */
+  gettimeofday(&start, NULL);
+  records = persist_recover(restore_record);
+  gettimeofday(&end, NULL);
+  printf("Recovered (%ld) files from (%ld) records in %.1f ms.\n",
+    hash_count(), records, (end.tv_sec - start.tv_sec) * 1000.0 +
+    (end.tv_usec - start.tv_usec) / 1000.0);
+  persist_init();
+  if (pthread_create(&snapshotter, NULL, persist_loop, NULL)) {
+    perror("ERROR: pthread_create() failed.");
+    exit(1); }
 
-    char client_ip[INET_ADDRSTRLEN];
-    inet_ntop(AF_INET, &(caddr.sin_addr), client_ip, INET_ADDRSTRLEN);
-    log_record("(%s) Client attempting to connect...\n", client_ip);
+  host_connection(P2T_PORTNUM, &listenfd, &caddr, &socklen);
+  listen(listenfd, TRACKER_BACKLOG);
+  fcntl(listenfd, F_SETFL, fcntl(listenfd, F_GETFL) | O_NONBLOCK);
 
-    for (int i = 0; i < MAX_CONNECTIONS; i++) {
-      if (clients[i].isActive == 0) { // only set newClient to nonActive
-        newClient = &clients[i];      // member of clients
-        break;
-      }
+  epfd = epoll_create1(0);
+  if (epfd == -1) {
+    perror("ERROR: epoll_create1() failed.");
+    exit(1); }
+  ev.events = EPOLLIN | EPOLLONESHOT;
+  ev.data.ptr = &listen_mark;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, listenfd, &ev);
+
+  /* all threads wait on the one epoll set. everything in it is one shot,
+   * so a connection is only ever run by one thread at a time */
+  for (int i = 1; i < TRACKER_THREADS; i++) {
+    if (pthread_create(&tids[i], NULL, tracker_loop, NULL)) {
+      perror("ERROR: pthread_create() failed.");
+      exit(1); }
+  }
+  tracker_loop(NULL);
+  close(listenfd);
+}
+
+/* take a free client slot, or NULL if all MAX_CONNECTIONS are in use */
+static struct client *slot_get(void)
+{
+  struct client *c;
+
+  pthread_mutex_lock(&slot_lock);
+  c = free_clients;
+  if (c != NULL) {
+    free_clients = c->next;
+    c->isActive = 1;
+    connected_clients++;
+  }
+  pthread_mutex_unlock(&slot_lock);
+  return c;
+}
+
+/* close (c) and put its slot back for the next connection */
+static void slot_release(struct client *c)
+{
+  close(c->sockfd);
+  log_record("(%s) Connection closed.\n", c->ip);
+
+  pthread_mutex_lock(&slot_lock);
+  c->isActive = 0;
+  c->next = free_clients;
+  free_clients = c;
+  connected_clients--;
+  pthread_mutex_unlock(&slot_lock);
+}
+
+/* re-arm (c)'s socket for (events), one shot */
+static void conn_arm(struct client *c, uint32_t events)
+{
+  struct epoll_event ev;
+
+  ev.events = events | EPOLLONESHOT;
+  ev.data.ptr = c;
+  if (epoll_ctl(epfd, EPOLL_CTL_MOD, c->sockfd, &ev) == -1) {
+    perror("ERROR: epoll_ctl(MOD) failed.");
+    exit(1); }
+}
+
+/* move (c) to (state), reading the (len) bytes it starts with */
+static void conn_expect(struct client *c, enum conn_state state, size_t len)
+{
+  c->state = state;
+  c->in_len = len;
+  c->in_off = 0;
+}
+
+/* add (len) bytes of (data) to the reply of (c) */
+static void reply_append(struct client *c, void *data, size_t len)
+{
+  if (c->out_len + len > c->out_cap) {
+    c->out_cap = (c->out_len + len) * 2;
+    c->out_buf = realloc(c->out_buf, c->out_cap);
+    if (!c->out_buf) {
+      perror("ERROR: realloc(out_buf) failed.");
+      exit(1); }
+  }
+  memcpy(c->out_buf + c->out_len, data, len);
+  c->out_len += len;
+}
+
+/* add a one byte (tag) to the reply of (c) */
+static void reply_tag(struct client *c, tsize_t tag)
+{
+  reply_append(c, &tag, sizeof(tsize_t));
+}
+
+/* read what is still missing of c->msg_buffer. returns 1 when done, 0 if
+ * the socket would block, -1 on error/hangup */
+static int conn_read(struct client *c)
+{
+  ssize_t ret;
+
+  while (c->in_off < c->in_len) {
+    ret = recv(c->sockfd, c->msg_buffer + c->in_off, c->in_len - c->in_off,
+      0);
+    if (ret == -1 && errno == EINTR) {
+      continue;
     }
-    if (newClient == NULL) {
-      send(sockfd, &send_tag, sizeof(tsize_t), MSG_NOSIGNAL);
-      fprintf(stderr, "ERROR: client (%s) attempted to connect when "
-             "MAX_CONNECTIONS has been reached.\n", client_ip);
-    } else {
-      newClient->sockfd = sockfd;
-      newClient->isActive = 1;
-      strcpy(newClient->ip, client_ip);
-      if (newClient->sockfd == -1) {
-        fprintf(stderr, "ERROR: client (%s) failed to accept.\n", client_ip);
-        break;
-      }
-      log_record("(%s) Accepted new client socket.\n", client_ip);
-      printf("(%s) Client connected.\n", client_ip);
-      // (3) init client thread for new connection
-      thread_init(newClient, connected_clients);
-      connected_clients++;
+    if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return 0;
     }
+    if (ret <= 0) {
+      return -1;
+    }
+    c->in_off += ret;
   }
-  close(listenfd);
+  return 1;
 }
 
-void *handle_file_request(void *args)
+/* write what is still pending of the reply. returns like conn_read */
+static int conn_write(struct client *c)
 {
-  tsize_t send_tag;
-  struct thread_info *t_info;
-  char file_request[65]; // must include null-terminating \0
-  
-  t_info = (struct thread_info *)args;
-  send_tag = REQUEST_APPROVED;
-  send(clients[t_info->id].sockfd, &send_tag, sizeof(tsize_t), 
-    MSG_NOSIGNAL);
-  recv(clients[t_info->id].sockfd, &file_request, sizeof(char)*65, 
-    MSG_NOSIGNAL);
-  struct nlist *lookup = hash_lookup(file_request);
+  ssize_t ret;
 
-  if (lookup != NULL) { // if file is in file hash, accept
-    printf("(%s) Serving request of '(%.8s...)' on the network with"
-      " (%d) peers.\n", 
-      clients[t_info->id].ip, lookup->name, lookup->defn->curr_peers);
-    send_tag = REQUEST_FOUND;
-    send(clients[t_info->id].sockfd, &send_tag, sizeof(tsize_t), MSG_NOSIGNAL);
-    send(clients[t_info->id].sockfd, &lookup->defn->curr_peers, sizeof(int), MSG_NOSIGNAL);
-    for (int i = 0; i < lookup->defn->curr_peers; i++) {
-      send(clients[t_info->id].sockfd, lookup->defn->peers[i], INET_ADDRSTRLEN, MSG_NOSIGNAL);
+  while (c->out_off < c->out_len) {
+    ret = send(c->sockfd, c->out_buf + c->out_off, c->out_len - c->out_off,
+      MSG_NOSIGNAL);
+    if (ret == -1 && errno == EINTR) {
+      continue;
+    }
+    if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return 0;
     }
-    return NULL;
+    if (ret <= 0) {
+      return -1;
+    }
+    c->out_off += ret;
   }
-  else { // if file is not in hash, reject
-    send_tag = REQUEST_NOT_FOUND;
-    send(clients[t_info->id].sockfd, &send_tag, sizeof(tsize_t), MSG_NOSIGNAL);
-    printf("(%s) Attempted to request a file not on the network!\n", 
-      clients[t_info->id].ip);
-    return NULL;
-  } 
+  return 1;
 }
 
-void *handle_seed_request(void *args)
+/* accept every pending connection into a free slot */
+static void accept_clients(void)
 {
+  struct sockaddr_in caddr;
+  socklen_t socklen;
+  struct client *c;
+  struct epoll_event ev;
   tsize_t send_tag;
-  struct thread_info *t_info;
-  char file_request[65]; // must include null-terminating \0
-  
-  t_info = (struct thread_info *)args;
-  send_tag = SEED_APPROVED;
+  int sockfd;
 
-  send(clients[t_info->id].sockfd, &send_tag, sizeof(tsize_t), MSG_NOSIGNAL);
-  recv(clients[t_info->id].sockfd, &file_request, sizeof(char)*65, MSG_NOSIGNAL);
+  while (1) {
+    socklen = sizeof(caddr);
+    sockfd = accept4(listenfd, (struct sockaddr *)&caddr, &socklen,
+      SOCK_NONBLOCK);
+    if (sockfd == -1) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        perror("ERROR: client failed to accept.\n");
+      }
+      return;
+    }
+    c = slot_get();
+    if (c == NULL) {
+      send_tag = HANDSHAKE_ERROR;
+      send(sockfd, &send_tag, sizeof(tsize_t), MSG_NOSIGNAL);
+      close(sockfd);
+      log_record("Client attempted to connect when MAX_CONNECTIONS has "
+        "been reached.\n");
+      continue;
+    }
+    c->sockfd = sockfd;
+    inet_ntop(AF_INET, &(caddr.sin_addr), c->ip, INET_ADDRSTRLEN);
+    c->addr = caddr.sin_addr;
+    c->out_len = 0;
+    c->out_off = 0;
+    conn_expect(c, CONN_HANDSHAKE, sizeof(tsize_t));
+    log_record("(%s) Accepted new client socket.\n", c->ip);
+
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.ptr = c;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, sockfd, &ev) == -1) {
+      perror("ERROR: epoll_ctl(ADD) failed.");
+      exit(1); }
+  }
+}
 
-  struct nlist *lookup = hash_lookup(file_request);
-  if (lookup != NULL) { // if file is in file hash, accept
-    lookup->defn->peers[lookup->defn->curr_peers] = clients[t_info->id].ip;
-    lookup->defn->curr_peers += 1;
-    send_tag = SEED_SUCCESS;
-    send(clients[t_info->id].sockfd, &send_tag, sizeof(tsize_t), MSG_NOSIGNAL);
-    printf("(%s) Now seeding file (%.8s...) in peerswarm of (%d).\n", 
-      clients[t_info->id].ip, file_request, lookup->defn->curr_peers);
-    return NULL;
+void *tracker_loop(void *args)
+{
+  struct epoll_event events[TRACKER_EVENTS], ev;
+  int n;
+
+  while (1) {
+    n = epoll_wait(epfd, events, TRACKER_EVENTS, -1);
+    if (n == -1 && errno != EINTR) {
+      perror("ERROR: epoll_wait() failed.");
+      exit(1); }
+
+    for (int i = 0; i < n; i++) {
+      if (events[i].data.ptr == &listen_mark) {
+        accept_clients();
+        ev.events = EPOLLIN | EPOLLONESHOT;
+        ev.data.ptr = &listen_mark;
+        epoll_ctl(epfd, EPOLL_CTL_MOD, listenfd, &ev);
+      }
+      else {
+        client_connect(events[i].data.ptr);
+      }
+    }
   }
-  else { // if file is not in hash, reject
-    struct peer_info *p_info;
-    p_info = malloc(sizeof(struct peer_info));
-    p_info->curr_peers = 0;
-    hash_install(file_request, p_info);
-    struct nlist *result = hash_lookup(file_request);
-    result->defn = p_info;  // this is very jimmy-rigged. should be set 
-                            // correctly the first time??
-    printf("(%s) Added new file: '(%.8s...)' to the network.\n", 
-      clients[t_info->id].ip, file_request);
-    p_info->peers[p_info->curr_peers] = clients[t_info->id].ip;
-    p_info->curr_peers += 1;
-    send_tag = SEED_SUCCESS;
-    send(clients[t_info->id].sockfd, &send_tag, sizeof(tsize_t), MSG_NOSIGNAL);
-    printf("(%s) Now seeding file (%.8s...) in peerswarm of (%d).\n", 
-      clients[t_info->id].ip, file_request, p_info->curr_peers);
-    return NULL;
-  } 
+  return NULL;
 }
 
-void *handle_add_request(void *args)
+/* an empty swarm with room for MIN_PEERS */
+static struct peer_info *peer_info_new(void)
 {
-  tsize_t send_tag;
-  struct thread_info *t_info;
   struct peer_info *p_info;
+
   p_info = malloc(sizeof(struct peer_info));
-  char file_request[65]; // must include null-terminating \0
-  
-  t_info = (struct thread_info *)args;
-  send_tag = ADD_APPROVED;
+  if (p_info) {
+    p_info->peers = malloc(MIN_PEERS * COMPACT_PEER_LEN);
+    p_info->timers = malloc(MIN_PEERS * sizeof(struct peer_timer *));
+    p_info->slots = calloc(2 * MIN_PEERS, sizeof(struct peer_timer *));
+    p_info->curr_peers = 0;
+    p_info->max_peers = MIN_PEERS;
+    p_info->completed = 0;
+    pthread_mutex_init(&p_info->shuffle_lock, NULL);
+  }
+  if (!p_info || !p_info->peers || !p_info->timers || !p_info->slots) {
+    perror("ERROR: malloc(peer_info) failed.");
+    exit(1); }
+  return p_info;
+}
 
-  send(clients[t_info->id].sockfd, &send_tag, sizeof(tsize_t), MSG_NOSIGNAL);
-  recv(clients[t_info->id].sockfd, &file_request, sizeof(char)*65, MSG_NOSIGNAL);
+/* put (t) in the slot of its (expires), never one that already ran */
+static void wheel_add(struct peer_wheel *w, struct peer_timer *t)
+{
+  long tick = t->expires / WHEEL_TICK;
 
-  if (hash_lookup(file_request) != NULL) { // if file is in file hash, reject
-    send_tag = ADD_FAIL;
-    send(clients[t_info->id].sockfd, &send_tag, sizeof(tsize_t), MSG_NOSIGNAL);
-    printf("(%s) Attempted to add file already on network!\n", 
-      clients[t_info->id].ip);
-    return NULL;
-  } 
-  else { // add our new file to our file hash
-    p_info->curr_peers = 0;
-    hash_install(file_request, p_info);
-    struct nlist *result = hash_lookup(file_request);
-    result->defn = p_info;  // this is very jimmy-rigged. should be set 
-                            // correctly the first time??
-    send_tag = ADD_SUCCESS;
-    send(clients[t_info->id].sockfd, &send_tag, sizeof(tsize_t), MSG_NOSIGNAL);
-    printf("(%s) Added new file: '(%.8s...)' to the network.\n", 
-      clients[t_info->id].ip, file_request);
-    return NULL;
+  if (w->tick == 0) {
+    w->tick = time(NULL) / WHEEL_TICK;
+  }
+  if (tick < w->tick) {
+    tick = w->tick;
   }
+  t->next = w->slots[tick % WHEEL_SLOTS];
+  w->slots[tick % WHEEL_SLOTS] = t;
 }
 
-void thread_init(struct client *client, int ntids) 
+/* 1 if (w) has slots to run by (now) */
+static int wheel_due(struct peer_wheel *w, time_t now)
 {
-  pthread_t *tid;
-  int ret;
-  struct thread_info *tid_info;
+  return w->tick != 0 && w->tick <= now / WHEEL_TICK;
+}
 
-  tid = malloc(sizeof(pthread_t));
-  if (!tid) { 
-    perror("ERROR: malloc(pthread_t) failed.");
-    exit(1); }
+/* home slot of (peer) in an index of (mask + 1) slots */
+static unsigned peer_hash(const unsigned char *peer, unsigned mask)
+{
+  unsigned long long key = 0;
 
-  tid_info = malloc(sizeof(struct thread_info));
-  if (!tid_info) {  
-    perror("ERROR: malloc(tid_info) failed.");
-    exit(1); }
-  tid_info->id = ntids;
-  tid_info->ntids = ntids;
-  tid_info->pthread_id = tid;
+  memcpy(&key, peer, COMPACT_PEER_LEN);
+  return (unsigned)((key * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+}
 
-  ret = pthread_create(tid, NULL, client_connect, tid_info);
-  if (ret) {
-    perror("ERROR: pthread_create() failed.");
-    exit(1); }
-  pthread_detach(*tid);
+/* slot of (peer) in the index of (p_info), or the empty one it would go
+ * in. the index holds timers, which follow their peer through
+ * peers_sample() and peer_remove(), so only adding and removing a peer
+ * touches it (its shard write locked) */
+static unsigned peer_slot(struct peer_info *p_info, const unsigned char *peer)
+{
+  unsigned mask = 2 * p_info->max_peers - 1;
+  unsigned s = peer_hash(peer, mask);
+  struct peer_timer *t;
+
+  while ((t = p_info->slots[s]) != NULL &&
+    memcmp(p_info->peers + t->index * COMPACT_PEER_LEN, peer,
+      COMPACT_PEER_LEN) != 0) {
+    s = (s + 1) & mask;
+  }
+  return s;
 }
 
-void *client_connect(void *args) 
+/* take peer (i) out of the index of (p_info), shifting back the timers
+ * after it that probed past its slot */
+static void peer_unindex(struct peer_info *p_info, int i)
 {
-  tsize_t send_tag, recv_tag;
-  struct thread_info *t_info;
+  unsigned mask = 2 * p_info->max_peers - 1;
+  unsigned hole = peer_slot(p_info, p_info->peers + i * COMPACT_PEER_LEN);
+  unsigned s, home;
+  struct peer_timer *t;
+
+  for (s = (hole + 1) & mask; (t = p_info->slots[s]) != NULL;
+    s = (s + 1) & mask) {
+    home = peer_hash(p_info->peers + t->index * COMPACT_PEER_LEN, mask);
+    if (((s - home) & mask) >= ((s - hole) & mask)) {
+      p_info->slots[hole] = t;
+      hole = s;
+    }
+  }
+  p_info->slots[hole] = NULL;
+}
 
-  t_info = (struct thread_info *)args;
+/* move the last peer of (p_info) into (i), its place in the swarm */
+static void peer_remove(struct peer_info *p_info, int i)
+{
+  int last = p_info->curr_peers - 1;
+
+  peer_unindex(p_info, i);
+  if (i != last) {
+    memcpy(p_info->peers + i * COMPACT_PEER_LEN,
+      p_info->peers + last * COMPACT_PEER_LEN, COMPACT_PEER_LEN);
+    p_info->timers[i] = p_info->timers[last];
+    p_info->timers[i]->index = i;
+  }
+  p_info->curr_peers--;
+}
 
-  // Client handshake
-  recv(clients[t_info->id].sockfd, &recv_tag, 1, 0);
-  send_tag = HANDSHAKE_OK;
-  if (recv_tag != HANDSHAKE) {
-    send_tag = HANDSHAKE_ERROR;
-    perror("ERROR: failed to make client-server handshake.\n"); 
+/* run the slots of (w) up to (now), dropping the peers that did not
+ * announce in time. only timers in those slots are looked at, so this
+ * costs what expired (plus what was refreshed) and not the whole swarm
+ * (the shard write locked) */
+static void wheel_expire(struct peer_wheel *w, time_t now)
+{
+  struct peer_timer *t, *next;
+  long last = now / WHEEL_TICK;
+  int expired = 0;
+
+  if (!wheel_due(w, now)) {
+    return;
+  }
+  /* after a whole turn without requests every slot is due once */
+  if (last - w->tick >= WHEEL_SLOTS) {
+    w->tick = last - WHEEL_SLOTS + 1;
+  }
+  while (w->tick <= last) {
+    t = w->slots[w->tick % WHEEL_SLOTS];
+    w->slots[w->tick % WHEEL_SLOTS] = NULL;
+    w->tick++;
+    for (; t != NULL; t = next) {
+      next = t->next;
+      if (t->swarm == NULL) {     // its peer sent STOPPED
+        free(t);
+        continue;
+      }
+      if (t->expires > now) {
+        wheel_add(w, t);
+        continue;
+      }
+      peer_remove(t->swarm, t->index);
+      free(t);
+      expired++;
+    }
   }
-  send(clients[t_info->id].sockfd, &send_tag, sizeof(tsize_t),
-             MSG_NOSIGNAL);
-  char client_ip[INET_ADDRSTRLEN];
+  if (expired > 0) {
+    log_record("Expired (%d) peers that stopped announcing.\n", expired);
+  }
+}
+
+/* index of (addr):(port) in (p_info), or -1 */
+static int peer_find(struct peer_info *p_info, struct in_addr addr,
+  unsigned short port)
+{
+  unsigned char peer[COMPACT_PEER_LEN];
+  struct peer_timer *t;
+
+  port = htons(port);
+  memcpy(peer, &addr.s_addr, 4);
+  memcpy(peer + 4, &port, 2);
+  t = p_info->slots[peer_slot(p_info, peer)];
+  return t ? t->index : -1;
+}
+
+/* append (addr):(port) to (p_info) with a timer in (w), growing it when
+ * it is full. returns -1 if it could not grow (its shard write locked) */
+static int peer_info_add(struct peer_info *p_info, struct peer_wheel *w,
+  struct in_addr addr, unsigned short port, time_t now)
+{
+  unsigned char *peers, *peer;
+  struct peer_timer **timers, **slots, *t;
 
-  // STEP (5) update struct clients[] with new client information
-  strcpy(client_ip, clients[t_info->id].ip);
+  if (p_info->curr_peers == p_info->max_peers) {
+    peers = realloc(p_info->peers, 2 * p_info->max_peers * COMPACT_PEER_LEN);
+    if (!peers) {
+      return -1;
+    }
+    p_info->peers = peers;
+    timers = realloc(p_info->timers,
+      2 * p_info->max_peers * sizeof(struct peer_timer *));
+    if (!timers) {
+      return -1;
+    }
+    p_info->timers = timers;
+    slots = calloc(4 * p_info->max_peers, sizeof(struct peer_timer *));
+    if (!slots) {
+      return -1;
+    }
+    free(p_info->slots);
+    p_info->slots = slots;
+    p_info->max_peers *= 2;
+    for (int i = 0; i < p_info->curr_peers; i++) {
+      slots[peer_slot(p_info, p_info->peers + i * COMPACT_PEER_LEN)] =
+        p_info->timers[i];
+    }
+  }
+  t = malloc(sizeof(struct peer_timer));
+  if (!t) {
+    return -1;
+  }
+  t->swarm = p_info;
+  t->index = p_info->curr_peers;
+  t->expires = now + PEER_TIMEOUT;
+  wheel_add(w, t);
+
+  peer = p_info->peers + p_info->curr_peers * COMPACT_PEER_LEN;
+  port = htons(port);
+  memcpy(peer, &addr.s_addr, 4);
+  memcpy(peer + 4, &port, 2);
+  p_info->timers[p_info->curr_peers] = t;
+  p_info->slots[peer_slot(p_info, peer)] = t;
+  p_info->curr_peers++;
+  return 0;
+}
+
+/* move a uniformly random (k) of the peers of (p_info) to its front, a
+ * partial Fisher-Yates shuffle. what is left behind stays a permutation of
+ * the swarm, so the next shuffle can start from it */
+static void peers_sample(struct peer_info *p_info, int k)
+{
+  unsigned char tmp[COMPACT_PEER_LEN];
+  unsigned char *peers = p_info->peers;
+  struct peer_timer *t;
+  int n = p_info->curr_peers;
+  int j;
+
+  if (shuffle_seed == 0) {
+    shuffle_seed = (unsigned)time(NULL) ^ (unsigned)pthread_self();
+  }
+  for (int i = 0; i < k && i < n - 1; i++) {
+    j = i + rand_r(&shuffle_seed) % (n - i);
+    memcpy(tmp, peers + i * COMPACT_PEER_LEN, COMPACT_PEER_LEN);
+    memcpy(peers + i * COMPACT_PEER_LEN, peers + j * COMPACT_PEER_LEN,
+      COMPACT_PEER_LEN);
+    memcpy(peers + j * COMPACT_PEER_LEN, tmp, COMPACT_PEER_LEN);
+    t = p_info->timers[i];
+    p_info->timers[i] = p_info->timers[j];
+    p_info->timers[j] = t;
+    p_info->timers[i]->index = i;
+    p_info->timers[j]->index = j;
+  }
+}
+
+void handle_file_request(struct client *c)
+{
+  struct peer_info *p_info;
+  struct peer_wheel *w = &wheels[hash_shard(c->msg_buffer)];
+  time_t now = time(NULL);
+  int numwant;
+
+  memcpy(&numwant, c->msg_buffer + 65, sizeof(int));
+  if (numwant < 0) {
+    reply_tag(c, INVALID_NUMWANT);
+    printf("(%s) Asked for (%d) peers!\n", c->ip, numwant);
+    return;
+  }
+  if (numwant == 0) {
+    numwant = NUMWANT_DEFAULT;
+  }
+  if (numwant > NUMWANT_MAX) {
+    numwant = NUMWANT_MAX;
+  }
+
+  hash_lock(c->msg_buffer, HASH_READ);
+  if (wheel_due(w, now)) {
+    /* drop the dead peers before handing any out */
+    hash_unlock(c->msg_buffer);
+    hash_lock(c->msg_buffer, HASH_WRITE);
+    wheel_expire(w, now);
+    hash_unlock(c->msg_buffer);
+    hash_lock(c->msg_buffer, HASH_READ);
+  }
+  struct nlist *lookup = hash_lookup(c->msg_buffer);
+
+  if (lookup != NULL) { // if file is in file hash, accept
+    p_info = lookup->defn;
+    if (numwant > p_info->curr_peers) {
+      numwant = p_info->curr_peers;
+    }
+    printf("(%s) Serving request of '(%.8s...)' on the network with"
+      " (%d/%d) peers.\n",
+      c->ip, lookup->name, numwant, p_info->curr_peers);
+    /* a different random subset every time, so leechers spread over the
+     * whole swarm. the peers are stored the way they are sent, so the
+     * subset is one copy into the reply */
+    reply_tag(c, REQUEST_FOUND);
+    reply_append(c, &numwant, sizeof(int));
+    pthread_mutex_lock(&p_info->shuffle_lock);
+    if (numwant < p_info->curr_peers) {
+      peers_sample(p_info, numwant);
+    }
+    reply_append(c, p_info->peers, (size_t)numwant * COMPACT_PEER_LEN);
+    pthread_mutex_unlock(&p_info->shuffle_lock);
+  }
+  else { // if file is not in hash, reject
+    reply_tag(c, REQUEST_NOT_FOUND);
+    printf("(%s) Attempted to request a file not on the network!\n",
+      c->ip);
+  }
+  hash_unlock(c->msg_buffer);
+}
 
-  log_record("(%s) Shook hands with client.\n", client_ip);
+/* an announce. STARTED and REANNOUNCE (re)start the peer's timeout,
+ * STOPPED takes it out of the swarm and COMPLETED counts a finished
+ * download, refreshing the peer if it is seeding */
+void handle_seed_request(struct client *c)
+{
+  char *file_request = c->msg_buffer;
+  struct peer_wheel *w = &wheels[hash_shard(file_request)];
+  struct peer_info *p_info;
+  time_t now = time(NULL);
+  int event, interval = ANNOUNCE_INTERVAL;
+  int i, ret = 0;
+
+  memcpy(&event, c->msg_buffer + 65, sizeof(int));
+  if (event < REANNOUNCE || event > COMPLETED) {
+    reply_tag(c, SEED_FAIL);
+    printf("(%s) Sent unknown announce event (%d)!\n", c->ip, event);
+    return;
+  }
 
-  /* This begins the recv/send client-server broadcast loop */
-  // STEP (1) recv message from server
-  if (recv(clients[t_info->id].sockfd, &recv_tag, sizeof(tsize_t), 0) == -1) {
-    perror(strerror(errno));
-    goto end;
+  hash_lock(file_request, HASH_WRITE);
+  wheel_expire(w, now);
+  struct nlist *lookup = hash_lookup(file_request);
+  if (lookup == NULL && (event == STARTED || event == REANNOUNCE)) {
+    /* if file is not in hash, add it */
+    lookup = hash_install(file_request, peer_info_new());
+    persist_log(PERSIST_ADD, file_request, NULL);
+    printf("(%s) Added new file: '(%.8s...)' to the network.\n",
+      c->ip, file_request);
   }
+  /* seeders take peer connections on P2P_PORTNUM, not on the port they
+   * reached us from */
+  p_info = lookup ? lookup->defn : NULL;
+  i = p_info ? peer_find(p_info, c->addr, P2P_PORTNUM) : -1;
+  switch (event) {
+    case REANNOUNCE:
+    case STARTED:
+        if (i != -1) {
+          p_info->timers[i]->expires = now + PEER_TIMEOUT;
+          break;
+        }
+        ret = peer_info_add(p_info, w, c->addr, P2P_PORTNUM, now);
+        if (ret == 0) {
+          persist_log(PERSIST_SEED, file_request,
+            p_info->peers + (p_info->curr_peers - 1) * COMPACT_PEER_LEN);
+          printf("(%s) Now seeding file (%.8s...) in peerswarm of (%d).\n",
+            c->ip, file_request, p_info->curr_peers);
+        }
+        break;
 
-  // STEP (1.a) recv RECV_TAG (1) byte tag
-  switch (recv_tag) {
-    case QUIT:
-        send_tag = QUIT;
-        send(clients[t_info->id].sockfd, &send_tag, sizeof(tsize_t),
-          MSG_NOSIGNAL);
+    case STOPPED:
+        if (i != -1) {
+          /* its timer goes once its slot comes up */
+          persist_log(PERSIST_STOP, file_request,
+            p_info->peers + i * COMPACT_PEER_LEN);
+          p_info->timers[i]->swarm = NULL;
+          peer_remove(p_info, i);
+          printf("(%s) Stopped seeding file (%.8s...), peerswarm of (%d).\n",
+            c->ip, file_request, p_info->curr_peers);
+        }
         break;
 
-    case ADD_REQUEST:
-        printf("(%s) Client usage_mode: ADD_REQUEST\n", client_ip);
-        handle_add_request(t_info);
+    case COMPLETED:
+        if (p_info == NULL) {
+          break;
+        }
+        p_info->completed++;
+        persist_log(PERSIST_COMPLETED, file_request, NULL);
+        if (i != -1) {
+          p_info->timers[i]->expires = now + PEER_TIMEOUT;
+        }
+        printf("(%s) Finished downloading file (%.8s...), (%ld) so far.\n",
+          c->ip, file_request, p_info->completed);
         break;
+  }
+  if (ret == -1) {
+    reply_tag(c, SEED_FAIL);
+    printf("(%s) Swarm of (%.8s...) could not grow.\n", c->ip,
+      file_request);
+  }
+  else {
+    reply_tag(c, SEED_SUCCESS);
+    reply_append(c, &interval, sizeof(int));
+  }
+  hash_unlock(file_request);
+}
+
+void handle_add_request(struct client *c)
+{
+  char *file_request = c->msg_buffer;
 
-    case SEED_REQUEST:
-        printf("(%s) Client usage_mode: SEED_REQUEST\n", client_ip);
-        handle_seed_request(t_info);
+  hash_lock(file_request, HASH_WRITE);
+  if (hash_lookup(file_request) != NULL) { // if file is in file hash, reject
+    reply_tag(c, ADD_FAIL);
+    printf("(%s) Attempted to add file already on network!\n", c->ip);
+  }
+  else { // add our new file to our file hash
+    hash_install(file_request, peer_info_new());
+    persist_log(PERSIST_ADD, file_request, NULL);
+    reply_tag(c, ADD_SUCCESS);
+    printf("(%s) Added new file: '(%.8s...)' to the network.\n",
+      c->ip, file_request);
+  }
+  hash_unlock(file_request);
+}
+
+static void restore_record(struct persist_record *r, int snapshot)
+{
+  static struct nlist *last;    // file of the record before, a snapshot
+  static struct peer_wheel *w;  // has all of a file's records in a row
+  char name[sizeof(r->name) + 1];
+  struct nlist *lookup;
+  struct in_addr addr;
+  unsigned short port;
+  int i;
+
+  memcpy(&addr.s_addr, r->peer, 4);
+  memcpy(&port, r->peer + 4, 2);
+  port = ntohs(port);
+
+  /* nothing else runs during recovery, so no locks are needed and the
+   * entry of the last file stays put */
+  if (last != NULL && strncmp(last->name, r->name, sizeof(r->name)) == 0) {
+    lookup = last;
+  }
+  else {
+    memcpy(name, r->name, sizeof(r->name));
+    name[sizeof(r->name)] = '\0';
+    lookup = hash_lookup(name);
+    if (lookup == NULL && r->type != PERSIST_STOP) {
+      lookup = hash_install(name, peer_info_new());
+    }
+    if (lookup == NULL) {
+      return;     // a STOP for a file we don't have
+    }
+    last = lookup;
+    w = &wheels[hash_shard(name)];
+  }
+
+  switch (r->type) {
+    case PERSIST_ADD:
+        lookup->defn->completed += r->count;
+        break;
+    case PERSIST_SEED:
+        /* a snapshot has each peer once, no need to look for it */
+        if (snapshot || peer_find(lookup->defn, addr, port) == -1) {
+          peer_info_add(lookup->defn, w, addr, port, time(NULL));
+        }
+        break;
+    case PERSIST_STOP:
+        if ((i = peer_find(lookup->defn, addr, port)) != -1) {
+          lookup->defn->timers[i]->swarm = NULL;
+          peer_remove(lookup->defn, i);
+        }
         break;
+    case PERSIST_COMPLETED:
+        lookup->defn->completed++;
+        break;
+  }
+}
+
+/* # of bytes of the message that (c) sends next, once it is on to
+ * (c->after_reply) */
+static size_t conn_msg_len(struct client *c)
+{
+  if (c->after_reply != CONN_INFO_HASH) {
+    return sizeof(tsize_t);
+  }
+  /* a file request also says how many peers it wants (0 for any), and
+   * an announce its event */
+  if (c->request == FILE_REQUEST || c->request == SEED_REQUEST) {
+    return sizeof(char)*65 + sizeof(int);
+  }
+  return sizeof(char)*65;
+}
 
-    case FILE_REQUEST:
-        printf("(%s) Client usage_mode: FILE_REQUEST\n", client_ip);
-        handle_file_request(t_info);
+/* act on the message that was just read into c->msg_buffer: queue the
+ * reply and pick the state that follows it */
+static void client_dispatch(struct client *c)
+{
+  tsize_t recv_tag = (tsize_t)c->msg_buffer[0];
+
+  c->out_len = 0;
+  c->out_off = 0;
+  switch (c->state) {
+    case CONN_HANDSHAKE:
+      if (recv_tag != HANDSHAKE) {
+        fprintf(stderr, "ERROR: failed to make client-server handshake.\n");
+        reply_tag(c, HANDSHAKE_ERROR);
+        c->after_reply = CONN_CLOSE;
         break;
+      }
+      log_record("(%s) Shook hands with client.\n", c->ip);
+      reply_tag(c, HANDSHAKE_OK);
+      c->after_reply = CONN_REQUEST;
+      break;
+
+    case CONN_REQUEST:
+      c->request = recv_tag;
+      c->after_reply = CONN_INFO_HASH;
+      switch (recv_tag) {
+        case QUIT:
+            reply_tag(c, QUIT);
+            c->after_reply = CONN_CLOSE;
+            break;
+
+        case ADD_REQUEST:
+            log_record("(%s) Client usage_mode: ADD_REQUEST\n", c->ip);
+            reply_tag(c, ADD_APPROVED);
+            break;
+
+        case SEED_REQUEST:
+            log_record("(%s) Client usage_mode: SEED_REQUEST\n", c->ip);
+            reply_tag(c, SEED_APPROVED);
+            break;
+
+        case FILE_REQUEST:
+            log_record("(%s) Client usage_mode: FILE_REQUEST\n", c->ip);
+            reply_tag(c, REQUEST_APPROVED);
+            break;
+
+        default:
+            fprintf(stderr, "ERROR: recieved unexpected tag (%d) from "
+              "client.\n", recv_tag);
+            c->state = CONN_CLOSE;
+            return;
+      }
+      break;
+
+    case CONN_INFO_HASH:
+      c->msg_buffer[64] = '\0';   // must include null-terminating \0
+      switch (c->request) {
+        case ADD_REQUEST:
+            handle_add_request(c);
+            break;
+        case SEED_REQUEST:
+            handle_seed_request(c);
+            break;
+        case FILE_REQUEST:
+            handle_file_request(c);
+            break;
+      }
+      /* the client may follow up with another request */
+      c->after_reply = CONN_HANDSHAKE;
+      break;
 
     default:
-        fprintf(stderr, "ERROR: recieved unexpected tag (%d) from client.\n", recv_tag);
+      abort();
+  }
+  c->state = CONN_REPLY;
+}
+
+void client_connect(struct client *c)
+{
+  int ret;
+
+  while (1) {
+    switch (c->state) {
+      case CONN_HANDSHAKE:
+      case CONN_REQUEST:
+      case CONN_INFO_HASH:
+        ret = conn_read(c);
+        if (ret == 0) {
+          conn_arm(c, EPOLLIN);
+          return;
+        }
+        if (ret == -1) {
+          c->state = CONN_CLOSE;
+          break;
+        }
+        client_dispatch(c);
+        break;
+
+      case CONN_REPLY:
+        ret = conn_write(c);
+        if (ret == 0) {
+          conn_arm(c, EPOLLOUT);
+          return;
+        }
+        if (ret == -1) {
+          c->state = CONN_CLOSE;
+          break;
+        }
+        conn_expect(c, c->after_reply, conn_msg_len(c));
         break;
-    }
 
-end: 
-  /* Make sure to free up at the end! */
-  free(t_info->pthread_id);
-  free(t_info);
-  pthread_exit(NULL);
+      case CONN_CLOSE:
+        slot_release(c);
+        return;
+    }
+  }
 }
@@ -0,0 +1,278 @@
+/*
+ * Swarthmore College, CS 87
+ * Copyright (c) 2020 Swarthmore College Computer Science Department,
+ * Swarthmore PA, Professor Tia Newhall
+ *
+ * SLY: uring.c
+ * Authors: Sasha Casada, Yatin Lala, and Leo Douhovnikoff (12-18-2023)
+ */
+
+/**
+ * Just enough io_uring for the seeder's disk -> socket path: a read of a
+ * chunk into a registered buffer from a registered file, linked to the
+ * send of that buffer, so a whole chunk costs one io_uring_enter() and no
+ * copies through user space.
+ *
+ * https://kernel.dk/io_uring.pdf
+ * https://man7.org/linux/man-pages/man7/io_uring.7.html
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include "shared.h"
+#include "uring.h"
+
+///////////////////////////////////////////////////////////////////////////////
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+  return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit)
+{
+  return (int)syscall(__NR_io_uring_enter, fd, to_submit, 0, 0, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, 
+  unsigned nr_args)
+{
+  return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/* undo the mmap()s of uring_init() and close the ring, for when it gives
+ * up on io_uring part way */
+static void uring_unmap(struct uring *ring, char *sq_ptr, size_t sq_size,
+  size_t sqes_size)
+{
+  munmap(ring->bufs, (size_t)URING_BUFFERS * URING_BUF_SIZE);
+  free(ring->free_bufs);
+  munmap(ring->sqes, sqes_size);
+  munmap(sq_ptr, sq_size);
+  pthread_mutex_destroy(&ring->lock);
+  close(ring->fd);
+  ring->fd = -1;
+}
+
+int uring_init(struct uring *ring, int nfiles)
+{
+  struct io_uring_params p;
+  struct iovec iov[URING_BUFFERS];
+  size_t sq_size, cq_size;
+  char *sq_ptr, *cq_ptr;
+  int *files;
+
+  memset(&p, 0, sizeof(p));
+  ring->fd = sys_io_uring_setup(URING_ENTRIES, &p);
+  if (ring->fd == -1) {
+    log_record("io_uring not available (%s), using sendfile.\n", 
+      strerror(errno));
+    return -1;
+  }
+  /* sends on non-blocking sockets need the kernel to poll for us */
+  if (!(p.features & IORING_FEAT_SINGLE_MMAP) || 
+    !(p.features & IORING_FEAT_FAST_POLL) || 
+    !(p.features & IORING_FEAT_NODROP)) {
+    log_record("io_uring too old (features %x), using sendfile.\n", 
+      p.features);
+    close(ring->fd);
+    return -1;
+  }
+
+  sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (cq_size > sq_size) {
+    sq_size = cq_size;
+  }
+  sq_ptr = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, 
+    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  ring->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), 
+    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, 
+    IORING_OFF_SQES);
+  if (sq_ptr == MAP_FAILED || ring->sqes == MAP_FAILED) {
+    perror("ERROR: mmap(io_uring) failed.");
+    exit(1); }
+  cq_ptr = sq_ptr;  // IORING_FEAT_SINGLE_MMAP
+
+  ring->sq_head = (unsigned *)(sq_ptr + p.sq_off.head);
+  ring->sq_tail = (unsigned *)(sq_ptr + p.sq_off.tail);
+  ring->sq_mask = (unsigned *)(sq_ptr + p.sq_off.ring_mask);
+  ring->sq_array = (unsigned *)(sq_ptr + p.sq_off.array);
+  ring->cq_head = (unsigned *)(cq_ptr + p.cq_off.head);
+  ring->cq_tail = (unsigned *)(cq_ptr + p.cq_off.tail);
+  ring->cq_mask = (unsigned *)(cq_ptr + p.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq_ptr + p.cq_off.cqes);
+  pthread_mutex_init(&ring->lock, NULL);
+
+  /* registered buffers */
+  ring->bufs = mmap(NULL, (size_t)URING_BUFFERS * URING_BUF_SIZE, 
+    PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  ring->free_bufs = malloc(sizeof(int) * URING_BUFFERS);
+  if (ring->bufs == MAP_FAILED || !ring->free_bufs) {
+    perror("ERROR: allocating io_uring buffers failed.");
+    exit(1); }
+  for (int i = 0; i < URING_BUFFERS; i++) {
+    iov[i].iov_base = ring->bufs + (size_t)i * URING_BUF_SIZE;
+    iov[i].iov_len = URING_BUF_SIZE;
+    ring->free_bufs[i] = i;
+  }
+  ring->nfree = URING_BUFFERS;
+  if (sys_io_uring_register(ring->fd, IORING_REGISTER_BUFFERS, iov, 
+    URING_BUFFERS) == -1) {
+    log_record("io_uring can't register buffers (%s), using sendfile.\n",
+      strerror(errno));
+    uring_unmap(ring, sq_ptr, sq_size,
+      p.sq_entries * sizeof(struct io_uring_sqe));
+    return -1;
+  }
+
+  /* registered file table, every slot empty to start with */
+  files = malloc(sizeof(int) * nfiles);
+  if (!files) {
+    perror("ERROR: malloc(files) failed.");
+    exit(1); }
+  for (int i = 0; i < nfiles; i++) {
+    files[i] = -1;
+  }
+  ring->nfiles = nfiles;
+  if (sys_io_uring_register(ring->fd, IORING_REGISTER_FILES, files, 
+    nfiles) == -1) {
+    log_record("io_uring can't register files (%s), using sendfile.\n",
+      strerror(errno));
+    free(files);
+    uring_unmap(ring, sq_ptr, sq_size,
+      p.sq_entries * sizeof(struct io_uring_sqe));
+    return -1;
+  }
+  free(files);
+  log_record("io_uring ready: %u entries, (%d) x %d KiB buffers, (%d) "
+    "file slots.\n", p.sq_entries, URING_BUFFERS, URING_BUF_SIZE / 1024, 
+    nfiles);
+  return 0;
+}
+
+int uring_set_file(struct uring *ring, int slot, int fd)
+{
+  struct io_uring_files_update up;
+
+  if (slot < 0 || slot >= ring->nfiles) {
+    return -1;
+  }
+  memset(&up, 0, sizeof(up));
+  up.offset = slot;
+  up.fds = (uint64_t)(uintptr_t)&fd;
+  if (sys_io_uring_register(ring->fd, IORING_REGISTER_FILES_UPDATE, &up, 1)
+    != 1) {
+    return -1;
+  }
+  return 0;
+}
+
+int uring_get_buf(struct uring *ring)
+{
+  int buf = -1;
+
+  pthread_mutex_lock(&ring->lock);
+  if (ring->nfree > 0) {
+    buf = ring->free_bufs[--ring->nfree];
+  }
+  pthread_mutex_unlock(&ring->lock);
+  return buf;
+}
+
+void uring_put_buf(struct uring *ring, int buf)
+{
+  pthread_mutex_lock(&ring->lock);
+  ring->free_bufs[ring->nfree++] = buf;
+  pthread_mutex_unlock(&ring->lock);
+}
+
+/* next free submission entry (ring->lock held); NULL if the queue is full */
+static struct io_uring_sqe *get_sqe(struct uring *ring, unsigned *tail)
+{
+  unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+  struct io_uring_sqe *sqe;
+
+  if (*tail - head >= *ring->sq_mask + 1) {
+    return NULL;
+  }
+  sqe = &ring->sqes[*tail & *ring->sq_mask];
+  ring->sq_array[*tail & *ring->sq_mask] = *tail & *ring->sq_mask;
+  (*tail)++;
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+int uring_read_send(struct uring *ring, int slot, off_t offset, int sockfd,
+  int buf, long len, uint64_t user_data)
+{
+  struct io_uring_sqe *read_sqe, *send_sqe;
+  char *addr = ring->bufs + (size_t)buf * URING_BUF_SIZE;
+  unsigned tail;
+  int ret;
+
+  pthread_mutex_lock(&ring->lock);
+  tail = *ring->sq_tail;
+  read_sqe = get_sqe(ring, &tail);
+  send_sqe = get_sqe(ring, &tail);
+  if (read_sqe == NULL || send_sqe == NULL) {
+    pthread_mutex_unlock(&ring->lock);
+    return -1;
+  }
+
+  read_sqe->opcode = IORING_OP_READ_FIXED;
+  read_sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+  read_sqe->fd = slot;
+  read_sqe->off = offset;
+  read_sqe->addr = (uint64_t)(uintptr_t)addr;
+  read_sqe->len = len;
+  read_sqe->buf_index = buf;
+  read_sqe->user_data = user_data;
+
+  send_sqe->opcode = IORING_OP_SEND;
+  send_sqe->fd = sockfd;
+  send_sqe->addr = (uint64_t)(uintptr_t)addr;
+  send_sqe->len = len;
+  send_sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+  send_sqe->user_data = user_data | URING_SEND;
+
+  __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+  do {
+    ret = sys_io_uring_enter(ring->fd, 2);
+  } while (ret == -1 && errno == EINTR);
+  pthread_mutex_unlock(&ring->lock);
+  /* once queued the pair will run, anything the kernel didn't take now is
+   * submitted again by uring_reap() */
+  return 0;
+}
+
+int uring_reap(struct uring *ring, struct io_uring_cqe *cqes, int max)
+{
+  unsigned head, tail, unsubmitted;
+  int n = 0;
+
+  pthread_mutex_lock(&ring->lock);
+  unsubmitted = *ring->sq_tail - __atomic_load_n(ring->sq_head, 
+    __ATOMIC_ACQUIRE);
+  if (unsubmitted > 0) {
+    sys_io_uring_enter(ring->fd, unsubmitted);
+  }
+  pthread_mutex_unlock(&ring->lock);
+
+  head = *ring->cq_head;
+  tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+  while (head != tail && n < max) {
+    cqes[n++] = ring->cqes[head & *ring->cq_mask];
+    head++;
+  }
+  __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+  return n;
+}
@@ -0,0 +1,247 @@
+/*
+ * Swarthmore College, CS 87
+ * Copyright (c) 2020 Swarthmore College Computer Science Department,
+ * Swarthmore PA, Professor Tia Newhall
+ *
+ * SLY: workpool.c
+ * Authors: Sasha Casada, Yatin Lala, and Leo Douhovnikoff (12-18-2023)
+ */
+
+/**
+ * Work-stealing thread pool. Every worker owns a deque: jobs it submits
+ * itself go on its tail and it runs newest first, which keeps a job's
+ * follow-up work on the same (cache-warm) thread. A worker with an empty
+ * deque steals the oldest job from another worker. Jobs submitted from
+ * outside the pool are spread round robin over the deques.
+ *
+ * Sleeping uses the usual counter handshake: a submitter bumps (pending)
+ * before looking at (sleepers), a worker bumps (sleepers) before looking
+ * at (pending), so one of them always sees the other.
+ *
+ * https://en.wikipedia.org/wiki/Work_stealing
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "shared.h"
+#include "workpool.h"
+
+////////////////////////////// DEFINITIONS ////////////////////////////////////
+
+/* the pool and deque index of the calling thread, if it is a worker */
+static __thread struct workpool *my_pool;
+static __thread int my_index;
+
+/* what each worker thread is started with */
+struct worker_args {
+  struct workpool *pool;
+  int index;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+
+/* grow (dq) to twice its size (dq->lock held) */
+static void deque_grow(struct work_deque *dq)
+{
+  struct work_item *items;
+
+  items = malloc(sizeof(struct work_item) * dq->cap * 2);
+  if (!items) {
+    perror("ERROR: malloc(work_item) failed.");
+    exit(1); }
+  for (int i = 0; i < dq->count; i++) {
+    items[i] = dq->items[(dq->head + i) % dq->cap];
+  }
+  free(dq->items);
+  dq->items = items;
+  dq->head = 0;
+  dq->cap *= 2;
+}
+
+/* queue (item) on deque (idx) of (pool), at the tail or at the head */
+static void deque_push(struct workpool *pool, int idx, struct work_item item,
+  int at_head)
+{
+  struct work_deque *dq = &pool->deques[idx];
+
+  pthread_mutex_lock(&dq->lock);
+  if (dq->count == dq->cap) {
+    deque_grow(dq);
+  }
+  if (at_head) {
+    dq->head = (dq->head + dq->cap - 1) % dq->cap;
+    dq->items[dq->head] = item;
+  }
+  else {
+    dq->items[(dq->head + dq->count) % dq->cap] = item;
+  }
+  dq->count++;
+  if (dq->count > pool->max_depth) {
+    pool->max_depth = dq->count;    // racy max, only used for the log
+  }
+  pthread_mutex_unlock(&dq->lock);
+}
+
+/* take a job off deque (idx): the newest if (steal) is 0, else the oldest.
+ * returns 1 if (item) was filled in */
+static int deque_pop(struct workpool *pool, int idx, struct work_item *item,
+  int steal)
+{
+  struct work_deque *dq = &pool->deques[idx];
+  int found = 0;
+
+  pthread_mutex_lock(&dq->lock);
+  if (dq->count > 0) {
+    if (steal) {
+      *item = dq->items[dq->head];
+      dq->head = (dq->head + 1) % dq->cap;
+    }
+    else {
+      *item = dq->items[(dq->head + dq->count - 1) % dq->cap];
+    }
+    dq->count--;
+    found = 1;
+  }
+  pthread_mutex_unlock(&dq->lock);
+  return found;
+}
+
+/* find a job for worker (idx): its own deque first, then everybody else's */
+static int find_work(struct workpool *pool, int idx, struct work_item *item)
+{
+  if (deque_pop(pool, idx, item, 0)) {
+    return 1;
+  }
+  for (int i = 1; i < pool->nthreads; i++) {
+    if (deque_pop(pool, (idx + i) % pool->nthreads, item, 1)) {
+      __atomic_add_fetch(&pool->stolen, 1, __ATOMIC_RELAXED);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* worker thread: run jobs forever, sleeping while the pool is empty */
+static void *workpool_thread(void *args)
+{
+  struct worker_args *w = (struct worker_args *)args;
+  struct workpool *pool = w->pool;
+  struct work_item item;
+
+  my_pool = pool;
+  my_index = w->index;
+  free(w);
+
+  while (1) {
+    if (find_work(pool, my_index, &item)) {
+      __atomic_sub_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+      item.fn(item.arg);
+      __atomic_add_fetch(&pool->executed, 1, __ATOMIC_RELAXED);
+      continue;
+    }
+    pthread_mutex_lock(&pool->lock);
+    __atomic_add_fetch(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) == 0) {
+      pthread_cond_wait(&pool->cond, &pool->lock);
+    }
+    __atomic_sub_fetch(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&pool->lock);
+  }
+  return NULL;
+}
+
+/* queue a job and wake a sleeping worker for it */
+static void workpool_queue(struct workpool *pool, void (*fn)(void *), 
+  void *arg, int at_head)
+{
+  struct work_item item;
+  int idx;
+
+  item.fn = fn;
+  item.arg = arg;
+  if (my_pool == pool) {
+    idx = my_index;
+  }
+  else {
+    idx = __atomic_fetch_add(&pool->next_victim, 1, __ATOMIC_RELAXED);
+    idx = (unsigned)idx % pool->nthreads;
+  }
+  deque_push(pool, idx, item, at_head);
+  __atomic_add_fetch(&pool->submitted, 1, __ATOMIC_RELAXED);
+
+  __atomic_add_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&pool->sleepers, __ATOMIC_SEQ_CST) > 0) {
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+  }
+}
+
+void workpool_init(struct workpool *pool, char *name, int nthreads)
+{
+  struct worker_args *w;
+  int ret;
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->cond, NULL);
+  pool->pending = 0;
+  pool->sleepers = 0;
+  pool->next_victim = 0;
+  pool->submitted = 0;
+  pool->executed = 0;
+  pool->stolen = 0;
+  pool->max_depth = 0;
+  pool->name = name;
+  pool->nthreads = nthreads;
+  pool->threads = malloc(sizeof(pthread_t) * nthreads);
+  pool->deques = malloc(sizeof(struct work_deque) * nthreads);
+  if (!pool->threads || !pool->deques) {
+    perror("ERROR: malloc(pthread_t) failed.");
+    exit(1); }
+
+  for (int i = 0; i < nthreads; i++) {
+    pthread_mutex_init(&pool->deques[i].lock, NULL);
+    pool->deques[i].cap = WORKPOOL_DEQUE_INIT;
+    pool->deques[i].head = 0;
+    pool->deques[i].count = 0;
+    pool->deques[i].items = malloc(sizeof(struct work_item) * 
+      WORKPOOL_DEQUE_INIT);
+    if (!pool->deques[i].items) {
+      perror("ERROR: malloc(work_item) failed.");
+      exit(1); }
+  }
+  for (int i = 0; i < nthreads; i++) {
+    w = malloc(sizeof(struct worker_args));
+    if (!w) {
+      perror("ERROR: malloc(worker_args) failed.");
+      exit(1); }
+    w->pool = pool;
+    w->index = i;
+    ret = pthread_create(&pool->threads[i], NULL, workpool_thread, w);
+    if (ret) {
+      perror("ERROR: pthread_create() failed.");
+      exit(1); }
+    pthread_detach(pool->threads[i]);
+  }
+  log_record("Started %s pool with (%d) workers.\n", name, nthreads);
+}
+
+void workpool_submit(struct workpool *pool, void (*fn)(void *), void *arg)
+{
+  workpool_queue(pool, fn, arg, 0);
+}
+
+void workpool_yield(struct workpool *pool, void (*fn)(void *), void *arg)
+{
+  workpool_queue(pool, fn, arg, 1);
+}
+
+void workpool_get_stats(struct workpool *pool, struct workpool_stats *stats)
+{
+  stats->depth = __atomic_load_n(&pool->pending, __ATOMIC_RELAXED);
+  stats->max_depth = pool->max_depth;
+  stats->submitted = __atomic_load_n(&pool->submitted, __ATOMIC_RELAXED);
+  stats->executed = __atomic_load_n(&pool->executed, __ATOMIC_RELAXED);
+  stats->stolen = __atomic_load_n(&pool->stolen, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,114 @@
+#!/bin/bash
+#
+# SLY: ledbat_test.sh
+# Compares a plain TCP download against a LEDBAT (-b) download through an
+# emulated bottleneck on the loopback interface. While each download runs
+# we probe the round trip time through the same queue (a TCP connect to a
+# closed port), so the added queuing delay of each transport shows up next
+# to its throughput.
+#
+# Needs root for tc(8). Run from anywhere:
+#   sudo ./ledbat_test.sh [-r <rate>] [-m <file_MiB>] [-q <queue_ms>]
+
+RATE=20mbit
+SIZE_MB=16
+QUEUE_MS=400
+
+while getopts "hr:m:q:" OPTION
+do
+   case $OPTION in
+       h)
+         echo "USAGE: sudo ./ledbat_test.sh [-r <rate>] [-m <file_MiB>] [-q <queue_ms>]"
+         exit 0
+         ;;
+       r)
+         RATE=$OPTARG
+         ;;
+       m)
+         SIZE_MB=$OPTARG
+         ;;
+       q)
+         QUEUE_MS=$OPTARG
+         ;;
+       ?)
+         exit -1
+         ;;
+     esac
+done
+
+script_dir="$(dirname "$(readlink -f "$0")")"
+BIN="$script_dir/../bin"
+WORK="$(mktemp -d)"
+
+cleanup() {
+  tc qdisc del dev lo root 2> /dev/null
+  kill $(jobs -p) 2> /dev/null
+  rm -rf "$WORK"
+}
+trap cleanup EXIT INT TERM
+
+# current time in microseconds
+now_us() {
+  echo $(( $(date +%s%N) / 1000 ))
+}
+
+# probe the loopback queue every 100ms until killed, one rtt (us) per line
+probe_rtt() {
+  while true; do
+    start=$(now_us)
+    (exec 3<> /dev/tcp/127.0.0.1/1) 2> /dev/null
+    echo $(( $(now_us) - start ))
+    sleep 0.1
+  done
+}
+
+# run one download; $1 is the label, the rest are extra client flags
+run_download() {
+  label=$1; shift
+  rm -rf "$WORK/download"; mkdir "$WORK/download"
+
+  probe_rtt > "$WORK/rtt.$label" &
+  probe=$!
+  start=$(now_us)
+  (cd "$WORK" && "$BIN/client" -f "$WORK/test.sly" -r "$WORK/download" "$@" \
+    > "$WORK/request.$label.out" 2>&1)
+  elapsed=$(( $(now_us) - start ))
+  kill $probe; wait $probe 2> /dev/null
+
+  if ! cmp -s "$WORK/seed/test.bin" "$WORK/download/test.bin"; then
+    echo "$label: FAILED, downloaded file does not match"
+    return
+  fi
+  awk -v label="$label" -v us="$elapsed" -v mb="$SIZE_MB" '
+    { sum += $1; n++; if ($1 > max) max = $1 }
+    END { printf "%-7s %8.2f MiB/s   rtt avg %7.2f ms   rtt max %7.2f ms\n",
+      label, mb / (us / 1000000), sum / n / 1000, max / 1000 }' \
+    "$WORK/rtt.$label"
+}
+
+# (1) build a random file and its .sly pointing at a loopback tracker
+mkdir "$WORK/seed"
+head -c $(( SIZE_MB * 1024 * 1024 )) /dev/urandom > "$WORK/seed/test.bin"
+(cd "$WORK" && "$script_dir/../../generate_torrent/generate_torrent.sh" \
+  -i 127.0.0.1 -f "$WORK/seed/test.bin" > /dev/null)
+
+# (2) tracker, add and seed
+(cd "$WORK" && exec "$BIN/tracker" > tracker.out 2>&1) &
+sleep 1
+(cd "$WORK" && "$BIN/client" -a -f "$WORK/test.sly" > add.out 2>&1)
+(cd "$WORK" && exec "$BIN/client" -f "$WORK/test.sly" -s "$WORK/seed" \
+  > seed.out 2>&1) &
+sleep 1
+
+# (3) bottleneck: token bucket at $RATE with a $QUEUE_MS ms deep queue
+tc qdisc add dev lo root tbf rate $RATE burst 100kb latency ${QUEUE_MS}ms \
+  || exit 1
+echo "Bottleneck: $RATE, ${QUEUE_MS}ms queue, ${SIZE_MB} MiB file"
+
+probe_rtt > "$WORK/rtt.idle" &
+sleep 2; kill $!
+awk '{ sum += $1; n++ } END { printf "idle    rtt avg %7.2f ms\n", sum / n / 1000 }' \
+  "$WORK/rtt.idle"
+
+run_download tcp
+run_download ledbat -b